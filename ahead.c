@@ -0,0 +1,254 @@
+#include "ahead.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*  ahead_fill
+    Lee un bloque completo: una tuberia entrega lo que tenga, asi que se
+    sigue leyendo hasta llenarlo o llegar al final. Solo se puede cancelar
+    el hilo mientras espera en read().
+
+    Devuelve los bytes leidos (menos de blksize solo al final), o -1
+*/
+
+static ssize_t ahead_fill ( tftp_ahead_t *ahead, u_char *p ) {
+    size_t  got = 0;
+    ssize_t n;
+
+    while ( got < ahead->blksize ) {
+        pthread_setcancelstate ( PTHREAD_CANCEL_ENABLE, NULL );
+        n = read ( ahead->fd, p + got, ahead->blksize - got );
+        pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE, NULL );
+
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+
+        if ( n == 0 )
+            break;
+
+        got += n;
+    }
+
+    return got;
+}
+
+/*  ahead_notify
+    Avisa al bucle si ya esta el bloque que esperaba, o si el hilo fallo
+    (con el cerrojo tomado)
+*/
+
+static void ahead_notify ( tftp_ahead_t *ahead ) {
+    if ( ahead->want == 0
+         || ( ahead->want >= ahead->read && ahead->error == 0 ) )
+        return;
+
+    ahead->want = 0;
+    eventfd_write ( ahead->efd, 1 );
+}
+
+/*  ahead_main
+    Hilo lector: llena slots mientras haya sitio, hasta el bloque corto
+*/
+
+static void *ahead_main ( void *arg ) {
+    tftp_ahead_t *ahead = arg;
+    unsigned      i;
+    ssize_t       n;
+
+    pthread_setcancelstate ( PTHREAD_CANCEL_DISABLE, NULL );
+    pthread_mutex_lock ( &ahead->lock );
+
+    while ( !ahead->closed ) {
+        if ( ahead->read - ahead->base >= ahead->nslots ) {
+            pthread_cond_wait ( &ahead->room, &ahead->lock );
+            continue;
+        }
+
+        /*  El slot de read no es el de ningun bloque sin confirmar, el bucle
+            no lo toca mientras se llena */
+
+        i = ahead->read % ahead->nslots;
+        pthread_mutex_unlock ( &ahead->lock );
+
+        n = ahead_fill ( ahead, ahead->slot[i] );
+
+        pthread_mutex_lock ( &ahead->lock );
+
+        if ( n == -1 ) {
+            ahead->error = errno;
+            ahead_notify ( ahead );
+            break;
+        }
+
+        ahead->len[i] = n;
+
+        if ( ( size_t ) n < ahead->blksize )
+            ahead->last = ahead->read;
+
+        ahead->read++;
+        ahead_notify ( ahead );
+
+        if ( ahead->last != 0 )
+            break;
+    }
+
+    pthread_mutex_unlock ( &ahead->lock );
+
+    return NULL;
+}
+
+static void ahead_free ( tftp_ahead_t *ahead ) {
+    unsigned i;
+
+    for ( i = 0; i < ahead->nslots && ahead->slot != NULL; i++ )
+        free ( ahead->slot[i] );
+
+    free ( ahead->slot );
+    free ( ahead->len );
+    free ( ahead );
+}
+
+/*  ahead_start
+    Arranca la lectura de fd en bloques de blksize, desde el bloque 1
+
+    Devuelve el lector, o NULL con errno
+*/
+
+tftp_ahead_t *ahead_start ( int fd, size_t blksize, unsigned nslots ) {
+    tftp_ahead_t *ahead = calloc ( 1, sizeof ( tftp_ahead_t ) );
+    unsigned      i;
+    int           error;
+
+    if ( ahead == NULL )
+        return NULL;
+
+    ahead->fd      = fd;
+    ahead->blksize = blksize;
+    ahead->nslots  = nslots;
+    ahead->base    = 1;
+    ahead->read    = 1;
+    ahead->slot    = calloc ( nslots, sizeof ( u_char * ) );
+    ahead->len     = calloc ( nslots, sizeof ( size_t ) );
+
+    for ( i = 0; ahead->slot != NULL && i < nslots; i++ )
+        if ( ( ahead->slot[i] = malloc ( blksize ) ) == NULL )
+            break;
+
+    if ( ahead->slot == NULL || ahead->len == NULL || i < nslots ) {
+        ahead_free ( ahead );
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if ( ( ahead->efd = eventfd ( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) == -1 ) {
+        error = errno;
+        ahead_free ( ahead );
+        errno = error;
+        return NULL;
+    }
+
+    pthread_mutex_init ( &ahead->lock, NULL );
+    pthread_cond_init ( &ahead->room, NULL );
+
+    if ( ( error = pthread_create ( &ahead->thread, NULL, ahead_main, ahead ) ) != 0 ) {
+        close ( ahead->efd );
+        pthread_cond_destroy ( &ahead->room );
+        pthread_mutex_destroy ( &ahead->lock );
+        ahead_free ( ahead );
+        errno = error;
+        return NULL;
+    }
+
+    return ahead;
+}
+
+/*  ahead_ready
+    Mira si el hilo ya leyo block. Si no, escribira en ahead->efd cuando lo
+    tenga (o si falla), para que la sesion espere sin bloquear el bucle
+    (session_sleep).
+
+    Devuelve true si ya se puede leer, o si no se va a poder (ahead_read
+    dira por que)
+*/
+
+bool ahead_ready ( tftp_ahead_t *ahead, uint64_t block ) {
+    bool ready;
+
+    pthread_mutex_lock ( &ahead->lock );
+
+    ready = block < ahead->read || ahead->error != 0 || ahead->last != 0;
+
+    if ( !ready )
+        ahead->want = block;
+
+    pthread_mutex_unlock ( &ahead->lock );
+
+    return ready;
+}
+
+/*  ahead_read
+    Copia el bloque block en buf, sin esperar: tiene que estar ya leido
+    (ahead_ready), sin confirmar y no pasar del final.
+
+    Devuelve los bytes del bloque, o -1 con errno
+*/
+
+ssize_t ahead_read ( tftp_ahead_t *ahead, uint64_t block, void *buf ) {
+    ssize_t len;
+
+    pthread_mutex_lock ( &ahead->lock );
+
+    if ( block < ahead->base || block >= ahead->read ) {
+        errno = ahead->error != 0 ? ahead->error : EINVAL;
+        pthread_mutex_unlock ( &ahead->lock );
+        return -1;
+    }
+
+    len = ahead->len[block % ahead->nslots];
+    memcpy ( buf, ahead->slot[block % ahead->nslots], len );
+
+    pthread_mutex_unlock ( &ahead->lock );
+
+    return len;
+}
+
+/*  ahead_release
+    El servidor confirmo hasta base - 1: sus slots quedan libres
+*/
+
+void ahead_release ( tftp_ahead_t *ahead, uint64_t base ) {
+    pthread_mutex_lock ( &ahead->lock );
+
+    if ( base > ahead->base ) {
+        ahead->base = base;
+        pthread_cond_signal ( &ahead->room );
+    }
+
+    pthread_mutex_unlock ( &ahead->lock );
+}
+
+/*  ahead_stop
+    Termina el hilo, aunque este esperando datos de la tuberia, y libera
+    todo
+*/
+
+void ahead_stop ( tftp_ahead_t *ahead ) {
+    pthread_mutex_lock ( &ahead->lock );
+    ahead->closed = true;
+    pthread_cond_signal ( &ahead->room );
+    pthread_mutex_unlock ( &ahead->lock );
+
+    pthread_cancel ( ahead->thread );
+    pthread_join ( ahead->thread, NULL );
+
+    close ( ahead->efd );
+    pthread_cond_destroy ( &ahead->room );
+    pthread_mutex_destroy ( &ahead->lock );
+    ahead_free ( ahead );
+}
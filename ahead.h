@@ -0,0 +1,49 @@
+#ifndef AHEAD_H
+#define AHEAD_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define AHEAD_SLOTS 16 /* bloques leidos por delante de la ventana */
+
+/*  Lectura anticipada de una subida desde una tuberia (stdin, un tar que se
+    va generando): un hilo lee bloques de blksize en un anillo de slots y el
+    bucle los toma de ahi. Como la tuberia no se puede releer, un bloque se
+    guarda hasta que el servidor lo confirma, por si hay que repetir la
+    ventana. El anillo tiene la ventana mas AHEAD_SLOTS: el hilo espera si va
+    tan por delante, y la memoria queda acotada. El bucle no espera nunca al
+    hilo: si el bloque aun no esta (ahead_ready) la sesion duerme hasta que
+    el hilo avisa por el eventfd. */
+
+typedef struct tftp_ahead {
+    pthread_t       thread;  /* hilo lector */
+    pthread_mutex_t lock;    /* protege base, read, last, want, error, closed */
+    pthread_cond_t  room;    /* se libero un slot o se cerro */
+    int             efd;     /* eventfd: llego el bloque want o un error */
+    uint64_t        want;    /* bloque que espera el bucle, 0 = ninguno */
+    int             fd;      /* de donde se lee */
+    size_t          blksize; /* tamaño de bloque negociado */
+    unsigned        nslots;  /* slots del anillo */
+    u_char **       slot;    /* bloque n en slot[n % nslots] */
+    size_t *        len;     /* bytes de cada slot */
+    uint64_t        base;    /* primer bloque sin confirmar */
+    uint64_t        read;    /* siguiente bloque por leer */
+    uint64_t        last;    /* bloque corto final, 0 = aun no */
+    int             error;   /* errno del hilo, 0 = sin error */
+    bool            closed;  /* se abandona la subida */
+
+} tftp_ahead_t;
+
+tftp_ahead_t *ahead_start ( int fd, size_t blksize, unsigned nslots );
+
+bool ahead_ready ( tftp_ahead_t *ahead, uint64_t block );
+
+ssize_t ahead_read ( tftp_ahead_t *ahead, uint64_t block, void *buf );
+
+void ahead_release ( tftp_ahead_t *ahead, uint64_t base );
+
+void ahead_stop ( tftp_ahead_t *ahead );
+
+#endif
@@ -0,0 +1,415 @@
+#include "batch.h"
+
+#include <ctype.h>
+#include <stddef.h>
+
+#define BATCH_OF( timer ) \
+    ( ( tftp_batch_t * ) ( ( char * ) ( timer ) - offsetof ( tftp_batch_t, tick ) ) )
+
+static void batch_fill ( tftp_batch_t *batch );
+
+/*  batch_load
+    Lee la lista de archivos: uno por linea, sin las lineas vacias ni las que
+    empiezan por '#'
+
+    Devuelve 0, o -1 con errno
+*/
+
+int batch_load ( tftp_batch_t *batch, const char *manifest ) {
+    FILE *  stream = fopen ( manifest, "r" );
+    char *  line   = NULL;
+    size_t  size   = 0;
+    size_t  room   = 0;
+    ssize_t len;
+    char ** files;
+
+    if ( stream == NULL )
+        return -1;
+
+    batch->files  = NULL;
+    batch->nfiles = 0;
+
+    while ( ( len = getline ( &line, &size, stream ) ) != -1 ) {
+        while ( len > 0 && isspace ( ( u_char ) line[len - 1] ) )
+            line[--len] = '\0';
+
+        if ( len == 0 || line[0] == '#' )
+            continue;
+
+        if ( len >= NAMESIZE ) {
+            errno = ENAMETOOLONG;
+            break;
+        }
+
+        if ( batch->nfiles == room ) {
+            room  = room == 0 ? 64 : room * 2;
+            files = realloc ( batch->files, room * sizeof ( char * ) );
+
+            if ( files == NULL )
+                break;
+
+            batch->files = files;
+        }
+
+        if ( ( batch->files[batch->nfiles] = strdup ( line ) ) == NULL )
+            break;
+
+        batch->nfiles++;
+    }
+
+    free ( line );
+
+    if ( ferror ( stream ) || !feof ( stream ) ) {
+        fclose ( stream );
+        batch_free ( batch );
+        return -1;
+    }
+
+    fclose ( stream );
+    return 0;
+}
+
+/*  batch_reap
+    Libera las sesiones de los archivos terminados. Se hace desde un
+    temporizador porque al terminar la sesion aun esta en la pila de quien la
+    llevaba.
+*/
+
+static void batch_reap ( tftp_timer_t *timer ) {
+    tftp_batch_t *batch = ( tftp_batch_t * ) timer;
+    tftp_job_t *  job;
+
+    while ( ( job = batch->dead ) != NULL ) {
+        batch->dead = job->next;
+
+        race_free ( &job->race );
+        tftp_free ( job->race.model );
+        free ( job );
+    }
+}
+
+/*  batch_release
+    Le llega el turno a una pre-abierta: sale el ACK que tenia retenido
+*/
+
+static void batch_release ( tftp_job_t *job ) {
+    tftp_t * instance;
+    unsigned i;
+
+    job->held             = false;
+    job->race.model->held = false;
+
+    for ( i = 0; i < job->race.next; i++ ) {
+        instance = job->race.attempt[i];
+
+        if ( instance == NULL || instance->done )
+            continue;
+
+        instance->held = false;
+
+        if ( instance->parked ) {
+            instance->parked = false;
+            instance->resume ( instance );
+        }
+    }
+}
+
+/*  batch_done
+    Termino un archivo: se cuenta, el marcador aprende de su espejo, y deja
+    sitio para que corra la siguiente pre-abierta y para abrir otra. Si el
+    espejo que respondio dejo de hacerlo a mitad, el archivo se vuelve a
+    pedir desde el principio a los que queden (la copia a medias es un
+    temporal que no se publica).
+*/
+
+static void batch_done ( tftp_race_t *race ) {
+    tftp_job_t *  job    = ( tftp_job_t * ) race;
+    tftp_batch_t *batch  = job->batch;
+    tftp_t *      winner = race_outcome ( race );
+    tftp_job_t *  prev;
+    tftp_job_t *  p;
+    tftp_result_t result;
+    int           host;
+    unsigned      i;
+
+    tftp_result ( winner, &result );
+
+    if ( batch->board != NULL ) {
+        if ( job->host != -1 )
+            batch->board->score[job->host].active--;
+
+        if ( !job->stale && ( host = race_host ( race, winner ) ) != -1 )
+            board_learn ( batch->board, host, winner, result.ok );
+    }
+
+    /* Una cancelada por esperar demasiado se vuelve a pedir (batch_stale) */
+
+    if ( job->stale )
+        batch->again[batch->nagain++] = job->index;
+
+    /*  Un espejo que dejo de responder ya no se usa, ni para este archivo
+        ni para los siguientes */
+
+    else if ( !result.ok && winner == race->winner && winner->lost
+              && race_failover ( race, winner ) == 0 ) {
+        syslog ( LOG_NOTICE, "Retrying %s on another server: %s",
+                 winner->file, result.message );
+        memcpy ( batch->server->down, race->down, sizeof ( race->down ) );
+        batch->again[batch->nagain++] = job->index;
+
+    } else if ( !result.ok ) {
+        printf ( "ERROR Fetching %s: %s\n", winner->file, result.message );
+        batch->failed++;
+
+    } else if ( batch->stats )
+        stats_print ( stdout, winner->file, &winner->stats );
+
+    /* Una pre-abierta tambien puede terminar: archivo de un bloque, o error */
+
+    if ( job->held ) {
+        for ( prev = NULL, p = batch->queue; p != job; p = p->next )
+            prev = p;
+
+        if ( prev != NULL )
+            prev->next = job->next;
+        else
+            batch->queue = job->next;
+
+        if ( batch->tail == job )
+            batch->tail = prev;
+
+        batch->held--;
+
+    } else {
+        for ( i = 0; batch->run[i] != job; i++ )
+            ;
+
+        batch->run[i] = batch->run[--batch->running];
+    }
+
+    job->next   = batch->dead;
+    batch->dead = job;
+    timer_arm ( &batch->loop->wheel, &batch->reap, 0 );
+
+    batch_fill ( batch );
+}
+
+/*  batch_open
+    Lanza la peticion del archivo index, sin turno si ya corren las que caben
+*/
+
+static void batch_open ( tftp_batch_t *batch, unsigned index ) {
+    const char *file = batch->files[index];
+    tftp_job_t *job;
+    tftp_t *    instance;
+
+    if ( tftp_set_file ( batch->model, file ) == -1
+         || ( job = calloc ( 1, sizeof ( tftp_job_t ) ) ) == NULL ) {
+        printf ( "ERROR Fetching %s %s\n", file, strerror ( errno ) );
+        batch->failed++;
+        return;
+    }
+
+    if ( ( instance = tftp_clone ( batch->model ) ) == NULL ) {
+        printf ( "ERROR Fetching %s %s\n", file, strerror ( ENOMEM ) );
+        batch->failed++;
+        free ( job );
+        return;
+    }
+
+    race_copy ( &job->race, batch->server );
+    job->race.done  = batch_done;
+    job->batch      = batch;
+    job->held       = batch->running >= batch->jobs;
+    job->host       = -1;
+    job->index      = index;
+    job->since      = loop_now_us () / 1000;
+    instance->held  = job->held;
+
+    /* Con varios espejos, el marcador elige por cual empezar */
+
+    if ( batch->board != NULL && job->race.nhosts > 1
+         && ( job->host = board_pick ( batch->board, batch->server, NULL ) ) != -1 ) {
+        race_prefer ( &job->race, job->host );
+        batch->board->score[job->host].active++;
+    }
+
+    if ( job->held ) {
+        if ( batch->tail != NULL )
+            batch->tail->next = job;
+        else
+            batch->queue = job;
+
+        batch->tail = job;
+        batch->held++;
+
+    } else
+        batch->run[batch->running++] = job;
+
+    race_start ( &job->race, batch->loop, instance, batch->start, true );
+}
+
+/*  batch_near
+    En curso a las que les queda poco: cuantas pre-abiertas puede haber
+*/
+
+static unsigned batch_near ( const tftp_batch_t *batch ) {
+    const tftp_t *winner;
+    uint64_t      near;
+    unsigned      i, n = 0;
+
+    for ( i = 0; i < batch->running; i++ ) {
+        winner = batch->run[i]->race.winner;
+
+        if ( winner == NULL || winner->tsize < 0 )
+            continue;
+
+        near = 2 * ( uint64_t ) winner->window * winner->blksize;
+
+        if ( near < BATCH_NEAR )
+            near = BATCH_NEAR;
+
+        n += ( uint64_t ) winner->tsize <= winner->stats.bytes + near;
+    }
+
+    return n;
+}
+
+/*  batch_stale
+    Una pre-abierta que lleva mas de BATCH_HOLD_MS sin turno: su servidor ya
+    pudo darla por perdida, asi que se cancela (batch_done la deja para
+    volver a pedirla) en lugar de confirmar a destiempo
+
+    Devuelve true si se cancelo
+*/
+
+static bool batch_stale ( tftp_job_t *job, uint64_t now ) {
+    if ( job->stale || now < job->since + BATCH_HOLD_MS )
+        return false;
+
+    job->stale = true;
+    race_cancel ( &job->race );
+    return true;
+}
+
+/*  batch_fill
+    Da turno a las pre-abiertas mientras haya sitio y abre peticiones nuevas
+    hasta tener jobs corriendo, y pre-abiertas mientras quepan en prefetch y
+    haya en curso a punto de acabar. Lo que termine mientras tanto vuelve
+    aqui; el bucle de fuera lo recoge.
+*/
+
+static void batch_fill ( tftp_batch_t *batch ) {
+    tftp_job_t *job;
+    uint64_t    now = loop_now_us () / 1000;
+
+    if ( batch->filling )
+        return;
+
+    batch->filling = true;
+
+    for ( ;; ) {
+        if ( batch->running < batch->jobs && batch->queue != NULL ) {
+            job = batch->queue;
+
+            /* batch_done ya la saca de la cola */
+
+            if ( batch_stale ( job, now ) )
+                continue;
+
+            batch->queue = job->next;
+
+            if ( batch->queue == NULL )
+                batch->tail = NULL;
+
+            batch->held--;
+            batch->run[batch->running++] = job;
+            batch_release ( job );
+
+        } else if ( ( batch->nagain > 0 || batch->next < batch->nfiles )
+                    && ( batch->running < batch->jobs
+                         || ( batch->held < batch->prefetch
+                              && batch->held < batch_near ( batch ) ) ) )
+            batch_open ( batch, batch->nagain > 0 ? batch->again[--batch->nagain]
+                                                  : batch->next++ );
+
+        else
+            break;
+    }
+
+    batch->filling = false;
+
+    /* Mientras pueda hacer falta pre-abrir o cancelar se vuelve a mirar */
+
+    if ( batch->prefetch > 0 && !timer_armed ( &batch->tick )
+         && ( batch->held > 0 || batch->nagain > 0
+              || batch->next < batch->nfiles ) )
+        timer_arm ( &batch->loop->wheel, &batch->tick, now + BATCH_TICK_MS );
+}
+
+/*  batch_tick
+    Cancela las pre-abiertas que esperan demasiado y pre-abre si alguna en
+    curso ya esta acabando
+*/
+
+static void batch_tick ( tftp_timer_t *timer ) {
+    tftp_batch_t *batch = BATCH_OF ( timer );
+    uint64_t      now   = loop_now_us () / 1000;
+    tftp_job_t *  job;
+    tftp_job_t *  next;
+
+    for ( job = batch->queue; job != NULL; job = next ) {
+        next = job->next;
+        batch_stale ( job, now );
+    }
+
+    batch_fill ( batch );
+}
+
+/*  batch_run
+    Descarga todos los archivos de la lista con las opciones de model y
+    vuelve cuando han terminado
+*/
+
+void batch_run ( tftp_batch_t *batch ) {
+    batch->reap.next   = NULL;
+    batch->reap.prev   = NULL;
+    batch->reap.expire = batch_reap;
+    batch->tick.next   = NULL;
+    batch->tick.prev   = NULL;
+    batch->tick.expire = batch_tick;
+    batch->next        = 0;
+    batch->running     = 0;
+    batch->held        = 0;
+    batch->failed      = 0;
+    batch->filling     = false;
+    batch->queue       = NULL;
+    batch->tail        = NULL;
+    batch->dead        = NULL;
+    batch->nagain      = 0;
+
+    if ( batch->jobs == 0 )
+        batch->jobs = 1;
+
+    /* El tamaño de cada archivo dice cuando pre-abrir el siguiente */
+
+    batch->model->tsize_opt = batch->prefetch > 0;
+
+    batch_fill ( batch );
+    loop_run ( batch->loop );
+
+    timer_cancel ( &batch->loop->wheel, &batch->tick );
+    timer_cancel ( &batch->loop->wheel, &batch->reap );
+    batch_reap ( &batch->reap );
+}
+
+void batch_free ( tftp_batch_t *batch ) {
+    unsigned i;
+
+    for ( i = 0; i < batch->nfiles; i++ )
+        free ( batch->files[i] );
+
+    free ( batch->files );
+    batch->files  = NULL;
+    batch->nfiles = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "race.h"
+#include "score.h"
+
+#define MAX_JOBS 1024     /* transferencias a la vez como mucho */
+#define MAX_PREFETCH 1024 /* peticiones pre-abiertas como mucho */
+#define BATCH_NEAR 65536  /* bytes que le quedan a una en curso para pre-abrir */
+#define BATCH_TICK_MS 20  /* cada cuanto se mira si toca pre-abrir */
+#define BATCH_HOLD_MS 1000 /* pre-abierta como mucho, luego se vuelve a pedir */
+
+/*  Descarga de una lista de archivos en un solo bucle. Ademas de las jobs
+    transferencias en curso se mantienen hasta prefetch peticiones
+    pre-abiertas: su RRQ ya salio y el primer DATA (u OACK) ya llego, pero no
+    se confirma hasta que una de las que corren termina. Asi la ida y vuelta
+    de la peticion de cada archivo se solapa con los datos de los anteriores.
+
+    El servidor de una pre-abierta la da por perdida si tarda en llegar el
+    ACK, asi que solo se pre-abre por cada una en curso a la que le quedan
+    menos de BATCH_NEAR bytes (o dos ventanas) segun el tsize (RFC 2349); y
+    la que pasa BATCH_HOLD_MS sin turno se cancela y se vuelve a pedir. */
+
+typedef struct tftp_job {
+    tftp_race_t       race;  /* intentos contra las direcciones */
+    struct tftp_batch *batch; /* lote al que pertenece */
+    struct tftp_job * next;  /* siguiente en espera o por liberar */
+    bool              held;  /* pre-abierta, sin turno aun */
+    bool              stale; /* cancelada por esperar demasiado */
+    int               host;  /* espejo elegido por el marcador, o -1 */
+    unsigned          index; /* archivo en la lista */
+    uint64_t          since; /* cuando se abrio (ms) */
+
+} tftp_job_t;
+
+typedef struct tftp_batch {
+    tftp_timer_t       reap;     /* libera los terminados fuera de su pila */
+    tftp_timer_t       tick;     /* mira si pre-abrir o cancelar alguna */
+    tftp_loop_t *      loop;     /* bucle de todas las sesiones */
+    tftp_t *           model;    /* opciones comunes */
+    tftp_race_t *      server;   /* direcciones resueltas del servidor */
+    tftp_board_t *     board;    /* marcador de los espejos, o NULL */
+    void ( *start ) ( tftp_t *instance ); /* envia la peticion */
+    char **            files;    /* nombres a descargar */
+    unsigned           nfiles;   /* cuantos */
+    unsigned           next;     /* siguiente por abrir */
+    unsigned           jobs;     /* transferencias a la vez */
+    unsigned           prefetch; /* peticiones pre-abiertas */
+    unsigned           running;  /* transferencias en curso */
+    unsigned           held;     /* pre-abiertas esperando turno */
+    unsigned           failed;   /* archivos que no se descargaron */
+    bool               filling;  /* dentro de batch_fill */
+    bool               stats;    /* mostrar las estadisticas de cada uno */
+    tftp_job_t *       queue;    /* pre-abiertas, por orden */
+    tftp_job_t *       tail;     /* ultima de queue */
+    tftp_job_t *       dead;     /* terminadas por liberar */
+    tftp_job_t *       run[MAX_JOBS];     /* en curso */
+    unsigned           again[MAX_JOBS + MAX_PREFETCH]; /* por volver a pedir */
+    unsigned           nagain;   /* cuantas */
+
+} tftp_batch_t;
+
+int batch_load ( tftp_batch_t *batch, const char *manifest );
+
+void batch_run ( tftp_batch_t *batch );
+
+void batch_free ( tftp_batch_t *batch );
+
+#endif
@@ -0,0 +1,155 @@
+/*  bench_codec
+    Mide lo que cuesta en CPU cada msg: construir DATA, ACK, ERROR y
+    peticiones, y validar (parse.h) DATA, ACK y OACK, para varios blksize.
+
+    uso: bench_codec [iteraciones]
+*/
+
+#include <time.h>
+
+#include "../table.h"
+
+#define DEF_ITERATIONS 10000000
+
+static const uint16_t blksizes[] = { 512, 1428, 8192, MAX_BLKSIZE };
+
+static double now_ns ( void ) {
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report ( const char *what, unsigned blksize, double start,
+                     unsigned long ops ) {
+    double ns = now_ns () - start;
+    char   name[64];
+
+    snprintf ( name, sizeof ( name ), "%s/%u", what, blksize );
+    printf ( "%-22s %10lu ops %9.1f ns/op\n", name, ops, ns / ops );
+}
+
+/*  oack_msg
+    Escribe en buf el OACK que aceptaria lo que pide instance
+
+    Devuelve su longitud
+*/
+
+static size_t oack_msg ( const tftp_t *instance, u_char *buf ) {
+    u_char *p = buf;
+
+    *p++ = ( OPCODE_OACK >> 8 ) & 0xff;
+    *p++ = OPCODE_OACK & 0xff;
+    p += sprintf ( ( char * ) p, OPT_BLKSIZE ) + 1;
+    p += sprintf ( ( char * ) p, "%u", instance->blksize_opt ) + 1;
+    p += sprintf ( ( char * ) p, OPT_WINDOWSIZE ) + 1;
+    p += sprintf ( ( char * ) p, "%u", instance->window_opt ) + 1;
+
+    return p - buf;
+}
+
+int main ( int argc, char **argv ) {
+    unsigned long iterations = DEF_ITERATIONS;
+    tftp_table_t  table;
+    tftp_t *      instance;
+    tftp_hot_t *  hot;
+    tftp_msg_t    msg;
+    u_char        oack[64];
+    size_t        oack_len;
+    uint64_t      sum = 0;
+    unsigned long i;
+    unsigned      b;
+    double        start;
+
+    if ( argc > 1 )
+        iterations = strtoul ( argv[1], NULL, 10 );
+
+    if ( ( instance = tftp_new () ) == NULL || table_init ( &table, 1 ) == -1
+         || tftp_set_file ( instance, "images/firmware-v2.bin" ) == -1
+         || ( hot = table_insert ( &table, instance ) ) == NULL ) {
+        puts ( "Not enough memory" );
+        return EXIT_FAILURE;
+    }
+
+    instance->msgerr = "Option negotiation failed";
+    instance->err    = ERR_OPTION;
+
+    for ( b = 0; b < sizeof ( blksizes ) / sizeof ( blksizes[0] ); b++ ) {
+        unsigned blksize = blksizes[b];
+
+        if ( tftp_resize ( instance, blksize ) == -1 ) {
+            puts ( "Not enough memory" );
+            return EXIT_FAILURE;
+        }
+
+        instance->blksize_opt = blksize;
+        instance->window_opt  = 16;
+
+        /* Un DATA lleno, como los del cuerpo de una transferencia */
+
+        memset ( instance->pkt + 4, 'x', blksize );
+
+        start = now_ns ();
+        for ( i = 0; i < iterations; i++ ) {
+            build_data_msg ( instance, BLOCK_WIRE ( i ), blksize );
+            sum += instance->pkt[3] + instance->pkt_len;
+        }
+        report ( "encode data", blksize, start, iterations );
+
+        start = now_ns ();
+        for ( i = 0; i < iterations; i++ ) {
+            hot->blknum = i;
+            build_ack_msg ( instance );
+            sum += instance->pkt[3];
+        }
+        report ( "encode ack", blksize, start, iterations );
+
+        memcpy ( instance->buf, instance->pkt, 4 + blksize );
+
+        start = now_ns ();
+        for ( i = 0; i < iterations; i++ ) {
+            parse_msg ( instance->buf, 4 + blksize - ( i & 1 ), blksize, &msg );
+            sum += msg.len + msg.block;
+        }
+        report ( "decode data", blksize, start, iterations );
+
+        build_ack_msg ( instance );
+        memcpy ( instance->buf, instance->pkt, 4 );
+
+        start = now_ns ();
+        for ( i = 0; i < iterations; i++ ) {
+            parse_msg ( instance->buf, 4, blksize, &msg );
+            sum += msg.opcode + msg.block;
+        }
+        report ( "decode ack", blksize, start, iterations );
+
+        /* El OACK trae lo mismo que se pidio: no cambia los buffers */
+
+        oack_len = oack_msg ( instance, oack );
+
+        start = now_ns ();
+        for ( i = 0; i < iterations / 10; i++ ) {
+            parse_msg ( oack, oack_len, blksize, &msg );
+            sum += dec_oack ( instance, &msg ) + instance->window;
+        }
+        report ( "decode oack", blksize, start, iterations / 10 );
+
+        start = now_ns ();
+        for ( i = 0; i < iterations / 10; i++ )
+            sum += build_request ( instance, OPCODE_RRQ );
+        report ( "encode request", blksize, start, iterations / 10 );
+
+        start = now_ns ();
+        for ( i = 0; i < iterations / 10; i++ ) {
+            build_error ( instance );
+            sum += instance->pkt_len;
+        }
+        report ( "encode error", blksize, start, iterations / 10 );
+    }
+
+    printf ( "(checksum %llu)\n", ( unsigned long long ) sum );
+
+    table_destroy ( &table );
+
+    return EXIT_SUCCESS;
+}
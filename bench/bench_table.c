@@ -0,0 +1,155 @@
+/*  bench_table
+    Mide la tabla de sesiones con muchas sesiones a la vez: alta, fijar tid,
+    busquedas (aciertos y fallos) y bajas.
+
+    uso: bench_table [sesiones] [busquedas]
+*/
+
+#include <time.h>
+
+#include "../table.h"
+
+#define DEF_SESSIONS 100000
+#define DEF_LOOKUPS 10000000
+
+static double now_ns ( void ) {
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* xorshift, para no medir rand() */
+
+static uint64_t rng = 88172645463325252ULL;
+
+static uint64_t next_rand ( void ) {
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+/* Claves de busqueda aparte, para no tocar los tftp_t al generarlas */
+
+typedef struct key {
+    uint32_t raddr;
+    uint16_t rport;
+    uint16_t lport;
+
+} bench_key_t;
+
+static void report ( const char *what, double start, unsigned long ops ) {
+    double ns = now_ns () - start;
+
+    printf ( "%-22s %10lu ops %9.1f ns/op\n", what, ops, ns / ops );
+}
+
+int main ( int argc, char **argv ) {
+    unsigned long sessions = DEF_SESSIONS;
+    unsigned long lookups  = DEF_LOOKUPS;
+    tftp_table_t  table;
+    tftp_t *      instances;
+    tftp_hot_t *  hot;
+    bench_key_t * keys;
+    uint32_t *    order;
+    uint64_t      sum = 0;
+    unsigned long i;
+    double        start;
+
+    if ( argc > 1 )
+        sessions = strtoul ( argv[1], NULL, 10 );
+
+    if ( argc > 2 )
+        lookups = strtoul ( argv[2], NULL, 10 );
+
+    instances = calloc ( sessions, sizeof ( tftp_t ) );
+    keys      = malloc ( sessions * sizeof ( bench_key_t ) );
+    order     = malloc ( lookups * sizeof ( uint32_t ) );
+
+    if ( instances == NULL || keys == NULL || order == NULL
+         || table_init ( &table, 1 ) == -1 ) {
+        puts ( "Not enough memory" );
+        return EXIT_FAILURE;
+    }
+
+    /*  Sesiones hacia 256 servidores desde 4 puertos locales, como un cliente
+        con pocos sockets compartidos y muchas transferencias */
+
+    for ( i = 0; i < sessions; i++ ) {
+        struct sockaddr_in *remote =
+            ( struct sockaddr_in * ) &instances[i].remote_addr;
+        struct sockaddr_in *local =
+            ( struct sockaddr_in * ) &instances[i].local_addr;
+
+        remote->sin_family      = AF_INET;
+        remote->sin_addr.s_addr = htonl ( 0x0a000000 | ( i & 0xff ) );
+        local->sin_family       = AF_INET;
+        local->sin_port         = htons ( 40000 + ( i & 3 ) );
+
+        keys[i].raddr = remote->sin_addr.s_addr;
+        keys[i].rport = htons ( 1024 + i % 60000 );
+        keys[i].lport = local->sin_port;
+    }
+
+    for ( i = 0; i < lookups; i++ )
+        order[i] = next_rand () % sessions;
+
+    /*  Cada sesion entra pendiente y recibe su tid con la primera respuesta,
+        como en una transferencia real */
+
+    start = now_ns ();
+    for ( i = 0; i < sessions; i++ ) {
+        table_insert ( &table, &instances[i] );
+        table_rekey ( &instances[i], keys[i].rport )->blknum = i;
+    }
+    report ( "insert + rekey", start, sessions );
+
+    printf ( "%-22s %10u slots %8.1f%% load %zu bytes/entry\n", "table",
+             table.mask + 1, 100.0 * table.count / ( table.mask + 1 ),
+             sizeof ( tftp_hot_t ) );
+
+    /* Busqueda y lectura de los campos calientes, sin tocar el tftp_t */
+
+    start = now_ns ();
+    for ( i = 0; i < lookups; i++ ) {
+        bench_key_t *k = &keys[order[i]];
+
+        hot = table_lookup ( &table, k->raddr, k->rport, 0, k->lport );
+        sum += hot->blknum + hot->state;
+    }
+    report ( "lookup hit (hot)", start, lookups );
+
+    /* Lo mismo pero siguiendo el puntero a la parte fria */
+
+    start = now_ns ();
+    for ( i = 0; i < lookups; i++ ) {
+        bench_key_t *k = &keys[order[i]];
+
+        hot = table_lookup ( &table, k->raddr, k->rport, 0, k->lport );
+        sum += hot->session->blksize;
+    }
+    report ( "lookup hit (+cold)", start, lookups );
+
+    start = now_ns ();
+    for ( i = 0; i < lookups; i++ )
+        sum += table_lookup ( &table, htonl ( 0x0b000000 | order[i] ), 69, 0,
+                              htons ( 40000 ) )
+               != NULL;
+    report ( "lookup miss", start, lookups );
+
+    start = now_ns ();
+    for ( i = 0; i < sessions; i++ )
+        table_remove ( &instances[i] );
+    report ( "remove", start, sessions );
+
+    printf ( "(checksum %llu, left %u)\n", ( unsigned long long ) sum,
+             table.count );
+
+    table_destroy ( &table );
+    free ( instances );
+    free ( keys );
+    free ( order );
+
+    return EXIT_SUCCESS;
+}
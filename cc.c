@@ -0,0 +1,189 @@
+#include "cc.h"
+
+#include <strings.h>
+
+/*  fixed
+    Sin control: la ventana negociada sale siempre completa
+*/
+
+static void fixed_init ( tftp_cc_t *cc, uint32_t window ) {
+    cc->cwnd     = window;
+    cc->ssthresh = window;
+}
+
+static void fixed_ack ( tftp_cc_t *cc, uint32_t blocks ) {
+    ( void ) cc;
+    ( void ) blocks;
+}
+
+static void fixed_loss ( tftp_cc_t *cc, bool timeout ) {
+    ( void ) cc;
+    ( void ) timeout;
+}
+
+/*  aimd
+    Arranque lento hasta ssthresh (+1 por bloque confirmado), despues +1 por
+    ventana de congestion confirmada. Una perdida deja cwnd a la mitad; un
+    timeout ademas vuelve a empezar desde 1.
+*/
+
+static void aimd_init ( tftp_cc_t *cc, uint32_t window ) {
+    cc->cwnd     = window < CC_INITIAL ? window : CC_INITIAL;
+    cc->ssthresh = window;
+    cc->acked    = 0;
+}
+
+static void aimd_ack ( tftp_cc_t *cc, uint32_t blocks ) {
+    if ( cc->cwnd < cc->ssthresh )
+        cc->cwnd += blocks;
+
+    else {
+        cc->acked += blocks;
+
+        while ( cc->acked >= cc->cwnd ) {
+            cc->acked -= cc->cwnd;
+            cc->cwnd++;
+        }
+    }
+
+    if ( cc->cwnd > cc->window )
+        cc->cwnd = cc->window;
+}
+
+static void aimd_loss ( tftp_cc_t *cc, bool timeout ) {
+    cc->ssthresh = cc->cwnd / 2 < CC_MIN ? CC_MIN : cc->cwnd / 2;
+    cc->cwnd     = timeout ? 1 : cc->ssthresh;
+    cc->acked    = 0;
+
+    if ( cc->cwnd > cc->window )
+        cc->cwnd = cc->window;
+}
+
+const tftp_cc_ops_t cc_fixed = { "fixed", fixed_init, fixed_ack, fixed_loss };
+const tftp_cc_ops_t cc_aimd  = { "aimd", aimd_init, aimd_ack, aimd_loss };
+
+static const tftp_cc_ops_t *controllers[] = { &cc_fixed, &cc_aimd, NULL };
+
+/*  cc_find
+    Busca un controlador por su nombre, NULL si no existe
+*/
+
+const tftp_cc_ops_t *cc_find ( const char *name ) {
+    int i;
+
+    for ( i = 0; controllers[i] != NULL; i++ )
+        if ( !strcasecmp ( controllers[i]->name, name ) )
+            return controllers[i];
+
+    return NULL;
+}
+
+/*  cc_pace
+    Traduce cwnd a ritmo: cwnd bloques de bytes cada srtt, con una rafaga de
+    cwnd bloques. Con cwnd igual a la ventana, o sin rtt medido, no se frena.
+*/
+
+static void cc_pace ( tftp_cc_t *cc, uint32_t srtt, size_t bytes ) {
+    if ( cc->cwnd >= cc->window || srtt == 0 ) {
+        bucket_set ( &cc->pace, 0, 0 );
+        return;
+    }
+
+    bucket_set ( &cc->pace, ( uint64_t ) cc->cwnd * bytes * 1000000 / srtt,
+                 ( int64_t ) cc->cwnd * bytes );
+}
+
+void cc_init ( tftp_cc_t *cc, uint32_t window ) {
+    if ( cc->ops == NULL )
+        cc->ops = &cc_fixed;
+
+    cc->window = window;
+    cc->ops->init ( cc, window );
+    bucket_init ( &cc->pace, 0, 0 );
+}
+
+void cc_ack ( tftp_cc_t *cc, uint32_t blocks, uint32_t srtt, size_t bytes ) {
+    cc->ops->on_ack ( cc, blocks );
+    cc_pace ( cc, srtt, bytes );
+}
+
+void cc_loss ( tftp_cc_t *cc, bool timeout, uint32_t srtt, size_t bytes ) {
+    cc->ops->on_loss ( cc, timeout );
+    cc_pace ( cc, srtt, bytes );
+}
+
+/*  bucket_init
+    Cubo lleno de rate bytes/s con una rafaga de 1/RATE_BURST_DIV s
+*/
+
+void bucket_init ( tftp_bucket_t *bucket, uint64_t rate, uint64_t now ) {
+    bucket->rate   = rate;
+    bucket->burst  = rate / RATE_BURST_DIV + 1;
+    bucket->tokens = bucket->burst;
+    bucket->last   = now;
+}
+
+/*  bucket_set
+    Cambia la tasa y la rafaga conservando los tokens que quepan. Un cubo
+    que no tenia limite empieza a recargarse en el siguiente bucket_wait, no
+    desde el last de cuando se creo.
+*/
+
+void bucket_set ( tftp_bucket_t *bucket, uint64_t rate, int64_t burst ) {
+    if ( bucket->rate == 0 )
+        bucket->last = 0;
+
+    bucket->rate  = rate;
+    bucket->burst = burst;
+
+    if ( bucket->tokens > burst )
+        bucket->tokens = burst;
+}
+
+/*  bucket_wait
+    Recarga el cubo hasta now (us) y devuelve cuantos us faltan para poder
+    enviar, 0 si ya se puede
+*/
+
+uint64_t bucket_wait ( tftp_bucket_t *bucket, uint64_t now ) {
+    uint64_t add, full;
+
+    if ( bucket->rate == 0 )
+        return 0;
+
+    if ( bucket->last == 0 )
+        bucket->last = now;
+
+    /*  Con lo que falta para llenarlo se satura antes de multiplicar, asi un
+        cubo parado mucho tiempo no desborda. Solo se avanza last si se sumo
+        algo, para no perder las fracciones de token con recargas muy
+        seguidas. */
+
+    full = bucket->tokens < bucket->burst
+               ? ( uint64_t ) ( bucket->burst - bucket->tokens ) * 1000000
+                         / bucket->rate
+                     + 1
+               : 0;
+
+    if ( now - bucket->last >= full ) {
+        bucket->tokens = bucket->burst;
+        bucket->last   = now;
+
+    } else if ( ( add = ( now - bucket->last ) * bucket->rate / 1000000 ) > 0 ) {
+        bucket->tokens += add;
+        bucket->last = now;
+
+        if ( bucket->tokens > bucket->burst )
+            bucket->tokens = bucket->burst;
+    }
+
+    if ( bucket->tokens > 0 )
+        return 0;
+
+    return ( uint64_t ) -bucket->tokens * 1000000 / bucket->rate + 1;
+}
+
+void bucket_take ( tftp_bucket_t *bucket, size_t bytes ) {
+    if ( bucket->rate != 0 )
+        bucket->tokens -= bytes;
+}
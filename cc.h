@@ -0,0 +1,72 @@
+#ifndef CC_H
+#define CC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CC_INITIAL 10 /* ventana inicial de aimd (bloques) */
+#define CC_MIN 2      /* ssthresh minimo tras una perdida */
+
+#define RATE_BURST_DIV 50 /* rafaga de un cubo: 1/50 s de su tasa */
+
+/*  Cubo de tokens en bytes. Se puede enviar mientras queden tokens; cada
+    envio los gasta aunque los deje en negativo, asi un paquete nunca espera a
+    reunir su tamaño y la deuda se paga antes del siguiente. rate 0 = sin
+    limite. */
+
+typedef struct tftp_bucket {
+    uint64_t rate;   /* bytes por segundo */
+    int64_t  burst;  /* tokens maximos acumulados */
+    int64_t  tokens; /* tokens disponibles, negativo = deuda */
+    uint64_t last;   /* ultima recarga (us) */
+
+} tftp_bucket_t;
+
+/*  Estado de un controlador de congestion de una sesion que envia por
+    ventanas (RFC 7440). cwnd son los bloques que pueden salir por rtt; como el
+    receptor solo confirma ventanas completas, la ventana negociada se envia
+    siempre entera y cwnd se aplica como ritmo: cwnd bloques por srtt. */
+
+typedef struct tftp_cc {
+    const struct tftp_cc_ops *ops;      /* controlador */
+    uint32_t                  window;   /* ventana negociada (bloques) */
+    uint32_t                  cwnd;     /* ventana de congestion (bloques) */
+    uint32_t                  ssthresh; /* fin del arranque lento */
+    uint32_t                  acked;    /* confirmados desde el ultimo +1 */
+    tftp_bucket_t             pace;     /* ritmo derivado de cwnd */
+
+} tftp_cc_t;
+
+/*  Controlador: init al conocer la ventana negociada, on_ack con los bloques
+    que confirma cada ACK, on_loss con una perdida (timeout = vencio el
+    reenvio, si no el receptor confirmo menos de lo enviado) */
+
+typedef struct tftp_cc_ops {
+    const char *name;
+    void ( *init ) ( tftp_cc_t *cc, uint32_t window );
+    void ( *on_ack ) ( tftp_cc_t *cc, uint32_t blocks );
+    void ( *on_loss ) ( tftp_cc_t *cc, bool timeout );
+
+} tftp_cc_ops_t;
+
+extern const tftp_cc_ops_t cc_fixed;
+extern const tftp_cc_ops_t cc_aimd;
+
+const tftp_cc_ops_t *cc_find ( const char *name );
+
+void cc_init ( tftp_cc_t *cc, uint32_t window );
+
+void cc_ack ( tftp_cc_t *cc, uint32_t blocks, uint32_t srtt, size_t bytes );
+
+void cc_loss ( tftp_cc_t *cc, bool timeout, uint32_t srtt, size_t bytes );
+
+void bucket_init ( tftp_bucket_t *bucket, uint64_t rate, uint64_t now );
+
+void bucket_set ( tftp_bucket_t *bucket, uint64_t rate, int64_t burst );
+
+uint64_t bucket_wait ( tftp_bucket_t *bucket, uint64_t now );
+
+void bucket_take ( tftp_bucket_t *bucket, size_t bytes );
+
+#endif
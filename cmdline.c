@@ -33,10 +33,31 @@ const char *gengetopt_args_info_versiontext = "";
 const char *gengetopt_args_info_description = "Trivial file transfer.";
 
 const char *gengetopt_args_info_help[] = {
-  "  -h, --help          Print help and exit",
-  "  -V, --version       Print version and exit",
-  "  -g, --get=filename  download a file",
-  "  -p, --put=filename  upload a file",
+  "  -h, --help               Print help and exit",
+  "  -V, --version            Print version and exit",
+  "  -g, --get=filename       download a file",
+  "  -p, --put=filename       upload a file",
+  "  -d, --durability=policy  durability of downloaded files (none, end, range)",
+  "  -F, --flush-mb=MB        writeback interval in MB for --durability=range",
+  "  -O, --direct             bypass the page cache with O_DIRECT writes",
+  "  -b, --blksize=bytes      block size to negotiate (8-65464)",
+  "  -w, --windowsize=blocks  blocks per window to negotiate (1-65535)",
+  "  -c, --congestion=name    rate controller for windowed uploads (fixed, aimd)",
+  "  -r, --rate=KiB/s         bandwidth cap for the transfer",
+  "  -R, --global-rate=KiB/s  bandwidth cap shared by all transfers",
+  "  -s, --sockets=count      share count sockets among all transfers (0 = one per transfer)",
+  "  -B, --busy-poll=usec     spin up to usec for each reply before sleeping (low latency)",
+  "  -S, --stats              print transfer statistics and block latencies",
+  "  -m, --manifest=file      download every file listed in file, one name per line",
+  "  -j, --jobs=count         transfers running at once with --manifest (default 1)",
+  "  -P, --prefetch=count     requests opened ahead of the running transfers (default 1)",
+  "  -y, --sync=manifest      mirror the files listed in the remote manifest (name size sha256)",
+  "  -D, --dest=dir           destination directory for --sync (default .)",
+  "  -z, --compressed         download file.gz and decompress it on the fly",
+  "  -o, --output=path        save the download as path (- for stdout), or the remote name of an upload",
+  "  -k, --scoreboard=file    remember mirror latency and health in file between batches",
+  "  -l, --listen=socket      stay resident and take transfers from the Unix socket (see daemon.h)",
+  "  -n, --per-server=count   transfers at once against each mirror with --listen (default no limit)",
     0
 };
 
@@ -64,6 +85,27 @@ void clear_given (struct gengetopt_args_info *args_info)
   args_info->version_given = 0 ;
   args_info->get_given = 0 ;
   args_info->put_given = 0 ;
+  args_info->durability_given = 0 ;
+  args_info->flush_mb_given = 0 ;
+  args_info->direct_given = 0 ;
+  args_info->blksize_given = 0 ;
+  args_info->windowsize_given = 0 ;
+  args_info->congestion_given = 0 ;
+  args_info->rate_given = 0 ;
+  args_info->global_rate_given = 0 ;
+  args_info->sockets_given = 0 ;
+  args_info->busy_poll_given = 0 ;
+  args_info->stats_given = 0 ;
+  args_info->manifest_given = 0 ;
+  args_info->jobs_given = 0 ;
+  args_info->prefetch_given = 0 ;
+  args_info->sync_given = 0 ;
+  args_info->dest_given = 0 ;
+  args_info->compressed_given = 0 ;
+  args_info->output_given = 0 ;
+  args_info->scoreboard_given = 0 ;
+  args_info->listen_given = 0 ;
+  args_info->per_server_given = 0 ;
 }
 
 static
@@ -74,6 +116,42 @@ void clear_args (struct gengetopt_args_info *args_info)
   args_info->get_orig = NULL;
   args_info->put_arg = NULL;
   args_info->put_orig = NULL;
+  args_info->durability_arg = NULL;
+  args_info->durability_orig = NULL;
+  args_info->flush_mb_arg = NULL;
+  args_info->flush_mb_orig = NULL;
+  args_info->blksize_arg = NULL;
+  args_info->blksize_orig = NULL;
+  args_info->windowsize_arg = NULL;
+  args_info->windowsize_orig = NULL;
+  args_info->congestion_arg = NULL;
+  args_info->congestion_orig = NULL;
+  args_info->rate_arg = NULL;
+  args_info->rate_orig = NULL;
+  args_info->global_rate_arg = NULL;
+  args_info->global_rate_orig = NULL;
+  args_info->sockets_arg = NULL;
+  args_info->sockets_orig = NULL;
+  args_info->busy_poll_arg = NULL;
+  args_info->busy_poll_orig = NULL;
+  args_info->manifest_arg = NULL;
+  args_info->manifest_orig = NULL;
+  args_info->jobs_arg = NULL;
+  args_info->jobs_orig = NULL;
+  args_info->prefetch_arg = NULL;
+  args_info->prefetch_orig = NULL;
+  args_info->sync_arg = NULL;
+  args_info->sync_orig = NULL;
+  args_info->dest_arg = NULL;
+  args_info->dest_orig = NULL;
+  args_info->output_arg = NULL;
+  args_info->output_orig = NULL;
+  args_info->scoreboard_arg = NULL;
+  args_info->scoreboard_orig = NULL;
+  args_info->listen_arg = NULL;
+  args_info->listen_orig = NULL;
+  args_info->per_server_arg = NULL;
+  args_info->per_server_orig = NULL;
   
 }
 
@@ -86,6 +164,27 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->version_help = gengetopt_args_info_help[1] ;
   args_info->get_help = gengetopt_args_info_help[2] ;
   args_info->put_help = gengetopt_args_info_help[3] ;
+  args_info->durability_help = gengetopt_args_info_help[4] ;
+  args_info->flush_mb_help = gengetopt_args_info_help[5] ;
+  args_info->direct_help = gengetopt_args_info_help[6] ;
+  args_info->blksize_help = gengetopt_args_info_help[7] ;
+  args_info->windowsize_help = gengetopt_args_info_help[8] ;
+  args_info->congestion_help = gengetopt_args_info_help[9] ;
+  args_info->rate_help = gengetopt_args_info_help[10] ;
+  args_info->global_rate_help = gengetopt_args_info_help[11] ;
+  args_info->sockets_help = gengetopt_args_info_help[12] ;
+  args_info->busy_poll_help = gengetopt_args_info_help[13] ;
+  args_info->stats_help = gengetopt_args_info_help[14] ;
+  args_info->manifest_help = gengetopt_args_info_help[15] ;
+  args_info->jobs_help = gengetopt_args_info_help[16] ;
+  args_info->prefetch_help = gengetopt_args_info_help[17] ;
+  args_info->sync_help = gengetopt_args_info_help[18] ;
+  args_info->dest_help = gengetopt_args_info_help[19] ;
+  args_info->compressed_help = gengetopt_args_info_help[20] ;
+  args_info->output_help = gengetopt_args_info_help[21] ;
+  args_info->scoreboard_help = gengetopt_args_info_help[22] ;
+  args_info->listen_help = gengetopt_args_info_help[23] ;
+  args_info->per_server_help = gengetopt_args_info_help[24] ;
   
 }
 
@@ -176,6 +275,42 @@ cmdline_parser_release (struct gengetopt_args_info *args_info)
   free_string_field (&(args_info->get_orig));
   free_string_field (&(args_info->put_arg));
   free_string_field (&(args_info->put_orig));
+  free_string_field (&(args_info->durability_arg));
+  free_string_field (&(args_info->durability_orig));
+  free_string_field (&(args_info->flush_mb_arg));
+  free_string_field (&(args_info->flush_mb_orig));
+  free_string_field (&(args_info->blksize_arg));
+  free_string_field (&(args_info->blksize_orig));
+  free_string_field (&(args_info->windowsize_arg));
+  free_string_field (&(args_info->windowsize_orig));
+  free_string_field (&(args_info->congestion_arg));
+  free_string_field (&(args_info->congestion_orig));
+  free_string_field (&(args_info->rate_arg));
+  free_string_field (&(args_info->rate_orig));
+  free_string_field (&(args_info->global_rate_arg));
+  free_string_field (&(args_info->global_rate_orig));
+  free_string_field (&(args_info->sockets_arg));
+  free_string_field (&(args_info->sockets_orig));
+  free_string_field (&(args_info->busy_poll_arg));
+  free_string_field (&(args_info->busy_poll_orig));
+  free_string_field (&(args_info->manifest_arg));
+  free_string_field (&(args_info->manifest_orig));
+  free_string_field (&(args_info->jobs_arg));
+  free_string_field (&(args_info->jobs_orig));
+  free_string_field (&(args_info->prefetch_arg));
+  free_string_field (&(args_info->prefetch_orig));
+  free_string_field (&(args_info->sync_arg));
+  free_string_field (&(args_info->sync_orig));
+  free_string_field (&(args_info->dest_arg));
+  free_string_field (&(args_info->dest_orig));
+  free_string_field (&(args_info->output_arg));
+  free_string_field (&(args_info->output_orig));
+  free_string_field (&(args_info->scoreboard_arg));
+  free_string_field (&(args_info->scoreboard_orig));
+  free_string_field (&(args_info->listen_arg));
+  free_string_field (&(args_info->listen_orig));
+  free_string_field (&(args_info->per_server_arg));
+  free_string_field (&(args_info->per_server_orig));
   
   
   for (i = 0; i < args_info->inputs_num; ++i)
@@ -219,6 +354,48 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
     write_into_file(outfile, "get", args_info->get_orig, 0);
   if (args_info->put_given)
     write_into_file(outfile, "put", args_info->put_orig, 0);
+  if (args_info->durability_given)
+    write_into_file(outfile, "durability", args_info->durability_orig, 0);
+  if (args_info->flush_mb_given)
+    write_into_file(outfile, "flush-mb", args_info->flush_mb_orig, 0);
+  if (args_info->direct_given)
+    write_into_file(outfile, "direct", 0, 0 );
+  if (args_info->blksize_given)
+    write_into_file(outfile, "blksize", args_info->blksize_orig, 0);
+  if (args_info->windowsize_given)
+    write_into_file(outfile, "windowsize", args_info->windowsize_orig, 0);
+  if (args_info->congestion_given)
+    write_into_file(outfile, "congestion", args_info->congestion_orig, 0);
+  if (args_info->rate_given)
+    write_into_file(outfile, "rate", args_info->rate_orig, 0);
+  if (args_info->global_rate_given)
+    write_into_file(outfile, "global-rate", args_info->global_rate_orig, 0);
+  if (args_info->sockets_given)
+    write_into_file(outfile, "sockets", args_info->sockets_orig, 0);
+  if (args_info->busy_poll_given)
+    write_into_file(outfile, "busy-poll", args_info->busy_poll_orig, 0);
+  if (args_info->stats_given)
+    write_into_file(outfile, "stats", 0, 0 );
+  if (args_info->manifest_given)
+    write_into_file(outfile, "manifest", args_info->manifest_orig, 0);
+  if (args_info->jobs_given)
+    write_into_file(outfile, "jobs", args_info->jobs_orig, 0);
+  if (args_info->prefetch_given)
+    write_into_file(outfile, "prefetch", args_info->prefetch_orig, 0);
+  if (args_info->sync_given)
+    write_into_file(outfile, "sync", args_info->sync_orig, 0);
+  if (args_info->dest_given)
+    write_into_file(outfile, "dest", args_info->dest_orig, 0);
+  if (args_info->compressed_given)
+    write_into_file(outfile, "compressed", 0, 0 );
+  if (args_info->output_given)
+    write_into_file(outfile, "output", args_info->output_orig, 0);
+  if (args_info->scoreboard_given)
+    write_into_file(outfile, "scoreboard", args_info->scoreboard_orig, 0);
+  if (args_info->listen_given)
+    write_into_file(outfile, "listen", args_info->listen_orig, 0);
+  if (args_info->per_server_given)
+    write_into_file(outfile, "per-server", args_info->per_server_orig, 0);
   
 
   i = EXIT_SUCCESS;
@@ -1056,6 +1233,27 @@ cmdline_parser_internal (
         { "version",	0, NULL, 'V' },
         { "get",	1, NULL, 'g' },
         { "put",	1, NULL, 'p' },
+        { "durability",	1, NULL, 'd' },
+        { "flush-mb",	1, NULL, 'F' },
+        { "direct",	0, NULL, 'O' },
+        { "blksize",	1, NULL, 'b' },
+        { "windowsize",	1, NULL, 'w' },
+        { "congestion",	1, NULL, 'c' },
+        { "rate",	1, NULL, 'r' },
+        { "global-rate",	1, NULL, 'R' },
+        { "sockets",	1, NULL, 's' },
+        { "busy-poll",	1, NULL, 'B' },
+        { "stats",	0, NULL, 'S' },
+        { "manifest",	1, NULL, 'm' },
+        { "jobs",	1, NULL, 'j' },
+        { "prefetch",	1, NULL, 'P' },
+        { "sync",	1, NULL, 'y' },
+        { "dest",	1, NULL, 'D' },
+        { "compressed",	0, NULL, 'z' },
+        { "output",	1, NULL, 'o' },
+        { "scoreboard",	1, NULL, 'k' },
+        { "listen",	1, NULL, 'l' },
+        { "per-server",	1, NULL, 'n' },
         { 0,  0, 0, 0 }
       };
 
@@ -1064,7 +1262,7 @@ cmdline_parser_internal (
       custom_opterr = opterr;
       custom_optopt = optopt;
 
-      c = custom_getopt_long (argc, argv, "hVg:p:", long_options, &option_index);
+      c = custom_getopt_long (argc, argv, "hVg:p:d:F:Ob:w:c:r:R:s:B:Sm:j:P:y:D:zo:k:l:n:", long_options, &option_index);
 
       optarg = custom_optarg;
       optind = custom_optind;
@@ -1109,6 +1307,258 @@ cmdline_parser_internal (
             goto failure;
         
           break;
+        case 'd':	/* durability of downloaded files (none, end, range).  */
+        
+        
+          if (update_arg( (void *)&(args_info->durability_arg), 
+               &(args_info->durability_orig), &(args_info->durability_given),
+              &(local_args_info.durability_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "durability", 'd',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'F':	/* writeback interval in MB for --durability=range.  */
+        
+        
+          if (update_arg( (void *)&(args_info->flush_mb_arg), 
+               &(args_info->flush_mb_orig), &(args_info->flush_mb_given),
+              &(local_args_info.flush_mb_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "flush-mb", 'F',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'O':	/* bypass the page cache with O_DIRECT writes.  */
+        
+        
+          if (update_arg( 0 , 
+               0 , &(args_info->direct_given),
+              &(local_args_info.direct_given), optarg, 0, 0, ARG_NO,
+              check_ambiguity, override, 0, 0,
+              "direct", 'O',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'b':	/* block size to negotiate (8-65464).  */
+        
+        
+          if (update_arg( (void *)&(args_info->blksize_arg), 
+               &(args_info->blksize_orig), &(args_info->blksize_given),
+              &(local_args_info.blksize_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "blksize", 'b',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'w':	/* blocks per window to negotiate (1-65535).  */
+        
+        
+          if (update_arg( (void *)&(args_info->windowsize_arg), 
+               &(args_info->windowsize_orig), &(args_info->windowsize_given),
+              &(local_args_info.windowsize_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "windowsize", 'w',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'c':	/* rate controller for windowed uploads (fixed, aimd).  */
+        
+        
+          if (update_arg( (void *)&(args_info->congestion_arg), 
+               &(args_info->congestion_orig), &(args_info->congestion_given),
+              &(local_args_info.congestion_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "congestion", 'c',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'r':	/* bandwidth cap for the transfer.  */
+        
+        
+          if (update_arg( (void *)&(args_info->rate_arg), 
+               &(args_info->rate_orig), &(args_info->rate_given),
+              &(local_args_info.rate_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "rate", 'r',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'R':	/* bandwidth cap shared by all transfers.  */
+        
+        
+          if (update_arg( (void *)&(args_info->global_rate_arg), 
+               &(args_info->global_rate_orig), &(args_info->global_rate_given),
+              &(local_args_info.global_rate_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "global-rate", 'R',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 's':	/* share count sockets among all transfers (0 = one per transfer).  */
+        
+        
+          if (update_arg( (void *)&(args_info->sockets_arg), 
+               &(args_info->sockets_orig), &(args_info->sockets_given),
+              &(local_args_info.sockets_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "sockets", 's',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'B':	/* spin up to usec for each reply before sleeping (low latency).  */
+        
+        
+          if (update_arg( (void *)&(args_info->busy_poll_arg), 
+               &(args_info->busy_poll_orig), &(args_info->busy_poll_given),
+              &(local_args_info.busy_poll_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "busy-poll", 'B',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'S':	/* print transfer statistics and block latencies.  */
+        
+        
+          if (update_arg( 0 , 
+               0 , &(args_info->stats_given),
+              &(local_args_info.stats_given), optarg, 0, 0, ARG_NO,
+              check_ambiguity, override, 0, 0,
+              "stats", 'S',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'm':	/* download every file listed in file, one name per line.  */
+        
+        
+          if (update_arg( (void *)&(args_info->manifest_arg), 
+               &(args_info->manifest_orig), &(args_info->manifest_given),
+              &(local_args_info.manifest_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "manifest", 'm',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'j':	/* transfers running at once with --manifest (default 1).  */
+        
+        
+          if (update_arg( (void *)&(args_info->jobs_arg), 
+               &(args_info->jobs_orig), &(args_info->jobs_given),
+              &(local_args_info.jobs_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "jobs", 'j',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'P':	/* requests opened ahead of the running transfers (default 1).  */
+        
+        
+          if (update_arg( (void *)&(args_info->prefetch_arg), 
+               &(args_info->prefetch_orig), &(args_info->prefetch_given),
+              &(local_args_info.prefetch_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "prefetch", 'P',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'y':	/* mirror the files listed in the remote manifest (name size sha256).  */
+        
+        
+          if (update_arg( (void *)&(args_info->sync_arg), 
+               &(args_info->sync_orig), &(args_info->sync_given),
+              &(local_args_info.sync_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "sync", 'y',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'D':	/* destination directory for --sync (default .).  */
+        
+        
+          if (update_arg( (void *)&(args_info->dest_arg), 
+               &(args_info->dest_orig), &(args_info->dest_given),
+              &(local_args_info.dest_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "dest", 'D',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'z':	/* download file.gz and decompress it on the fly.  */
+        
+        
+          if (update_arg( 0 , 
+               0 , &(args_info->compressed_given),
+              &(local_args_info.compressed_given), optarg, 0, 0, ARG_NO,
+              check_ambiguity, override, 0, 0,
+              "compressed", 'z',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'o':	/* save the download as path (- for stdout), or the remote name of an upload.  */
+        
+        
+          if (update_arg( (void *)&(args_info->output_arg), 
+               &(args_info->output_orig), &(args_info->output_given),
+              &(local_args_info.output_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "output", 'o',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'k':	/* remember mirror latency and health in file between batches.  */
+        
+        
+          if (update_arg( (void *)&(args_info->scoreboard_arg), 
+               &(args_info->scoreboard_orig), &(args_info->scoreboard_given),
+              &(local_args_info.scoreboard_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "scoreboard", 'k',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'l':	/* stay resident and take transfers from the Unix socket (see daemon.h).  */
+        
+        
+          if (update_arg( (void *)&(args_info->listen_arg), 
+               &(args_info->listen_orig), &(args_info->listen_given),
+              &(local_args_info.listen_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "listen", 'l',
+              additional_error))
+            goto failure;
+        
+          break;
+        case 'n':	/* transfers at once against each mirror with --listen (default no limit).  */
+        
+        
+          if (update_arg( (void *)&(args_info->per_server_arg), 
+               &(args_info->per_server_orig), &(args_info->per_server_given),
+              &(local_args_info.per_server_given), optarg, 0, 0, ARG_STRING,
+              check_ambiguity, override, 0, 0,
+              "per-server", 'n',
+              additional_error))
+            goto failure;
+        
+          break;
 
         case 0:	/* Long option with no short option */
         case '?':	/* Invalid option.  */
@@ -45,11 +45,89 @@ struct gengetopt_args_info
   char * put_arg;	/**< @brief upload a file.  */
   char * put_orig;	/**< @brief upload a file original value given at command line.  */
   const char *put_help; /**< @brief upload a file help description.  */
+  char * durability_arg;	/**< @brief durability of downloaded files (none, end, range).  */
+  char * durability_orig;	/**< @brief durability of downloaded files (none, end, range) original value given at command line.  */
+  const char *durability_help; /**< @brief durability of downloaded files (none, end, range) help description.  */
+  char * flush_mb_arg;	/**< @brief writeback interval in MB for --durability=range.  */
+  char * flush_mb_orig;	/**< @brief writeback interval in MB for --durability=range original value given at command line.  */
+  const char *flush_mb_help; /**< @brief writeback interval in MB for --durability=range help description.  */
+  const char *direct_help; /**< @brief bypass the page cache with O_DIRECT writes help description.  */
+  char * blksize_arg;	/**< @brief block size to negotiate (8-65464).  */
+  char * blksize_orig;	/**< @brief block size to negotiate (8-65464) original value given at command line.  */
+  const char *blksize_help; /**< @brief block size to negotiate (8-65464) help description.  */
+  char * windowsize_arg;	/**< @brief blocks per window to negotiate (1-65535).  */
+  char * windowsize_orig;	/**< @brief blocks per window to negotiate (1-65535) original value given at command line.  */
+  const char *windowsize_help; /**< @brief blocks per window to negotiate (1-65535) help description.  */
+  char * congestion_arg;	/**< @brief rate controller for windowed uploads (fixed, aimd).  */
+  char * congestion_orig;	/**< @brief rate controller for windowed uploads (fixed, aimd) original value given at command line.  */
+  const char *congestion_help; /**< @brief rate controller for windowed uploads (fixed, aimd) help description.  */
+  char * rate_arg;	/**< @brief bandwidth cap for the transfer.  */
+  char * rate_orig;	/**< @brief bandwidth cap for the transfer original value given at command line.  */
+  const char *rate_help; /**< @brief bandwidth cap for the transfer help description.  */
+  char * global_rate_arg;	/**< @brief bandwidth cap shared by all transfers.  */
+  char * global_rate_orig;	/**< @brief bandwidth cap shared by all transfers original value given at command line.  */
+  const char *global_rate_help; /**< @brief bandwidth cap shared by all transfers help description.  */
+  char * sockets_arg;	/**< @brief share count sockets among all transfers (0 = one per transfer).  */
+  char * sockets_orig;	/**< @brief share count sockets among all transfers (0 = one per transfer) original value given at command line.  */
+  const char *sockets_help; /**< @brief share count sockets among all transfers (0 = one per transfer) help description.  */
+  char * busy_poll_arg;	/**< @brief spin up to usec for each reply before sleeping (low latency).  */
+  char * busy_poll_orig;	/**< @brief spin up to usec for each reply before sleeping (low latency) original value given at command line.  */
+  const char *busy_poll_help; /**< @brief spin up to usec for each reply before sleeping (low latency) help description.  */
+  const char *stats_help; /**< @brief print transfer statistics and block latencies help description.  */
+  char * manifest_arg;	/**< @brief download every file listed in file, one name per line.  */
+  char * manifest_orig;	/**< @brief download every file listed in file, one name per line original value given at command line.  */
+  const char *manifest_help; /**< @brief download every file listed in file, one name per line help description.  */
+  char * jobs_arg;	/**< @brief transfers running at once with --manifest (default 1).  */
+  char * jobs_orig;	/**< @brief transfers running at once with --manifest (default 1) original value given at command line.  */
+  const char *jobs_help; /**< @brief transfers running at once with --manifest (default 1) help description.  */
+  char * prefetch_arg;	/**< @brief requests opened ahead of the running transfers (default 1).  */
+  char * prefetch_orig;	/**< @brief requests opened ahead of the running transfers (default 1) original value given at command line.  */
+  const char *prefetch_help; /**< @brief requests opened ahead of the running transfers (default 1) help description.  */
+  char * sync_arg;	/**< @brief mirror the files listed in the remote manifest (name size sha256).  */
+  char * sync_orig;	/**< @brief mirror the files listed in the remote manifest (name size sha256) original value given at command line.  */
+  const char *sync_help; /**< @brief mirror the files listed in the remote manifest (name size sha256) help description.  */
+  char * dest_arg;	/**< @brief destination directory for --sync (default .).  */
+  char * dest_orig;	/**< @brief destination directory for --sync (default .) original value given at command line.  */
+  const char *dest_help; /**< @brief destination directory for --sync (default .) help description.  */
+  const char *compressed_help; /**< @brief download file.gz and decompress it on the fly help description.  */
+  char * output_arg;	/**< @brief save the download as path (- for stdout), or the remote name of an upload.  */
+  char * output_orig;	/**< @brief save the download as path (- for stdout), or the remote name of an upload original value given at command line.  */
+  const char *output_help; /**< @brief save the download as path (- for stdout), or the remote name of an upload help description.  */
+  char * scoreboard_arg;	/**< @brief remember mirror latency and health in file between batches.  */
+  char * scoreboard_orig;	/**< @brief remember mirror latency and health in file between batches original value given at command line.  */
+  const char *scoreboard_help; /**< @brief remember mirror latency and health in file between batches help description.  */
+  char * listen_arg;	/**< @brief stay resident and take transfers from the Unix socket (see daemon.h).  */
+  char * listen_orig;	/**< @brief stay resident and take transfers from the Unix socket (see daemon.h) original value given at command line.  */
+  const char *listen_help; /**< @brief stay resident and take transfers from the Unix socket (see daemon.h) help description.  */
+  char * per_server_arg;	/**< @brief transfers at once against each mirror with --listen (default no limit).  */
+  char * per_server_orig;	/**< @brief transfers at once against each mirror with --listen (default no limit) original value given at command line.  */
+  const char *per_server_help; /**< @brief transfers at once against each mirror with --listen (default no limit) help description.  */
   
   unsigned int help_given ;	/**< @brief Whether help was given.  */
   unsigned int version_given ;	/**< @brief Whether version was given.  */
   unsigned int get_given ;	/**< @brief Whether get was given.  */
   unsigned int put_given ;	/**< @brief Whether put was given.  */
+  unsigned int durability_given ;	/**< @brief Whether durability was given.  */
+  unsigned int flush_mb_given ;	/**< @brief Whether flush-mb was given.  */
+  unsigned int direct_given ;	/**< @brief Whether direct was given.  */
+  unsigned int blksize_given ;	/**< @brief Whether blksize was given.  */
+  unsigned int windowsize_given ;	/**< @brief Whether windowsize was given.  */
+  unsigned int congestion_given ;	/**< @brief Whether congestion was given.  */
+  unsigned int rate_given ;	/**< @brief Whether rate was given.  */
+  unsigned int global_rate_given ;	/**< @brief Whether global-rate was given.  */
+  unsigned int sockets_given ;	/**< @brief Whether sockets was given.  */
+  unsigned int busy_poll_given ;	/**< @brief Whether busy-poll was given.  */
+  unsigned int stats_given ;	/**< @brief Whether stats was given.  */
+  unsigned int manifest_given ;	/**< @brief Whether manifest was given.  */
+  unsigned int jobs_given ;	/**< @brief Whether jobs was given.  */
+  unsigned int prefetch_given ;	/**< @brief Whether prefetch was given.  */
+  unsigned int sync_given ;	/**< @brief Whether sync was given.  */
+  unsigned int dest_given ;	/**< @brief Whether dest was given.  */
+  unsigned int compressed_given ;	/**< @brief Whether compressed was given.  */
+  unsigned int output_given ;	/**< @brief Whether output was given.  */
+  unsigned int scoreboard_given ;	/**< @brief Whether scoreboard was given.  */
+  unsigned int listen_given ;	/**< @brief Whether listen was given.  */
+  unsigned int per_server_given ;	/**< @brief Whether per-server was given.  */
 
   char **inputs ; /**< @brief unamed options (options without names) */
   unsigned inputs_num ; /**< @brief unamed options number */
@@ -0,0 +1,39 @@
+#include "coro.h"
+#include "tftp.h"
+
+/*  Lo que el bucle le avisa a la sesion (recv, retry y resume) despierta a
+    su corrutina con el motivo */
+
+static void coro_recv ( tftp_t *instance, ssize_t received ) {
+    instance->co.wake     = WAKE_RECV;
+    instance->co.received = received;
+    instance->co.body ( instance );
+}
+
+static void coro_retry ( tftp_t *instance ) {
+    instance->co.wake = WAKE_RETRY;
+    instance->co.body ( instance );
+}
+
+static void coro_resume ( tftp_t *instance ) {
+    instance->co.wake = WAKE_RESUME;
+    instance->co.body ( instance );
+}
+
+/*  coro_start
+    La sesion pasa a llevarla body desde el principio: corre hasta su primera
+    espera y el bucle la despierta despues con cada msg, reenvio o fin de
+    espera
+*/
+
+void coro_start ( tftp_t *instance, void ( *body ) ( tftp_t *instance ) ) {
+    instance->co.body     = body;
+    instance->co.received = 0;
+    instance->co.line     = 0;
+    instance->co.wake     = WAKE_START;
+    instance->recv        = coro_recv;
+    instance->retry       = coro_retry;
+    instance->resume      = coro_resume;
+
+    body ( instance );
+}
@@ -0,0 +1,58 @@
+#ifndef CORO_H
+#define CORO_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define CORO_DONE 0xffff /* linea de una corrutina que ya termino */
+
+#define WAKE_START 0  /* primera llamada */
+#define WAKE_RECV 1   /* llego un msg, en buf */
+#define WAKE_RETRY 2  /* vencio el reenvio */
+#define WAKE_RESUME 3 /* termino la espera por el ritmo o el turno */
+
+struct tftp;
+
+/*  Corrutina sin pila (protothread) de una sesion: el cuerpo es un switch
+    sobre la linea donde se quedo, asi cada espera vuelve al bucle de
+    eventos y la siguiente llamada sigue justo detras, sin hilo ni pila
+    propia. Cuesta unos pocos bytes por sesion. Las variables locales no
+    sobreviven a una espera, el estado del protocolo va en la sesion; y no se
+    puede esperar dentro de un switch del propio cuerpo. */
+
+typedef struct tftp_coro {
+    void ( *body ) ( struct tftp *instance ); /* cuerpo de la corrutina */
+    ssize_t  received; /* bytes del msg en buf, con WAKE_RECV */
+    uint16_t line;     /* donde sigue, 0 = al principio */
+    uint8_t  wake;     /* por que se la despierta (WAKE_*) */
+
+} tftp_coro_t;
+
+#define CORO_BEGIN( co )     \
+    switch ( ( co )->line ) { \
+    case CORO_DONE:           \
+        return;               \
+    case 0:
+
+/* Vuelve al bucle; la siguiente vez que se despierte sigue aqui */
+
+#define CORO_YIELD( co )          \
+    do {                          \
+        ( co )->line = __LINE__;  \
+        return;                   \
+    case __LINE__:;               \
+    } while ( 0 )
+
+#define CORO_EXIT( co )            \
+    do {                           \
+        ( co )->line = CORO_DONE;  \
+        return;                    \
+    } while ( 0 )
+
+#define CORO_END( co ) \
+    }                  \
+    ( co )->line = CORO_DONE
+
+void coro_start ( struct tftp *instance, void ( *body ) ( struct tftp *instance ) );
+
+#endif
@@ -0,0 +1,833 @@
+#define _GNU_SOURCE /* accept4 */
+
+#include "daemon.h"
+
+#include <ctype.h>
+#include <signal.h>
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/un.h>
+
+#define DAEMON_OF( ptr, field ) \
+    ( ( tftp_daemon_t * ) ( ( char * ) ( ptr ) - offsetof ( tftp_daemon_t, field ) ) )
+
+static void client_close ( tftp_client_t *client );
+
+static void daemon_fill ( tftp_daemon_t *daemon );
+
+/*  client_watch
+    Pide a epoll lo que hace falta de la conexion: leer mientras el cliente
+    siga mandando, escribir mientras quede algo sin enviar
+*/
+
+static void client_watch ( tftp_client_t *client ) {
+    loop_rewatch ( client->daemon->loop, client->fd, &client->watch,
+                   ( client->eof ? 0 : EPOLLIN )
+                       | ( client->writing ? EPOLLOUT : 0 ) );
+}
+
+/*  client_idle
+    Cierra la conexion si ya no espera nada: el cliente dejo de mandar (o el
+    demonio se esta parando) y todas sus respuestas salieron
+*/
+
+static void client_idle ( tftp_client_t *client ) {
+    if ( ( client->eof || client->daemon->stopping ) && client->running == 0
+         && client->out_len == 0 )
+        client_close ( client );
+}
+
+/*  client_flush
+    Envia lo que se pueda de las respuestas pendientes sin bloquear
+*/
+
+static void client_flush ( tftp_client_t *client ) {
+    ssize_t n;
+
+    while ( client->out_len > 0 ) {
+        n = send ( client->fd, client->out, client->out_len,
+                   MSG_NOSIGNAL | MSG_DONTWAIT );
+
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                break;
+
+            client_close ( client );
+            return;
+        }
+
+        memmove ( client->out, client->out + n, client->out_len - n );
+        client->out_len -= n;
+    }
+
+    if ( ( client->out_len > 0 ) != client->writing ) {
+        client->writing = client->out_len > 0;
+        client_watch ( client );
+    }
+
+    client_idle ( client );
+}
+
+/*  client_printf
+    Añade una respuesta y la envia. Un cliente que no lee no puede frenar al
+    resto: si no cabe, se le cierra la conexion.
+*/
+
+static void client_printf ( tftp_client_t *client, const char *format, ... ) {
+    size_t  room = DAEMON_OUT - client->out_len;
+    va_list args;
+    int     n;
+
+    if ( client->closed )
+        return;
+
+    va_start ( args, format );
+    n = vsnprintf ( client->out + client->out_len, room, format, args );
+    va_end ( args );
+
+    if ( n < 0 || ( size_t ) n >= room ) {
+        syslog ( LOG_WARNING, "Control connection not reading, closing it" );
+        client_close ( client );
+        return;
+    }
+
+    client->out_len += n;
+    client_flush ( client );
+}
+
+/*  client_close
+    Cierra la conexion. Lo que pidio y esperaba turno se descarta; lo que ya
+    corre termina igual, sin nadie a quien avisar. La memoria se libera en
+    daemon_reap, fuera de la pila de quien la cerro.
+*/
+
+static void client_close ( tftp_client_t *client ) {
+    tftp_daemon_t *  daemon = client->daemon;
+    tftp_request_t * req;
+    tftp_request_t **p;
+    tftp_client_t ** c;
+
+    if ( client->closed )
+        return;
+
+    client->closed = true;
+    loop_unwatch ( daemon->loop, client->fd );
+    close ( client->fd );
+
+    for ( c = &daemon->clients; *c != client; c = &( *c )->next )
+        ;
+
+    *c           = client->next;
+    client->next = daemon->gone;
+    daemon->gone = client;
+
+    daemon->tail = NULL;
+
+    for ( p = &daemon->queue; ( req = *p ) != NULL; ) {
+        if ( req->client == client ) {
+            *p          = req->next;
+            req->next   = daemon->dead;
+            daemon->dead = req;
+
+        } else {
+            daemon->tail = req;
+            p            = &req->next;
+        }
+    }
+
+    for ( req = daemon->active; req != NULL; req = req->next )
+        if ( req->client == client )
+            req->client = NULL;
+
+    timer_arm ( &daemon->loop->wheel, &daemon->reap, 0 );
+}
+
+/*  request_queue
+    Pone req a esperar turno detras de las de su clase y de las mas
+    urgentes, o con ahead delante de las de su clase (una que vuelve ya
+    espero el suyo)
+*/
+
+static void request_queue ( tftp_request_t *req, bool ahead ) {
+    tftp_daemon_t *  daemon = req->daemon;
+    unsigned         prio   = req->race.model->prio;
+    tftp_request_t **p;
+
+    if ( !ahead && daemon->tail != NULL
+         && daemon->tail->race.model->prio <= prio ) {
+        daemon->tail->next = req;
+        daemon->tail       = req;
+        return;
+    }
+
+    for ( p = &daemon->queue;
+          *p != NULL && ( ahead ? ( *p )->race.model->prio < prio
+                                : ( *p )->race.model->prio <= prio );
+          p = &( *p )->next )
+        ;
+
+    req->next = *p;
+    *p        = req;
+
+    if ( req->next == NULL )
+        daemon->tail = req;
+}
+
+/*  request_retry
+    Vuelve a poner en espera lo que pedia req, con una sesion nueva; req
+    termina y se libera como las demas
+
+    Devuelve 0, o -1 si no hay memoria
+*/
+
+static int request_retry ( tftp_request_t *req ) {
+    tftp_request_t *retry = calloc ( 1, sizeof ( tftp_request_t ) );
+
+    if ( retry == NULL
+         || ( retry->race.model = tftp_clone ( req->race.model ) ) == NULL ) {
+        free ( retry );
+        return -1;
+    }
+
+    retry->daemon = req->daemon;
+    retry->client = req->client;
+    retry->id     = req->id;
+    retry->type   = req->type;
+    retry->host   = -1;
+    request_queue ( retry, true );
+
+    return 0;
+}
+
+/*  request_done
+    Termino una peticion: se contesta a quien la hizo, el marcador aprende
+    de su espejo y entra la siguiente que esperaba turno. Si el espejo que
+    respondio dejo de hacerlo a mitad, queda caido DAEMON_REPROBE_MS y la
+    peticion vuelve a esperar turno para los que queden, salvo que ya no
+    quede ninguno o la subida venga de una tuberia que no se puede releer.
+*/
+
+static void request_done ( tftp_race_t *race ) {
+    tftp_request_t * req     = ( tftp_request_t * ) race;
+    tftp_daemon_t *  daemon  = req->daemon;
+    tftp_client_t *  client  = req->client;
+    tftp_t *         outcome = race_outcome ( race );
+    tftp_request_t **p;
+    tftp_result_t    result;
+    int              host    = race_host ( race, outcome );
+    bool             retried = false;
+
+    tftp_result ( outcome, &result );
+
+    if ( req->host != -1 ) {
+        daemon->host_running[req->host]--;
+
+        if ( daemon->board != NULL )
+            daemon->board->score[req->host].active--;
+    }
+
+    if ( daemon->board != NULL && host != -1 )
+        board_learn ( daemon->board, host, outcome, result.ok );
+
+    if ( !result.ok && outcome->lost && host != -1
+         && race_failover ( race, outcome ) == 0 ) {
+        daemon->server->down[host] = true;
+        daemon->down_until[host]   = loop_now_us () / 1000 + DAEMON_REPROBE_MS;
+
+        if ( outcome == race->winner && !outcome->sequential
+             && !daemon->stopping && request_retry ( req ) == 0 ) {
+            syslog ( LOG_NOTICE, "Retrying %s on another server: %s",
+                     outcome->file, result.message );
+            retried = true;
+        }
+    }
+
+    for ( p = &daemon->active; *p != req; p = &( *p )->next )
+        ;
+
+    *p           = req->next;
+    req->next    = daemon->dead;
+    daemon->dead = req;
+    daemon->running--;
+    timer_arm ( &daemon->loop->wheel, &daemon->reap, 0 );
+
+    if ( client != NULL && !retried ) {
+        client->running--;
+
+        if ( result.ok )
+            client_printf ( client, "OK %u %llu %llu\n", req->id,
+                            ( unsigned long long ) result.bytes,
+                            ( unsigned long long ) result.usec );
+        else
+            client_printf ( client, "ERROR %u %d %s\n", req->id, result.code,
+                            result.message );
+    }
+
+    daemon_fill ( daemon );
+}
+
+/*  request_start
+    Lanza la peticion contra el servidor, empezando por el espejo host si
+    hay varios
+*/
+
+static void request_start ( tftp_request_t *req, int host ) {
+    tftp_daemon_t *daemon = req->daemon;
+    tftp_loop_t *  loop   = daemon->loop;
+
+    race_copy ( &req->race, daemon->server );
+    req->race.done = request_done;
+    req->host      = host;
+
+    if ( host != -1 ) {
+        daemon->host_running[host]++;
+
+        if ( daemon->board != NULL ) {
+            race_prefer ( &req->race, host );
+            daemon->board->score[host].active++;
+        }
+    }
+
+    if ( !timer_armed ( &daemon->progress ) )
+        timer_arm ( &loop->wheel, &daemon->progress,
+                    loop_now_us () / 1000 + DAEMON_PROGRESS_MS );
+
+    /* Como en start_protocol: un WRQ solo prueba la siguiente si falla */
+
+    if ( req->type == OPCODE_RRQ )
+        race_start ( &req->race, loop, req->race.model, daemon->start_rrq, true );
+    else
+        race_start ( &req->race, loop, req->race.model, daemon->start_wrq, false );
+}
+
+/*  daemon_host
+    Espejo para la siguiente peticion: el del marcador entre los que no han
+    llegado a per_server, o el unico. Los caidos cuyo plazo vencio vuelven a
+    contar como vivos. Con todos los vivos en su limite la
+    peticion tiene que esperar.
+
+    Devuelve su indice, -1 si no queda ninguno vivo (la peticion sale igual
+    y falla), o -2 si hay que esperar
+*/
+
+static int daemon_host ( tftp_daemon_t *daemon ) {
+    tftp_race_t *server = daemon->server;
+    uint64_t     now    = loop_now_us () / 1000;
+    bool         full[RACE_HOSTS];
+    unsigned     h, live = 0, room = 0;
+
+    for ( h = 0; h < server->nhosts; h++ ) {
+        if ( server->down[h] && now >= daemon->down_until[h] )
+            server->down[h] = false;
+
+        full[h] = daemon->per_server != 0
+                  && daemon->host_running[h] >= daemon->per_server;
+        live += !server->down[h];
+        room += !server->down[h] && !full[h];
+    }
+
+    if ( live > 0 && room == 0 )
+        return -2;
+
+    if ( daemon->board != NULL )
+        return board_pick ( daemon->board, server, full );
+
+    return 0;
+}
+
+/*  daemon_fill
+    Da turno a las peticiones en espera mientras haya sitio. Lo que termine
+    mientras tanto vuelve aqui; el bucle de fuera lo recoge.
+*/
+
+static void daemon_fill ( tftp_daemon_t *daemon ) {
+    tftp_request_t *req;
+    int             host;
+
+    if ( daemon->filling )
+        return;
+
+    daemon->filling = true;
+
+    while ( daemon->running < daemon->jobs && ( req = daemon->queue ) != NULL
+            && ( host = daemon_host ( daemon ) ) != -2 ) {
+        daemon->queue = req->next;
+
+        if ( daemon->queue == NULL )
+            daemon->tail = NULL;
+
+        req->next      = daemon->active;
+        daemon->active = req;
+        daemon->running++;
+
+        request_start ( req, host );
+    }
+
+    daemon->filling = false;
+}
+
+/*  request_new
+    Encola una transferencia de client con la clase prio: file es el nombre
+    remoto y local el del archivo de aqui, NULL si es el mismo. Espera
+    detras de las de su clase y de las mas urgentes.
+
+    Devuelve 0, o -1 con errno
+*/
+
+static int request_new ( tftp_client_t *client, unsigned id, int type,
+                         unsigned prio, const char *file, const char *local ) {
+    tftp_daemon_t * daemon = client->daemon;
+    tftp_request_t *req;
+    tftp_t *        instance;
+
+    if ( tftp_set_file ( daemon->model, file ) == -1 )
+        return -1;
+
+    if ( ( req = calloc ( 1, sizeof ( tftp_request_t ) ) ) == NULL
+         || ( instance = tftp_clone ( daemon->model ) ) == NULL ) {
+        free ( req );
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if ( tftp_set_local ( instance, local ) == -1 ) {
+        tftp_free ( instance );
+        free ( req );
+        return -1;
+    }
+
+    instance->prio  = prio;
+    req->race.model = instance;
+    req->daemon     = daemon;
+    req->client     = client;
+    req->id         = id;
+    req->type       = type;
+    req->host       = -1;
+    client->running++;
+    request_queue ( req, false );
+    daemon_fill ( daemon );
+
+    return 0;
+}
+
+/*  client_line
+    Atiende una linea del cliente. Las vacias no cuentan como peticion.
+*/
+
+static void client_line ( tftp_client_t *client, char *line ) {
+    size_t   len = strlen ( line );
+    char *   save, *cmd, *first, *second, *tmp;
+    unsigned id, prio = SCHED_DEFAULT;
+    long     class;
+    int      status;
+
+    while ( len > 0 && isspace ( ( u_char ) line[len - 1] ) )
+        line[--len] = '\0';
+
+    if ( ( cmd = strtok_r ( line, " \t", &save ) ) == NULL )
+        return;
+
+    id    = ++client->ids;
+    first = strtok_r ( NULL, " \t", &save );
+
+    if ( first != NULL && !strcmp ( first, "-p" ) ) {
+        if ( ( first = strtok_r ( NULL, " \t", &save ) ) == NULL )
+            class = -1;
+        else
+            class = strtol ( first, &tmp, 10 );
+
+        if ( class < 0 || class >= SCHED_CLASSES || *tmp != '\0' ) {
+            client_printf ( client, "ERROR %u -1 Invalid priority\n", id );
+            return;
+        }
+
+        prio  = class;
+        first = strtok_r ( NULL, " \t", &save );
+    }
+
+    second = strtok_r ( NULL, " \t", &save );
+
+    if ( client->daemon->stopping ) {
+        client_printf ( client, "ERROR %u -1 Daemon stopping\n", id );
+        return;
+    }
+
+    if ( first == NULL || strtok_r ( NULL, " \t", &save ) != NULL ) {
+        client_printf ( client, "ERROR %u -1 Invalid request\n", id );
+        return;
+    }
+
+    if ( !strcmp ( cmd, "get" ) )
+        status = request_new ( client, id, OPCODE_RRQ, prio, first, second );
+
+    else if ( !strcmp ( cmd, "put" ) )
+        status = request_new ( client, id, OPCODE_WRQ, prio,
+                               second != NULL ? second : first,
+                               second != NULL ? first : NULL );
+
+    else {
+        client_printf ( client, "ERROR %u -1 Unknown command %s\n", id, cmd );
+        return;
+    }
+
+    if ( status == -1 )
+        client_printf ( client, "ERROR %u -1 %s\n", id, strerror ( errno ) );
+}
+
+/*  client_ready
+    La conexion tiene algo que leer o ya se puede escribir en ella. Cuando el
+    cliente deja de mandar (cierra su lado), se le sigue contestando hasta
+    que terminen sus peticiones.
+*/
+
+static void client_ready ( tftp_loop_t *loop, tftp_watch_t *watch,
+                           uint32_t events ) {
+    tftp_client_t *client = ( tftp_client_t * ) watch;
+    char *         line, *nl;
+    ssize_t        n;
+
+    ( void ) loop;
+
+    /*  Cerrada en este mismo lote (sigue en gone hasta liberarla): su fd
+        ya no es suyo, puede ser otro recien abierto */
+
+    if ( client->closed )
+        return;
+
+    if ( events & EPOLLOUT )
+        client_flush ( client );
+
+    /* El envio puede haberla cerrado */
+
+    if ( client->closed )
+        return;
+
+    if ( client->eof ) {
+        if ( events & ( EPOLLHUP | EPOLLERR ) )
+            client_close ( client );
+        return;
+    }
+
+    while ( events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) ) {
+        n = recv ( client->fd, client->in + client->in_len,
+                   DAEMON_LINE - 1 - client->in_len, 0 );
+
+        if ( n == -1 && errno == EINTR )
+            continue;
+
+        if ( n == -1 && ( errno == EAGAIN || errno == EWOULDBLOCK ) )
+            break;
+
+        if ( n <= 0 ) {
+            client->eof = true;
+            client_watch ( client );
+            client_idle ( client );
+            return;
+        }
+
+        client->in_len += n;
+        client->in[client->in_len] = '\0';
+        line                       = client->in;
+
+        while ( ( nl = strchr ( line, '\n' ) ) != NULL ) {
+            *nl = '\0';
+            client_line ( client, line );
+
+            if ( client->closed )
+                return;
+
+            line = nl + 1;
+        }
+
+        client->in_len -= line - client->in;
+        memmove ( client->in, line, client->in_len );
+
+        if ( client->in_len == DAEMON_LINE - 1 ) {
+            client_printf ( client, "ERROR %u -1 Request too long\n",
+                            ++client->ids );
+            client_close ( client );
+            return;
+        }
+    }
+}
+
+/*  daemon_accept
+    Acepta las conexiones nuevas al socket de control
+*/
+
+static void daemon_accept ( tftp_loop_t *loop, tftp_watch_t *watch,
+                            uint32_t events ) {
+    tftp_daemon_t *daemon = DAEMON_OF ( watch, listen );
+    tftp_client_t *client;
+    int            fd;
+
+    ( void ) events;
+
+    while ( ( fd = accept4 ( daemon->listen_fd, NULL, NULL,
+                             SOCK_NONBLOCK | SOCK_CLOEXEC ) )
+            != -1 ) {
+        if ( ( client = calloc ( 1, sizeof ( tftp_client_t ) ) ) == NULL ) {
+            close ( fd );
+            continue;
+        }
+
+        client->fd          = fd;
+        client->daemon      = daemon;
+        client->watch.ready = client_ready;
+
+        if ( loop_watch ( loop, fd, &client->watch, EPOLLIN ) == -1 ) {
+            syslog ( LOG_ERR, "Error watching control connection: %s",
+                     strerror ( errno ) );
+            close ( fd );
+            free ( client );
+            continue;
+        }
+
+        client->next    = daemon->clients;
+        daemon->clients = client;
+    }
+}
+
+/*  daemon_stop
+    Deja de aceptar conexiones y peticiones, descarta lo que esperaba turno
+    y cierra las conexiones que ya no esperan nada. loop_run vuelve cuando
+    termine lo que estaba en curso. Una segunda señal ya termina el proceso.
+*/
+
+static void daemon_stop ( tftp_daemon_t *daemon ) {
+    tftp_loop_t *   loop = daemon->loop;
+    tftp_request_t *req;
+    tftp_client_t * client, *next;
+    sigset_t        signals;
+
+    daemon->stopping = true;
+
+    loop_unwatch ( loop, daemon->listen_fd );
+    close ( daemon->listen_fd );
+    unlink ( daemon->path );
+
+    loop_unwatch ( loop, daemon->signal_fd );
+    close ( daemon->signal_fd );
+
+    sigemptyset ( &signals );
+    sigaddset ( &signals, SIGINT );
+    sigaddset ( &signals, SIGTERM );
+    sigprocmask ( SIG_UNBLOCK, &signals, NULL );
+
+    while ( ( req = daemon->queue ) != NULL ) {
+        daemon->queue = req->next;
+        req->next     = daemon->dead;
+        daemon->dead  = req;
+
+        if ( req->client != NULL ) {
+            req->client->running--;
+            client_printf ( req->client, "ERROR %u -1 Daemon stopping\n",
+                            req->id );
+        }
+    }
+
+    daemon->tail = NULL;
+    timer_arm ( &loop->wheel, &daemon->reap, 0 );
+
+    for ( client = daemon->clients; client != NULL; client = next ) {
+        next = client->next;
+        client_idle ( client );
+    }
+}
+
+static void daemon_signal ( tftp_loop_t *loop, tftp_watch_t *watch,
+                            uint32_t events ) {
+    tftp_daemon_t *         daemon = DAEMON_OF ( watch, signals );
+    struct signalfd_siginfo info;
+
+    ( void ) loop;
+    ( void ) events;
+
+    if ( read ( daemon->signal_fd, &info, sizeof ( info ) ) != sizeof ( info ) )
+        return;
+
+    syslog ( LOG_NOTICE, "Signal %u received, stopping", info.ssi_signo );
+    daemon_stop ( daemon );
+}
+
+/*  daemon_progress
+    Cuenta a cada cliente cuanto llevan sus transferencias en curso
+*/
+
+static void daemon_progress ( tftp_timer_t *timer ) {
+    tftp_daemon_t * daemon = DAEMON_OF ( timer, progress );
+    tftp_request_t *req;
+    tftp_t *        winner;
+
+    for ( req = daemon->active; req != NULL; req = req->next ) {
+        winner = req->race.winner;
+
+        if ( req->client != NULL && winner != NULL && !winner->done )
+            client_printf ( req->client, "PROGRESS %u %llu\n", req->id,
+                            ( unsigned long long ) winner->stats.bytes );
+    }
+
+    if ( daemon->running > 0 )
+        timer_arm ( &daemon->loop->wheel, timer,
+                    loop_now_us () / 1000 + DAEMON_PROGRESS_MS );
+}
+
+/*  daemon_reap
+    Libera las peticiones y conexiones terminadas
+*/
+
+static void daemon_reap ( tftp_timer_t *timer ) {
+    tftp_daemon_t * daemon = ( tftp_daemon_t * ) timer;
+    tftp_request_t *req;
+    tftp_client_t * client;
+
+    while ( ( req = daemon->dead ) != NULL ) {
+        daemon->dead = req->next;
+
+        /* Las que no llegaron a empezar no tienen intentos */
+
+        if ( req->race.loop != NULL )
+            race_free ( &req->race );
+
+        tftp_free ( req->race.model );
+        free ( req );
+    }
+
+    while ( ( client = daemon->gone ) != NULL ) {
+        daemon->gone = client->next;
+        free ( client );
+    }
+}
+
+/*  daemon_stale
+    path ya existe: si nadie escucha es de un demonio que termino mal y se
+    puede reutilizar
+
+    Devuelve 0 si se puede, o -1 con errno
+*/
+
+static int daemon_stale ( const struct sockaddr_un *addr ) {
+    int fd = socket ( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    int error;
+
+    if ( fd == -1 )
+        return -1;
+
+    error = connect ( fd, ( const struct sockaddr * ) addr, sizeof ( *addr ) ) == 0
+                ? EADDRINUSE
+                : errno;
+    close ( fd );
+
+    if ( error != ECONNREFUSED ) {
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*  daemon_open
+    Escucha en el socket Unix path (solo para el usuario) y toma SIGINT y
+    SIGTERM por el bucle. loop, model, server, start_* y jobs ya tienen que
+    estar puestos.
+
+    Devuelve 0, o -1 con errno
+*/
+
+int daemon_open ( tftp_daemon_t *daemon, const char *path ) {
+    struct sockaddr_un addr = { 0 };
+    socklen_t          size = sizeof ( addr );
+    sigset_t           signals;
+    int                error;
+
+    if ( strlen ( path ) >= sizeof ( addr.sun_path ) ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy ( addr.sun_path, path );
+
+    daemon->path      = path;
+    daemon->signal_fd = -1;
+    daemon->listen_fd = socket ( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+
+    if ( daemon->listen_fd == -1 )
+        return -1;
+
+    if ( bind ( daemon->listen_fd, ( struct sockaddr * ) &addr, size ) == -1
+         && ( errno != EADDRINUSE || daemon_stale ( &addr ) == -1
+              || unlink ( path ) == -1
+              || bind ( daemon->listen_fd, ( struct sockaddr * ) &addr, size ) == -1 ) ) {
+        error = errno;
+        close ( daemon->listen_fd );
+        errno = error;
+        return -1;
+    }
+
+    sigemptyset ( &signals );
+    sigaddset ( &signals, SIGINT );
+    sigaddset ( &signals, SIGTERM );
+
+    daemon->listen.ready  = daemon_accept;
+    daemon->signals.ready = daemon_signal;
+
+    if ( chmod ( path, S_IRUSR | S_IWUSR ) == -1
+         || listen ( daemon->listen_fd, DAEMON_BACKLOG ) == -1
+         || sigprocmask ( SIG_BLOCK, &signals, NULL ) == -1
+         || ( daemon->signal_fd = signalfd ( -1, &signals, SFD_NONBLOCK | SFD_CLOEXEC ) ) == -1
+         || loop_watch ( daemon->loop, daemon->listen_fd, &daemon->listen, EPOLLIN ) == -1
+         || loop_watch ( daemon->loop, daemon->signal_fd, &daemon->signals, EPOLLIN ) == -1 ) {
+        error = errno;
+        loop_unwatch ( daemon->loop, daemon->listen_fd );
+        close ( daemon->listen_fd );
+
+        if ( daemon->signal_fd != -1 )
+            close ( daemon->signal_fd );
+
+        sigprocmask ( SIG_UNBLOCK, &signals, NULL );
+        unlink ( path );
+        errno = error;
+        return -1;
+    }
+
+    daemon->reap.next        = NULL;
+    daemon->reap.prev        = NULL;
+    daemon->reap.expire      = daemon_reap;
+    daemon->progress.next    = NULL;
+    daemon->progress.prev    = NULL;
+    daemon->progress.expire  = daemon_progress;
+    daemon->running          = 0;
+    daemon->filling          = false;
+    daemon->stopping         = false;
+    daemon->queue            = NULL;
+    daemon->tail             = NULL;
+    daemon->active           = NULL;
+    daemon->dead             = NULL;
+    daemon->clients          = NULL;
+    daemon->gone             = NULL;
+
+    if ( daemon->jobs == 0 )
+        daemon->jobs = 1;
+
+    syslog ( LOG_NOTICE, "Listening on %s", path );
+
+    return 0;
+}
+
+/*  daemon_run
+    Atiende conexiones y transferencias hasta que una señal lo pare y acabe
+    lo que estaba en curso
+*/
+
+void daemon_run ( tftp_daemon_t *daemon ) {
+    loop_run ( daemon->loop );
+
+    timer_cancel ( &daemon->loop->wheel, &daemon->progress );
+    timer_cancel ( &daemon->loop->wheel, &daemon->reap );
+    daemon_reap ( &daemon->reap );
+}
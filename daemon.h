@@ -0,0 +1,99 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "race.h"
+#include "score.h"
+
+#define DAEMON_LINE 1024        /* peticion mas larga */
+#define DAEMON_OUT 65536        /* respuestas pendientes por conexion */
+#define DAEMON_BACKLOG 64       /* conexiones sin aceptar */
+#define DAEMON_PROGRESS_MS 1000 /* cada cuanto se informa del avance */
+#define DAEMON_REPROBE_MS 30000 /* espejo caido que se vuelve a probar */
+
+/*  Modo residente: el cliente se queda escuchando en un socket Unix y cada
+    conexion le pide transferencias, una por linea:
+
+        get [-p <clase>] <remoto> [<local>]
+        put [-p <clase>] <local> [<remoto>]
+
+    Las peticiones se numeran por conexion desde 1 y corren en el mismo
+    bucle que todas las demas, jobs a la vez y como mucho per_server contra
+    cada espejo; el resto espera turno. La clase (0 la mas urgente, hasta
+    SCHED_CLASSES - 1, SCHED_DEFAULT si no se da) ordena esa espera y el
+    reparto del limite global (fair.h). Por la misma conexion vuelve, para
+    cada una:
+
+        PROGRESS <n> <bytes>             cada DAEMON_PROGRESS_MS en curso
+        OK <n> <bytes> <us>              al terminar bien
+        ERROR <n> <codigo> <motivo>      al fallar (codigo -1 si no es TFTP)
+
+    Si el espejo que la lleva deja de responder a mitad, la peticion vuelve
+    a esperar turno para otro; ese espejo no se usa durante
+    DAEMON_REPROBE_MS y despues se vuelve a probar.
+
+    Con SIGINT o SIGTERM deja de aceptar, descarta lo que esperaba turno y
+    termina cuando acaba lo que estaba en curso. */
+
+typedef struct tftp_request {
+    tftp_race_t            race;   /* intentos contra las direcciones */
+    struct tftp_daemon *   daemon; /* demonio que la lleva */
+    struct tftp_client *   client; /* quien la pidio, NULL si se fue */
+    struct tftp_request *  next;   /* siguiente en su lista */
+    unsigned               id;     /* numero en su conexion */
+    int                    type;   /* OPCODE_RRQ u OPCODE_WRQ */
+    int                    host;   /* espejo asignado, o -1 */
+
+} tftp_request_t;
+
+typedef struct tftp_client {
+    tftp_watch_t          watch;   /* registro en epoll */
+    int                   fd;      /* conexion */
+    struct tftp_daemon *  daemon;  /* demonio al que pertenece */
+    struct tftp_client *  next;    /* siguiente conexion */
+    unsigned              ids;     /* peticiones recibidas */
+    unsigned              running; /* en curso o esperando turno */
+    bool                  writing; /* esperando a poder escribir */
+    bool                  eof;     /* el cliente ya no manda mas */
+    bool                  closed;  /* cerrada, por liberar */
+    size_t                in_len;  /* bytes en in */
+    size_t                out_len; /* bytes en out */
+    char                  in[DAEMON_LINE];  /* linea a medias */
+    char                  out[DAEMON_OUT];  /* respuestas sin enviar */
+
+} tftp_client_t;
+
+typedef struct tftp_daemon {
+    tftp_timer_t     reap;      /* libera lo terminado fuera de su pila */
+    tftp_timer_t     progress;  /* avance de lo que esta en curso */
+    tftp_watch_t     listen;    /* conexiones nuevas */
+    tftp_watch_t     signals;   /* SIGINT y SIGTERM */
+    int              listen_fd; /* socket Unix de control */
+    int              signal_fd; /* signalfd de las señales */
+    const char *     path;      /* ruta del socket */
+    tftp_loop_t *    loop;      /* bucle de todas las sesiones */
+    tftp_t *         model;     /* opciones comunes */
+    tftp_race_t *    server;    /* direcciones resueltas del servidor */
+    tftp_board_t *   board;     /* marcador de los espejos, o NULL */
+    void ( *start_rrq ) ( tftp_t *instance ); /* envia un RRQ */
+    void ( *start_wrq ) ( tftp_t *instance ); /* envia un WRQ */
+    unsigned         jobs;      /* transferencias a la vez */
+    unsigned         per_server; /* a la vez por espejo, 0 = sin limite */
+    unsigned         running;   /* transferencias en curso */
+    unsigned         host_running[RACE_HOSTS]; /* en curso por espejo */
+    uint64_t         down_until[RACE_HOSTS]; /* caido hasta (ms), ver server */
+    bool             filling;   /* dentro de daemon_fill */
+    bool             stopping;  /* llego una señal */
+    tftp_request_t * queue;     /* esperando turno, por orden */
+    tftp_request_t * tail;      /* ultima de queue */
+    tftp_request_t * active;    /* en curso */
+    tftp_request_t * dead;      /* terminadas por liberar */
+    tftp_client_t *  clients;   /* conexiones abiertas */
+    tftp_client_t *  gone;      /* conexiones cerradas por liberar */
+
+} tftp_daemon_t;
+
+int daemon_open ( tftp_daemon_t *daemon, const char *path );
+
+void daemon_run ( tftp_daemon_t *daemon );
+
+#endif
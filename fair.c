@@ -0,0 +1,193 @@
+#include "fair.h"
+#include "loop.h"
+
+static void sched_run ( tftp_timer_t *timer );
+
+void sched_init ( tftp_sched_t *sched, tftp_wheel_t *wheel,
+                  tftp_bucket_t *rate ) {
+    memset ( sched, 0, sizeof ( tftp_sched_t ) );
+    sched->wheel        = wheel;
+    sched->rate         = rate;
+    sched->timer.expire = sched_run;
+}
+
+/*  sched_arm
+    Programa el siguiente reparto para cuando el cubo tenga tokens
+*/
+
+static void sched_arm ( tftp_sched_t *sched, uint64_t now ) {
+    if ( sched->running || timer_armed ( &sched->timer ) )
+        return;
+
+    timer_arm ( sched->wheel, &sched->timer,
+                ( now + bucket_wait ( sched->rate, now ) + 999 ) / 1000 );
+}
+
+/*  sched_join
+    Pone la sesion a esperar turno en su clase: al final, o delante si se
+    quedo sin tokens a mitad de un turno que aun no habia gastado
+*/
+
+static void sched_join ( tftp_sched_t *sched, tftp_t *instance, bool front,
+                         uint64_t now ) {
+    unsigned c = instance->prio;
+
+    instance->turn = false;
+
+    if ( instance->queued )
+        return;
+
+    instance->queued = true;
+
+    if ( front ) {
+        instance->sched_next = sched->head[c];
+        sched->head[c]       = instance;
+
+        if ( sched->tail[c] == NULL )
+            sched->tail[c] = instance;
+
+    } else {
+        instance->sched_next = NULL;
+
+        if ( sched->tail[c] != NULL )
+            sched->tail[c]->sched_next = instance;
+        else
+            sched->head[c] = instance;
+
+        sched->tail[c] = instance;
+    }
+
+    sched->waiting++;
+    sched_arm ( sched, now );
+}
+
+/*  sched_pop
+    Saca la primera sesion de la clase mas urgente que tenga alguna
+*/
+
+static tftp_t *sched_pop ( tftp_sched_t *sched ) {
+    tftp_t * instance;
+    unsigned c;
+
+    for ( c = 0; sched->head[c] == NULL; c++ )
+        ;
+
+    instance       = sched->head[c];
+    sched->head[c] = instance->sched_next;
+
+    if ( sched->head[c] == NULL )
+        sched->tail[c] = NULL;
+
+    instance->sched_next = NULL;
+    instance->queued     = false;
+    sched->waiting--;
+
+    return instance;
+}
+
+/*  sched_wait
+    Cuantos us tiene que esperar la sesion por el limite global. Si no es 0
+    queda en la cola y sera resume quien la avise en su turno.
+*/
+
+uint64_t sched_wait ( tftp_sched_t *sched, tftp_t *instance, uint64_t now ) {
+    uint64_t wait = bucket_wait ( sched->rate, now );
+
+    if ( instance->queued )
+        return wait != 0 ? wait : 1;
+
+    if ( instance->turn ) {
+        if ( wait == 0 && instance->deficit > 0 )
+            return 0;
+
+        sched_join ( sched, instance, instance->deficit > 0, now );
+        return wait != 0 ? wait : 1;
+    }
+
+    /* Sin nadie delante, lo que haya en el cubo es de quien llegue */
+
+    if ( wait == 0 && sched->waiting == 0 )
+        return 0;
+
+    sched_join ( sched, instance, false, now );
+    return wait != 0 ? wait : 1;
+}
+
+/*  sched_spend
+    Descuenta lo enviado del turno de la sesion
+*/
+
+void sched_spend ( tftp_t *instance, size_t bytes ) {
+    if ( instance->turn )
+        instance->deficit -= bytes;
+}
+
+/*  sched_leave
+    La sesion termina: sale de la cola si estaba esperando
+*/
+
+void sched_leave ( tftp_sched_t *sched, tftp_t *instance ) {
+    unsigned c = instance->prio;
+    tftp_t **p, *prev = NULL;
+
+    instance->turn = false;
+
+    if ( !instance->queued )
+        return;
+
+    for ( p = &sched->head[c]; *p != instance; p = &( *p )->sched_next )
+        prev = *p;
+
+    *p = instance->sched_next;
+
+    if ( sched->tail[c] == instance )
+        sched->tail[c] = prev;
+
+    instance->sched_next = NULL;
+    instance->queued     = false;
+    sched->waiting--;
+}
+
+/*  sched_run
+    Reparte lo que haya en el cubo. Un deficit aun negativo tras sumarle el
+    quantum (se paso mucho en el turno anterior) cede el turno a la
+    siguiente; lo que no gaste quien deja de tener algo que enviar no se
+    guarda para despues.
+*/
+
+static void sched_run ( tftp_timer_t *timer ) {
+    tftp_sched_t *sched = ( tftp_sched_t * ) timer;
+    uint64_t      now   = loop_now_us ();
+    tftp_t *      instance;
+
+    sched->running = true;
+
+    while ( sched->waiting > 0 && bucket_wait ( sched->rate, now ) == 0 ) {
+        instance = sched_pop ( sched );
+
+        if ( instance->deficit <= 0 )
+            instance->deficit += SCHED_QUANTUM;
+
+        if ( instance->deficit <= 0 ) {
+            sched_join ( sched, instance, false, now );
+            continue;
+        }
+
+        instance->turn = true;
+
+        if ( instance->resume != NULL )
+            instance->resume ( instance );
+
+        instance->turn = false;
+
+        if ( !instance->queued && instance->deficit > 0 )
+            instance->deficit = 0;
+
+        now = loop_now_us ();
+    }
+
+    sched->running = false;
+
+    if ( sched->waiting > 0 )
+        sched_arm ( sched, now );
+}
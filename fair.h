@@ -0,0 +1,42 @@
+#ifndef FAIR_H
+#define FAIR_H
+
+#include "tftp.h"
+
+#define SCHED_CLASSES 4     /* clases de prioridad, 0 la mas urgente */
+#define SCHED_DEFAULT 2     /* clase de lo que no pide otra */
+#define SCHED_QUANTUM 16384 /* bytes que suma cada turno al deficit */
+
+/*  Reparto del limite global del bucle entre sus sesiones. Mientras el cubo
+    tenga tokens y nadie espere, cada sesion envia en cuanto puede; cuando se
+    agota, las que quieren sacar su ventana (o el ACK que pide la siguiente)
+    hacen cola aqui en vez de esperar cada una a su temporizador, y al
+    recargarse se les da turno por orden: primero la clase mas urgente con
+    alguien esperando y, dentro de la clase, deficit round robin. Cada turno
+    suma SCHED_QUANTUM al deficit de la sesion, que envia mientras le quede;
+    lo que se pase se descuenta del siguiente. Asi una imagen enorme no deja
+    sin ancho a un archivo urgente, y las de una misma clase se lo reparten
+    por bytes, sea cual sea su blksize o su ventana. Sin limite global no hay
+    nada que repartir y no se usa. */
+
+typedef struct tftp_sched {
+    tftp_timer_t    timer;               /* siguiente reparto */
+    tftp_wheel_t *  wheel;               /* rueda del bucle */
+    tftp_bucket_t * rate;                /* limite que se reparte */
+    tftp_t *        head[SCHED_CLASSES]; /* esperando turno, por clase */
+    tftp_t *        tail[SCHED_CLASSES]; /* ultima de cada cola */
+    unsigned        waiting;             /* sesiones en las colas */
+    bool            running;             /* dentro de sched_run */
+
+} tftp_sched_t;
+
+void sched_init ( tftp_sched_t *sched, tftp_wheel_t *wheel,
+                  tftp_bucket_t *rate );
+
+uint64_t sched_wait ( tftp_sched_t *sched, tftp_t *instance, uint64_t now );
+
+void sched_spend ( tftp_t *instance, size_t bytes );
+
+void sched_leave ( tftp_sched_t *sched, tftp_t *instance );
+
+#endif
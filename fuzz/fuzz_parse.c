@@ -0,0 +1,111 @@
+/*  fuzz_parse
+    Objetivo de libFuzzer para parse_msg y dec_oack: cualquier secuencia de
+    bytes tiene que dar un msg valido con todos sus punteros dentro de la
+    entrada, o -1. Con -DFUZZ_REPLAY se compila sin libFuzzer y repite los
+    archivos que se le pasen (el corpus), asi se puede correr sin clang.
+
+    uso: fuzz_parse [opciones de libFuzzer] fuzz/corpus/parse
+         replay_parse archivo...
+*/
+
+#include <assert.h>
+
+#include "../tftp.h"
+
+/*  inside
+    Comprueba que la cadena de p termina antes de end
+*/
+
+static void inside ( const u_char *buf, const u_char *end, const char *p ) {
+    const u_char *s = ( const u_char * ) p;
+
+    assert ( s >= buf && s < end );
+    assert ( memchr ( s, '\0', end - s ) != NULL );
+}
+
+int LLVMFuzzerTestOneInput ( const uint8_t *data, size_t size ) {
+    static tftp_t *instance;
+    tftp_msg_t     msg;
+    u_char *       buf;
+    size_t         max_data;
+    unsigned       i;
+
+    if ( instance == NULL && ( instance = tftp_new () ) == NULL )
+        return 0;
+
+    /*  Copia del tamaño justo, para que el sanitizer vea cualquier lectura
+        fuera; el limite de DATA sale del propio tamaño */
+
+    if ( size == 0 || ( buf = malloc ( size ) ) == NULL )
+        return 0;
+
+    memcpy ( buf, data, size );
+    max_data = size % 2 ? MAX_BLKSIZE : BUFSIZE;
+
+    if ( parse_msg ( buf, size, max_data, &msg ) == 0 ) {
+        /*  El bucle descarta lo que no llega a 4 bytes, el parser tambien */
+
+        assert ( size >= 4 );
+
+        switch ( msg.opcode ) {
+        case OPCODE_DATA:
+            assert ( msg.len <= max_data && msg.data + msg.len == buf + size );
+            break;
+
+        case OPCODE_ACK:
+            break;
+
+        case OPCODE_ERROR:
+            assert ( msg.data + msg.len <= buf + size );
+            assert ( memchr ( msg.data, '\0', msg.len ) == NULL );
+            break;
+
+        case OPCODE_OACK:
+            assert ( msg.nopts <= PARSE_MAX_OPTS );
+
+            for ( i = 0; i < msg.nopts; i++ ) {
+                inside ( buf, buf + size, msg.name[i] );
+                inside ( buf, buf + size, msg.value[i] );
+            }
+
+            instance->blksize_opt = MAX_BLKSIZE;
+            instance->window_opt  = MAX_WINDOWSIZE;
+            dec_oack ( instance, &msg );
+            break;
+
+        default:
+            assert ( 0 );
+        }
+    }
+
+    free ( buf );
+
+    return 0;
+}
+
+#ifdef FUZZ_REPLAY
+
+int main ( int argc, char **argv ) {
+    static uint8_t data[MAX_BLKSIZE + 4];
+    FILE *         file;
+    size_t         size;
+    int            i;
+
+    for ( i = 1; i < argc; i++ ) {
+        if ( ( file = fopen ( argv[i], "rb" ) ) == NULL ) {
+            perror ( argv[i] );
+            return EXIT_FAILURE;
+        }
+
+        size = fread ( data, 1, sizeof ( data ), file );
+        fclose ( file );
+
+        LLVMFuzzerTestOneInput ( data, size );
+    }
+
+    printf ( "%d inputs ok\n", argc - 1 );
+
+    return EXIT_SUCCESS;
+}
+
+#endif
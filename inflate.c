@@ -0,0 +1,330 @@
+#include "inflate.h"
+#include "output.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/*  inflate_chunk
+    Descomprime len bytes de p y escribe lo que salga. Tras el final de un
+    miembro gzip puede venir otro (archivos concatenados), se sigue con el.
+
+    Devuelve 0, o el errno del fallo
+*/
+
+static int inflate_chunk ( tftp_inflate_t *gz, u_char *p, size_t len ) {
+    size_t n;
+    int    ret;
+
+    gz->z.next_in  = p;
+    gz->z.avail_in = len;
+
+    for ( ;; ) {
+        if ( gz->ended && gz->z.avail_in > 0 ) {
+            inflateReset ( &gz->z );
+            gz->ended = false;
+        }
+
+        gz->z.next_out  = gz->out_buf;
+        gz->z.avail_out = INFLATE_OUT;
+
+        ret = inflate ( &gz->z, Z_NO_FLUSH );
+
+        if ( ret == Z_STREAM_END )
+            gz->ended = true;
+
+        else if ( ret != Z_OK && ret != Z_BUF_ERROR )
+            return ret == Z_MEM_ERROR ? ENOMEM : EPROTO;
+
+        n = INFLATE_OUT - gz->z.avail_out;
+
+        if ( n > 0 && out_store ( gz->out, gz->out_buf, n ) == -1 )
+            return errno;
+
+        /* Sin entrada y con sitio de sobra en la salida, no queda nada */
+
+        if ( ret == Z_BUF_ERROR
+             || ( gz->z.avail_in == 0 && gz->z.avail_out != 0 ) )
+            return 0;
+    }
+}
+
+/*  inflate_notify
+    Avisa al bucle si esperaba sitio y ya lo hay, o si el hilo fallo (con el
+    cerrojo tomado)
+*/
+
+static void inflate_notify ( tftp_inflate_t *gz ) {
+    if ( gz->want == 0
+         || ( gz->size - gz->used < gz->want && gz->error == 0 ) )
+        return;
+
+    gz->want = 0;
+    eventfd_write ( gz->efd, 1 );
+}
+
+/*  inflate_main
+    Hilo descompresor: consume el anillo hasta que se cierra o falla, y
+    avisa al bucle de que acabo. Los bytes se descomprimen en su sitio, el
+    receptor no los pisa hasta que se descuentan de used.
+*/
+
+static void *inflate_main ( void *arg ) {
+    tftp_inflate_t *gz = arg;
+    size_t          chunk;
+    int             error;
+
+    pthread_mutex_lock ( &gz->lock );
+
+    for ( ;; ) {
+        while ( gz->used == 0 && !gz->closed && gz->error == 0 )
+            pthread_cond_wait ( &gz->ready, &gz->lock );
+
+        if ( gz->used == 0 || gz->error != 0 )
+            break;
+
+        chunk = gz->size - gz->head;
+
+        if ( chunk > gz->used )
+            chunk = gz->used;
+
+        pthread_mutex_unlock ( &gz->lock );
+
+        error = inflate_chunk ( gz, gz->ring + gz->head, chunk );
+
+        pthread_mutex_lock ( &gz->lock );
+
+        if ( error != 0 && gz->error == 0 )
+            gz->error = error;
+
+        gz->head = ( gz->head + chunk ) % gz->size;
+        gz->used -= chunk;
+        inflate_notify ( gz );
+    }
+
+    gz->finished = true;
+    eventfd_write ( gz->efd, 1 );
+    pthread_mutex_unlock ( &gz->lock );
+
+    return NULL;
+}
+
+/*  inflate_start
+    Arranca el hilo que descomprime hacia out (ya abierta). El anillo tiene
+    sitio al menos para window bytes, lo que el servidor manda por ACK.
+
+    Devuelve el descompresor, o NULL con errno
+*/
+
+tftp_inflate_t *inflate_start ( struct tftp_out *out, size_t window ) {
+    tftp_inflate_t *gz = calloc ( 1, sizeof ( tftp_inflate_t ) );
+    int             error;
+
+    if ( gz == NULL )
+        return NULL;
+
+    gz->out     = out;
+    gz->size    = window > INFLATE_RING ? window : INFLATE_RING;
+    gz->ring    = malloc ( gz->size );
+    gz->out_buf = malloc ( INFLATE_OUT );
+
+    /* 15 + 32: ventana maxima y deteccion automatica de gzip o zlib */
+
+    if ( gz->ring == NULL || gz->out_buf == NULL
+         || inflateInit2 ( &gz->z, 15 + 32 ) != Z_OK ) {
+        free ( gz->ring );
+        free ( gz->out_buf );
+        free ( gz );
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if ( ( gz->efd = eventfd ( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ) == -1 ) {
+        error = errno;
+        inflateEnd ( &gz->z );
+        free ( gz->ring );
+        free ( gz->out_buf );
+        free ( gz );
+        errno = error;
+        return NULL;
+    }
+
+    pthread_mutex_init ( &gz->lock, NULL );
+    pthread_cond_init ( &gz->ready, NULL );
+
+    if ( ( error = pthread_create ( &gz->thread, NULL, inflate_main, gz ) ) != 0 ) {
+        inflateEnd ( &gz->z );
+        close ( gz->efd );
+        pthread_cond_destroy ( &gz->ready );
+        pthread_mutex_destroy ( &gz->lock );
+        free ( gz->ring );
+        free ( gz->out_buf );
+        free ( gz );
+        errno = error;
+        return NULL;
+    }
+
+    return gz;
+}
+
+/*  inflate_room
+    Mira si caben len bytes mas en el anillo. Si no, el hilo escribira en
+    gz->efd cuando quepan (o si falla), para que la sesion espere sin
+    bloquear el bucle (session_sleep).
+
+    Devuelve true si caben o el hilo ya fallo (inflate_push lo dira)
+*/
+
+bool inflate_room ( tftp_inflate_t *gz, size_t len ) {
+    bool room;
+
+    if ( len > gz->size )
+        len = gz->size;
+
+    pthread_mutex_lock ( &gz->lock );
+
+    room = gz->size - gz->used >= len || gz->error != 0;
+
+    if ( !room )
+        gz->want = len;
+
+    pthread_mutex_unlock ( &gz->lock );
+
+    return room;
+}
+
+/*  inflate_push
+    Deja len bytes comprimidos en el anillo, sin esperar: quien los recibe
+    ya se aseguro de que caben (inflate_room)
+
+    Devuelve len, o -1 con el errno del hilo si este fallo, o ENOBUFS si no
+    caben
+*/
+
+ssize_t inflate_push ( tftp_inflate_t *gz, const void *data, size_t len ) {
+    const u_char *p     = data;
+    size_t        left  = len;
+    int           error = 0;
+    size_t        tail, n;
+
+    pthread_mutex_lock ( &gz->lock );
+
+    if ( gz->error != 0 )
+        error = gz->error;
+
+    else if ( gz->size - gz->used < len )
+        error = ENOBUFS;
+
+    while ( error == 0 && left > 0 ) {
+        tail = ( gz->head + gz->used ) % gz->size;
+        n    = gz->size - tail;
+
+        if ( n > left )
+            n = left;
+
+        memcpy ( gz->ring + tail, p, n );
+        gz->used += n;
+        p += n;
+        left -= n;
+    }
+
+    if ( error == 0 )
+        pthread_cond_signal ( &gz->ready );
+
+    pthread_mutex_unlock ( &gz->lock );
+
+    if ( error != 0 ) {
+        errno = error;
+        return -1;
+    }
+
+    return len;
+}
+
+/*  inflate_free
+    Recoge el hilo y libera todo
+*/
+
+static int inflate_free ( tftp_inflate_t *gz ) {
+    int error;
+
+    pthread_join ( gz->thread, NULL );
+
+    error = gz->error;
+
+    if ( error == 0 && !gz->ended )
+        error = EPROTO; /* flujo truncado */
+
+    inflateEnd ( &gz->z );
+    close ( gz->efd );
+    pthread_cond_destroy ( &gz->ready );
+    pthread_mutex_destroy ( &gz->lock );
+    free ( gz->ring );
+    free ( gz->out_buf );
+    free ( gz );
+
+    return error;
+}
+
+/*  inflate_close
+    Ya llego todo: el hilo descomprime lo que quede y escribe en gz->efd al
+    acabar, para que la sesion lo espere sin bloquear el bucle
+    (session_sleep)
+*/
+
+void inflate_close ( tftp_inflate_t *gz ) {
+    pthread_mutex_lock ( &gz->lock );
+    gz->closed = true;
+    pthread_cond_signal ( &gz->ready );
+    pthread_mutex_unlock ( &gz->lock );
+}
+
+/*  inflate_done
+    El hilo acabo (tras inflate_close o un fallo) y recogerlo no espera
+*/
+
+bool inflate_done ( tftp_inflate_t *gz ) {
+    bool done;
+
+    pthread_mutex_lock ( &gz->lock );
+    done = gz->finished;
+    pthread_mutex_unlock ( &gz->lock );
+
+    return done;
+}
+
+/*  inflate_finish
+    Recoge el hilo cuando ya acabo (inflate_done) y libera el descompresor
+
+    Devuelve 0, o -1 con errno si fallo o el flujo estaba incompleto
+*/
+
+int inflate_finish ( tftp_inflate_t *gz ) {
+    int error;
+
+    if ( ( error = inflate_free ( gz ) ) != 0 ) {
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*  inflate_stop
+    La descarga se abandona: el hilo deja lo que tenga pendiente
+*/
+
+void inflate_stop ( tftp_inflate_t *gz ) {
+    pthread_mutex_lock ( &gz->lock );
+    gz->closed = true;
+
+    if ( gz->error == 0 )
+        gz->error = ECANCELED;
+
+    pthread_cond_signal ( &gz->ready );
+    pthread_mutex_unlock ( &gz->lock );
+
+    inflate_free ( gz );
+}
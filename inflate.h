@@ -0,0 +1,59 @@
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#define INFLATE_RING ( 1 << 20 )   /* bytes comprimidos en espera, minimo */
+#define INFLATE_OUT ( 64 << 10 )   /* salida de cada llamada a inflate */
+#define INFLATE_SUFFIX ".gz"       /* se pide archivo + sufijo */
+
+struct tftp_out;
+
+/*  Descompresion de una descarga en su propio hilo. El bucle deja los bytes
+    recibidos en un anillo y sigue; el hilo los descomprime (gzip o zlib) y
+    los escribe en el temporal de la salida. El bucle no espera nunca al
+    hilo: antes de pedir mas datos mira si caben (inflate_room), y si no la
+    sesion retiene el ACK hasta que el hilo avisa por el eventfd de que hay
+    sitio. La memoria queda acotada por el anillo. Con el ultimo bloque el
+    anillo se cierra (inflate_close) y la sesion duerme en el mismo eventfd
+    hasta que el hilo acaba; solo entonces se le recoge (inflate_finish) y
+    se publica el archivo. */
+
+typedef struct tftp_inflate {
+    pthread_t        thread;       /* hilo descompresor */
+    pthread_mutex_t  lock;         /* protege lo que comparten bucle e hilo */
+    pthread_cond_t   ready;        /* hay datos o se cerro */
+    int              efd;          /* eventfd: sitio pedido, fallo o fin */
+    size_t           want;         /* sitio que espera el bucle, 0 = nada */
+    u_char *         ring;         /* bytes comprimidos */
+    size_t           size;         /* tamaño del anillo */
+    size_t           head;         /* primer byte sin descomprimir */
+    size_t           used;         /* bytes en el anillo */
+    bool             closed;       /* no llegaran mas */
+    bool             finished;     /* el hilo acabo, se puede recoger */
+    bool             ended;        /* se vio el final del flujo */
+    int              error;        /* errno del hilo, 0 = sin error */
+    z_stream         z;            /* estado de zlib */
+    u_char *         out_buf;      /* salida descomprimida */
+    struct tftp_out *out;          /* destino */
+
+} tftp_inflate_t;
+
+tftp_inflate_t *inflate_start ( struct tftp_out *out, size_t window );
+
+bool inflate_room ( tftp_inflate_t *gz, size_t len );
+
+ssize_t inflate_push ( tftp_inflate_t *gz, const void *data, size_t len );
+
+void inflate_close ( tftp_inflate_t *gz );
+
+bool inflate_done ( tftp_inflate_t *gz );
+
+int inflate_finish ( tftp_inflate_t *gz );
+
+void inflate_stop ( tftp_inflate_t *gz );
+
+#endif
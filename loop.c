@@ -0,0 +1,1066 @@
+#include "loop.h"
+#include "ahead.h"
+#include "reorder.h"
+
+#include <stddef.h>
+#include <sys/epoll.h>
+#include <time.h>
+
+#define SESSION_OF( timer, field ) \
+    ( ( tftp_t * ) ( ( char * ) ( timer ) - offsetof ( tftp_t, field ) ) )
+
+static void session_expire ( tftp_timer_t *timer );
+
+static void session_resume ( tftp_timer_t *timer );
+
+static void sock_ready ( tftp_loop_t *loop, tftp_watch_t *watch,
+                         uint32_t events );
+
+static void sock_closed ( tftp_loop_t *loop, tftp_watch_t *watch,
+                          uint32_t events );
+
+static void sock_cancelled ( tftp_loop_t *loop, tftp_watch_t *watch,
+                             uint32_t events );
+
+static void sock_expire ( tftp_timer_t *timer );
+
+static void sock_close ( tftp_loop_t *loop, tftp_sock_t *sock );
+
+static void loop_reap ( tftp_loop_t *loop );
+
+static void session_wake ( tftp_loop_t *loop, tftp_watch_t *watch,
+                           uint32_t events );
+
+static const char cancelled_reason[] = "Transfer cancelled";
+
+uint64_t loop_now_us ( void ) {
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return ( uint64_t ) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int loop_init ( tftp_loop_t *loop ) {
+    loop->active  = 0;
+    loop->failed  = 0;
+    loop->shared    = NULL;
+    loop->nshared   = 0;
+    loop->busy_poll = 0;
+    loop->watched   = 0;
+    loop->closed    = NULL;
+    loop->lingering = NULL;
+    loop->epfd   = epoll_create1 ( EPOLL_CLOEXEC );
+
+    if ( loop->epfd == -1 )
+        return -1;
+
+    if ( table_init ( &loop->table, 1 ) == -1 ) {
+        close ( loop->epfd );
+        return -1;
+    }
+
+    wheel_init ( &loop->wheel, loop_now_us () / 1000 );
+    bucket_init ( &loop->rate, 0, 0 );
+    sched_init ( &loop->sched, &loop->wheel, &loop->rate );
+    return 0;
+}
+
+void loop_destroy ( tftp_loop_t *loop ) {
+    tftp_sock_t *sock;
+    unsigned     i;
+
+    while ( ( sock = loop->lingering ) != NULL ) {
+        loop->lingering = sock->next;
+        timer_cancel ( &loop->wheel, &sock->linger );
+        sock_close ( loop, sock );
+    }
+
+    loop_reap ( loop );
+
+    for ( i = 0; i < loop->nshared; i++ ) {
+        close ( loop->shared[i].fd );
+        pool_put ( loop->shared[i].buf );
+    }
+
+    free ( loop->shared );
+    close ( loop->epfd );
+    table_destroy ( &loop->table );
+}
+
+/*  loop_reap
+    Devuelve al pool los sockets propios que se cerraron. Se hace entre dos
+    lotes de epoll_wait: en el mismo lote puede quedar un evento suyo y
+    loop_run no puede llamar a un watch ya liberado.
+*/
+
+static void loop_reap ( tftp_loop_t *loop ) {
+    tftp_sock_t *sock;
+
+    while ( ( sock = loop->closed ) != NULL ) {
+        loop->closed = sock->next;
+        pool_put ( sock );
+    }
+}
+
+/*  sock_busy_poll
+    Pide al kernel que al leer sondee la cola del dispositivo hasta us us
+    antes de dormir. Subirlo por encima de net.core.busy_read necesita
+    CAP_NET_ADMIN; si no se puede, queda la espera activa de loop_spin.
+*/
+
+static void sock_busy_poll ( tftp_sock_t *sock, uint32_t us ) {
+    int value = us;
+
+    if ( setsockopt ( sock->fd, SOL_SOCKET, SO_BUSY_POLL, &value,
+                      sizeof ( value ) )
+         == -1 )
+        syslog ( LOG_WARNING, "Error from setsockopt(SO_BUSY_POLL): %s",
+                 strerror ( errno ) );
+
+#ifdef SO_PREFER_BUSY_POLL
+    value = 1;
+    setsockopt ( sock->fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &value,
+                 sizeof ( value ) );
+#endif
+}
+
+/*  sock_open
+    Crea un socket UDP no bloqueante de la familia dada, ligado a un puerto
+    que elige el sistema. El puerto lo necesitamos para la 4-tupla con la que
+    se buscan las sesiones. Los IPv6 son solo IPv6, los IPv4 van por los
+    suyos.
+*/
+
+static int sock_open ( tftp_loop_t *loop, tftp_sock_t *sock, int family ) {
+    struct epoll_event ev;
+    socklen_t          size = sizeof ( sock->addr );
+    int                on   = 1;
+
+    memset ( &sock->addr, 0, sizeof ( sock->addr ) );
+    sock->addr.ss_family = family;
+
+    sock->fd = socket ( family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+
+    if ( sock->fd == -1 )
+        return -1;
+
+    if ( family == AF_INET6 )
+        setsockopt ( sock->fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof ( on ) );
+
+    sock->watch.ready = sock_ready;
+
+    ev.events   = EPOLLIN;
+    ev.data.ptr = &sock->watch;
+
+    if ( loop->busy_poll != 0 )
+        sock_busy_poll ( sock, loop->busy_poll );
+
+    if ( bind ( sock->fd, ( struct sockaddr * ) &sock->addr,
+                family == AF_INET6 ? sizeof ( struct sockaddr_in6 )
+                                   : sizeof ( struct sockaddr_in ) )
+             == -1
+         || getsockname ( sock->fd, ( struct sockaddr * ) &sock->addr, &size )
+                == -1
+         || epoll_ctl ( loop->epfd, EPOLL_CTL_ADD, sock->fd, &ev ) == -1 ) {
+        close ( sock->fd );
+        return -1;
+    }
+
+    sock->addrlen = size;
+    return 0;
+}
+
+/*  loop_share
+    Crea count sockets por familia (IPv4 e IPv6) que compartiran todas las
+    sesiones que se registren despues, cada uno en su puerto. Asi los
+    descriptores y los registros en epoll no crecen con las sesiones. Si el
+    sistema no tiene IPv6 se queda solo con los IPv4.
+*/
+
+int loop_share ( tftp_loop_t *loop, unsigned count ) {
+    static const int families[] = { AF_INET, AF_INET6 };
+    tftp_sock_t *    shared     = calloc ( 2 * count, sizeof ( tftp_sock_t ) );
+    unsigned         n          = 0;
+    unsigned         f, i;
+
+    if ( shared == NULL )
+        return -1;
+
+    for ( f = 0; f < 2; f++ ) {
+        for ( i = 0; i < count; i++ ) {
+            shared[n].buf = pool_get ( 4 + MAX_BLKSIZE );
+
+            if ( shared[n].buf != NULL
+                 && sock_open ( loop, &shared[n], families[f] ) == 0 ) {
+                n++;
+                continue;
+            }
+
+            pool_put ( shared[n].buf );
+
+            if ( families[f] == AF_INET6 && errno == EAFNOSUPPORT )
+                break;
+
+            while ( n-- > 0 ) {
+                close ( shared[n].fd );
+                pool_put ( shared[n].buf );
+            }
+
+            free ( shared );
+            return -1;
+        }
+    }
+
+    loop->shared  = shared;
+    loop->nshared = n;
+
+    return 0;
+}
+
+/*  loop_pick
+    Elige el socket compartido de la familia del servidor con menos sesiones
+    que no tenga ya una peticion sin respuesta al mismo servidor: la primera
+    respuesta se asigna por la direccion remota, dos peticiones pendientes al
+    mismo servidor desde el mismo puerto no se podrian distinguir. NULL si no
+    hay ninguno.
+*/
+
+static tftp_sock_t *loop_pick ( tftp_loop_t *loop, tftp_t *instance ) {
+    tftp_sock_t *best   = NULL;
+    uint32_t     raddr  = addr_key ( ( struct sockaddr * ) &instance->remote_addr );
+    int          family = instance->remote_addr.ss_family;
+    tftp_sock_t *sock;
+    unsigned     i;
+
+    for ( i = 0; i < loop->nshared; i++ ) {
+        sock = &loop->shared[i];
+
+        if ( sock->addr.ss_family != family
+             || ( best != NULL && sock->users >= best->users ) )
+            continue;
+
+        if ( table_lookup ( &loop->table, raddr, 0,
+                            addr_key ( ( struct sockaddr * ) &sock->addr ),
+                            addr_port ( ( struct sockaddr * ) &sock->addr ) )
+             != NULL )
+            continue;
+
+        best = sock;
+    }
+
+    return best;
+}
+
+/*  loop_add
+    Registra una sesion en uno de los sockets compartidos, o en uno propio si
+    no los hay o no sirve ninguno. La sesion entra en la tabla sin tid y con
+    el timeout inicial por defecto. Si la sesion tiene limite de ritmo se le
+    pasa tambien al kernel con SO_MAX_PACING_RATE, que lo aplica si la
+    interfaz usa la qdisc fq.
+*/
+
+int loop_add ( tftp_loop_t *loop, tftp_t *instance ) {
+    tftp_sock_t *sock = loop_pick ( loop, instance );
+    uint32_t     pacing;
+
+    if ( sock == NULL ) {
+        sock = pool_get ( sizeof ( tftp_sock_t ) );
+
+        if ( sock == NULL ) {
+            errno = ENOMEM;
+            return -1;
+        }
+
+        if ( sock_open ( loop, sock, instance->remote_addr.ss_family ) == -1 ) {
+            pool_put ( sock );
+            return -1;
+        }
+
+        sock->owner = instance;
+        sock->users = 0;
+        sock->buf   = NULL;
+    }
+
+    instance->sock             = sock;
+    instance->local_descriptor = sock->fd;
+    instance->local_addr       = sock->addr;
+    instance->size_local       = sock->addrlen;
+
+    if ( table_insert ( &loop->table, instance ) == NULL ) {
+        if ( sock->owner == instance ) {
+            close ( sock->fd );
+            pool_put ( sock );
+        }
+
+        instance->sock             = NULL;
+        instance->local_descriptor = -1;
+        return -1;
+    }
+
+    sock->users++;
+
+    instance->loop       = loop;
+    instance->done       = false;
+    instance->failed     = false;
+    instance->cancelled  = false;
+    instance->sleep_fd   = -1;
+    instance->wake.ready = session_wake;
+    instance->srtt   = 0;
+    instance->rttvar = 0;
+    instance->rto    = DEF_TIMEOUT_SEC * 1000 + DEF_TIMEOUT_USEC / 1000;
+    instance->timer.expire = session_expire;
+    instance->pace.expire  = session_resume;
+    loop->active++;
+
+    memset ( &instance->stats, 0, sizeof ( instance->stats ) );
+    instance->stats.start = loop_now_us ();
+
+    cc_init ( &instance->cc, instance->window );
+
+    if ( instance->rate.rate != 0 && sock->owner == instance ) {
+        pacing = instance->rate.rate > UINT32_MAX ? UINT32_MAX
+                                                  : instance->rate.rate;
+        setsockopt ( instance->local_descriptor, SOL_SOCKET,
+                     SO_MAX_PACING_RATE, &pacing, sizeof ( pacing ) );
+    }
+
+    return 0;
+}
+
+/*  session_output
+    Envia el msg de pkt al servidor. Con el socket conectado a su tid no hace
+    falta pasar la direccion ni que el kernel resuelva la ruta en cada envio.
+    Si el buffer del socket esta lleno (una rafaga de ventana grande) el msg
+    se da por perdido: lo repite el reenvio y el control de congestion frena.
+    En un socket conectado el ICMP de puerto inalcanzable de un envio
+    anterior (un reenvio que llego con el servidor ya cerrado) sale en este
+    como ECONNREFUSED sin enviar nada: se repite una vez y, si vuelve, del
+    servidor caido ya se encarga el timeout.
+
+    Devuelve 0, o -1 si fallo el envio
+*/
+
+int session_output ( tftp_t *instance ) {
+    ssize_t sent;
+    int     refused = 0;
+
+    do {
+        if ( instance->connected )
+            sent = send ( instance->local_descriptor, instance->pkt,
+                          instance->pkt_len, 0 );
+        else
+            sent = sendto ( instance->local_descriptor, instance->pkt,
+                            instance->pkt_len, 0,
+                            ( struct sockaddr * ) &instance->remote_addr,
+                            instance->size_remote );
+    } while ( sent == -1
+              && ( errno == EINTR
+                   || ( errno == ECONNREFUSED && refused++ == 0 ) ) );
+
+    if ( sent == -1
+         && ( errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS
+              || errno == ECONNREFUSED ) )
+        return 0;
+
+    return sent == ( ssize_t ) instance->pkt_len ? 0 : -1;
+}
+
+/*  session_xmit
+    Envia el msg de pkt y arma el reenvio para dentro de rto
+*/
+
+static int session_xmit ( tftp_t *instance ) {
+    tftp_loop_t *loop = instance->loop;
+    int          sent;
+    uint64_t     expires;
+
+    instance->sent_at = loop_now_us ();
+    expires           = instance->sent_at / 1000 + instance->rto;
+
+    sent = session_output ( instance );
+
+    timer_arm ( &loop->wheel, &instance->timer, expires );
+    HOT ( instance )->deadline = ( uint32_t ) expires;
+
+    return sent;
+}
+
+/*  session_send
+    Envia un msg nuevo (no un reenvio) que queda en pkt por si hay que
+    repetirlo. Su respuesta servira para medir el rtt.
+*/
+
+int session_send ( tftp_t *instance ) {
+    instance->resent = false;
+    return session_xmit ( instance );
+}
+
+/*  session_burst
+    Envia pkt como un bloque mas de una ventana, sin tocar el reenvio: quien
+    envia la ventana lo arma al final con session_arm. El rtt se mide desde el
+    primer bloque.
+*/
+
+int session_burst ( tftp_t *instance ) {
+    if ( instance->sent_at == 0 )
+        instance->sent_at = loop_now_us ();
+
+    return session_output ( instance );
+}
+
+/*  session_arm
+    Arma el reenvio para dentro de rto si no estaba armado
+*/
+
+void session_arm ( tftp_t *instance ) {
+    uint64_t expires;
+
+    if ( timer_armed ( &instance->timer ) )
+        return;
+
+    expires = loop_now_us () / 1000 + instance->rto;
+
+    timer_arm ( &instance->loop->wheel, &instance->timer, expires );
+    HOT ( instance )->deadline = ( uint32_t ) expires;
+}
+
+/*  session_wait
+    Cuantos us faltan para que la sesion pueda enviar segun su limite y el
+    ritmo de su control de congestion; 0 si puede ya. Cumplidos los suyos,
+    el limite global decide a quien le toca (fair.h).
+*/
+
+uint64_t session_wait ( tftp_t *instance ) {
+    uint64_t now = loop_now_us ();
+    uint64_t wait, max;
+
+    max = bucket_wait ( &instance->rate, now );
+
+    if ( ( wait = bucket_wait ( &instance->cc.pace, now ) ) > max )
+        max = wait;
+
+    if ( max > 0 )
+        return max;
+
+    return sched_wait ( &instance->loop->sched, instance, now );
+}
+
+void session_spend ( tftp_t *instance, size_t bytes ) {
+    bucket_take ( &instance->rate, bytes );
+    bucket_take ( &instance->loop->rate, bytes );
+    bucket_take ( &instance->cc.pace, bytes );
+    sched_spend ( instance, bytes );
+}
+
+/*  session_pace
+    Espera wait us y llama a resume de la sesion. Si espera turno del limite
+    global ya la avisara el reparto.
+*/
+
+void session_pace ( tftp_t *instance, uint64_t wait ) {
+    if ( timer_armed ( &instance->pace ) || instance->queued )
+        return;
+
+    timer_arm ( &instance->loop->wheel, &instance->pace,
+                ( loop_now_us () + wait + 999 ) / 1000 );
+}
+
+static void session_resume ( tftp_timer_t *timer ) {
+    tftp_t *instance = SESSION_OF ( timer, pace );
+
+    if ( instance->resume != NULL )
+        instance->resume ( instance );
+}
+
+/*  session_rtt
+    Ha llegado la respuesta esperada: se desarma el reenvio, se reinician los
+    reintentos y, si el msg no se reenvio (Karn), se ajusta el rto con la
+    muestra como en el RFC 6298
+*/
+
+void session_rtt ( tftp_t *instance ) {
+    uint64_t sample;
+    uint32_t rto;
+
+    timer_cancel ( &instance->loop->wheel, &instance->timer );
+    HOT ( instance )->retries = 0;
+
+    /*  Una muestra por envio, y ninguna si hubo reenvio: no se sabe a cual de
+        los dos responde */
+
+    if ( instance->resent || instance->sent_at == 0 ) {
+        instance->resent  = false;
+        instance->sent_at = 0;
+        return;
+    }
+
+    sample            = loop_now_us () - instance->sent_at;
+    instance->sent_at = 0;
+
+    if ( sample == 0 )
+        sample = 1;
+
+    lat_add ( &instance->stats.lat, sample );
+
+    if ( instance->srtt == 0 ) {
+        instance->srtt   = sample;
+        instance->rttvar = sample / 2;
+
+    } else {
+        instance->rttvar = ( 3 * ( uint64_t ) instance->rttvar
+                             + ( instance->srtt > sample
+                                     ? instance->srtt - sample
+                                     : sample - instance->srtt ) )
+                           / 4;
+        instance->srtt = ( 7 * ( uint64_t ) instance->srtt + sample ) / 8;
+    }
+
+    rto = ( instance->srtt + 4 * instance->rttvar + 999 ) / 1000;
+
+    if ( rto < RTO_MIN_MS )
+        rto = RTO_MIN_MS;
+
+    if ( rto > RTO_MAX_MS )
+        rto = RTO_MAX_MS;
+
+    instance->rto = rto;
+}
+
+/*  session_expire
+    Vencio el reenvio: se repite el ultimo msg doblando el rto, hasta
+    DEF_RETRIES veces seguidas sin respuesta. Si la sesion tiene su propio
+    reenvio (una ventana entera, por ejemplo) se usa ese.
+*/
+
+static void session_expire ( tftp_timer_t *timer ) {
+    tftp_t *    instance = SESSION_OF ( timer, timer );
+    tftp_hot_t *hot      = HOT ( instance );
+
+    hot->retries++;
+    instance->stats.resent++;
+
+    if ( hot->retries >= DEF_RETRIES ) {
+        instance->lost = true;
+        session_error ( instance, "Retries limit reached for %s.",
+                        instance->file );
+        return;
+    }
+
+    syslog ( LOG_NOTICE, "Retry number %d for %s; blknum %llu",
+             ( int ) hot->retries, instance->file,
+             ( unsigned long long ) hot->blknum );
+
+    instance->rto    = instance->rto * 2 > RTO_MAX_MS ? RTO_MAX_MS
+                                                      : instance->rto * 2;
+    instance->resent = true;
+
+    if ( instance->retry != NULL )
+        instance->retry ( instance );
+
+    else if ( session_xmit ( instance ) == -1 )
+        session_error ( instance, "Error from sendto() retrying %s: %s",
+                        instance->file, strerror ( errno ) );
+}
+
+/*  sock_close
+    Cierra un socket propio; vuelve al pool tras el lote (loop_reap)
+*/
+
+static void sock_close ( tftp_loop_t *loop, tftp_sock_t *sock ) {
+    close ( sock->fd );
+    sock->fd          = -1;
+    sock->owner       = NULL;
+    sock->watch.ready = sock_closed;
+    sock->next        = loop->closed;
+    loop->closed      = sock;
+}
+
+/*  sock_linger
+    Deja abierto ms el socket propio de una sesion cancelada: la respuesta a
+    su peticion puede venir aun de camino y asi recibe un ERROR 0 en lugar
+    de un ICMP (sock_cancelled). No retiene el bucle, si termina antes se
+    cierra con el.
+*/
+
+static void sock_linger ( tftp_loop_t *loop, tftp_sock_t *sock, uint64_t ms ) {
+    sock->owner         = NULL;
+    sock->watch.ready   = sock_cancelled;
+    sock->loop          = loop;
+    sock->linger.next   = NULL;
+    sock->linger.prev   = NULL;
+    sock->linger.expire = sock_expire;
+    sock->next          = loop->lingering;
+    loop->lingering     = sock;
+
+    timer_arm ( &loop->wheel, &sock->linger, loop_now_us () / 1000 + ms );
+}
+
+/*  session_done
+    Termina la sesion: cierra el socket y lo que quede abierto del archivo,
+    la saca del bucle y de la tabla, y avisa a finish si la sesion lo tiene.
+    La sesion no se libera, es de quien la creo.
+*/
+
+void session_done ( tftp_t *instance, bool ok ) {
+    tftp_loop_t *loop = instance->loop;
+
+    if ( instance->done )
+        return;
+
+    timer_cancel ( &loop->wheel, &instance->timer );
+    timer_cancel ( &loop->wheel, &instance->pace );
+    sched_leave ( &loop->sched, instance );
+
+    /* El eventfd es del hilo que se esperaba, se cierra con el */
+
+    if ( instance->sleep_fd != -1 ) {
+        loop_unwatch ( loop, instance->sleep_fd );
+        instance->sleep_fd = -1;
+    }
+
+    /*  Un socket compartido sigue abierto para las demas sesiones. El
+        propio de una cancelada aun contesta un rto a su servidor */
+
+    if ( instance->sock->owner != instance )
+        instance->sock->users--;
+
+    else if ( instance->cancelled )
+        sock_linger ( loop, instance->sock, instance->rto );
+
+    else
+        sock_close ( loop, instance->sock );
+
+    instance->sock             = NULL;
+    instance->local_descriptor = -1;
+    instance->connected        = false;
+
+    if ( instance->out.fd != -1 )
+        out_abort ( &instance->out );
+
+    /* El lector de la tuberia tiene que parar antes de cerrarla */
+
+    if ( instance->ahead != NULL ) {
+        ahead_stop ( instance->ahead );
+        instance->ahead = NULL;
+    }
+
+    reorder_free ( instance->reorder );
+    instance->reorder = NULL;
+
+    if ( instance->fd != -1 ) {
+        close ( instance->fd );
+        instance->fd = -1;
+    }
+
+    table_remove ( instance );
+
+    instance->done      = true;
+    instance->failed    = !ok;
+    instance->stats.end = loop_now_us ();
+    loop->active--;
+
+    if ( !ok && !instance->cancelled )
+        loop->failed++;
+
+    if ( instance->finish != NULL )
+        instance->finish ( instance );
+}
+
+/*  session_cancel
+    Termina la sesion sin que cuente como fallo, p.ej. un intento que perdio
+    la carrera (race.h). Queda failed, no tiene resultado que dar.
+*/
+
+void session_cancel ( tftp_t *instance ) {
+    if ( instance->done )
+        return;
+
+    instance->cancelled = true;
+
+    /*  Si su servidor ya respondio se le avisa con un ERROR 0, asi suelta
+        la transferencia sin esperar a sus reenvios ni a un ICMP. Lo que
+        llegue despues lo contesta el socket propio (sock_linger). */
+
+    if ( HOT ( instance )->rport != 0 ) {
+        instance->err    = ERR_NOT_DEFINED;
+        instance->msgerr = ( char * ) cancelled_reason;
+        build_error ( instance );
+        session_output ( instance );
+    }
+
+    session_done ( instance, false );
+}
+
+/*  session_sleep
+    La sesion espera a otro hilo (inflate.h, ahead.h), que escribira en el
+    eventfd fd cuando tenga lo que hace falta; entonces se la despierta con
+    resume. El bucle sigue con las demas, no se bloquea nunca en el hilo.
+
+    Devuelve 0, o -1 con errno
+*/
+
+int session_sleep ( tftp_t *instance, int fd ) {
+    if ( instance->sleep_fd != -1 )
+        return 0;
+
+    if ( loop_watch ( instance->loop, fd, &instance->wake, EPOLLIN ) == -1 )
+        return -1;
+
+    instance->sleep_fd = fd;
+    return 0;
+}
+
+static void session_wake ( tftp_loop_t *loop, tftp_watch_t *watch,
+                           uint32_t events ) {
+    tftp_t * instance = SESSION_OF ( watch, wake );
+    uint64_t count;
+
+    ( void ) events;
+
+    /* Un aviso que quedo en el lote de una sesion que ya termino */
+
+    if ( instance->sleep_fd == -1 )
+        return;
+
+    if ( read ( instance->sleep_fd, &count, sizeof ( count ) ) == -1
+         && errno != EAGAIN )
+        syslog ( LOG_WARNING, "Error from read() on eventfd: %s",
+                 strerror ( errno ) );
+
+    loop_unwatch ( loop, instance->sleep_fd );
+    instance->sleep_fd = -1;
+    instance->resume ( instance );
+}
+
+/*  session_error
+    Termina la sesion con error: el motivo va al log y queda en la sesion
+    para el resultado (tftp_result)
+*/
+
+void session_error ( tftp_t *instance, const char *format, ... ) {
+    char    reason[RESULT_MSGSIZE];
+    va_list args;
+
+    va_start ( args, format );
+    vsnprintf ( reason, sizeof ( reason ), format, args );
+    va_end ( args );
+
+    syslog ( LOG_ERR, "%s", reason );
+    tftp_set_reason ( instance, reason );
+    session_done ( instance, false );
+}
+
+/*  sock_refuse
+    Responde desde sock a un msg de from con un ERROR code. A un ERROR no se
+    responde, para no entrar en un ping-pong de errores.
+*/
+
+static void sock_refuse ( tftp_sock_t *sock, const u_char *msg, uint16_t code,
+                          const char *reason, const struct sockaddr *from,
+                          socklen_t size ) {
+    u_char pkt[64];
+    size_t len = strlen ( reason ) + 1;
+
+    if ( ( ( msg[0] << 8 ) + msg[1] ) == OPCODE_ERROR )
+        return;
+
+    pkt[0] = ( OPCODE_ERROR >> 8 ) & 0xff;
+    pkt[1] = OPCODE_ERROR & 0xff;
+    pkt[2] = ( code >> 8 ) & 0xff;
+    pkt[3] = code & 0xff;
+    memcpy ( pkt + 4, reason, len );
+
+    sendto ( sock->fd, pkt, 4 + len, 0, from, size );
+}
+
+/*  loop_stranger
+    Responde con ERR_UNKNOWN_TID a un msg que no es de ninguna sesion, como
+    pide el RFC 1350, sin que afecte a las transferencias en curso
+*/
+
+static void loop_stranger ( tftp_sock_t *sock, const u_char *msg,
+                            const struct sockaddr *from, socklen_t size ) {
+    sock_refuse ( sock, msg, ERR_UNKNOWN_TID, "Unknown transfer ID", from,
+                  size );
+}
+
+/*  loop_connected
+    Lee lo pendiente en un socket propio ya conectado al tid del servidor: el
+    kernel descarta lo que venga de otro sitio, asi que no hay direccion que
+    comprobar ni sesion que buscar.
+*/
+
+static void loop_connected ( tftp_t *instance ) {
+    ssize_t received;
+
+    while ( !instance->done ) {
+        received = recv ( instance->local_descriptor, instance->buf,
+                          4 + instance->blksize, 0 );
+
+        if ( received == -1 ) {
+            /*  Un ICMP de puerto inalcanzable llega como ECONNREFUSED; del
+                servidor caido ya se encarga el timeout */
+
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                return;
+
+            continue;
+        }
+
+        if ( received >= 4 )
+            instance->recv ( instance, received );
+    }
+}
+
+/*  loop_read
+    Lee todo lo pendiente en un socket y se lo pasa a la sesion a la que va.
+    Un socket propio recibe directamente en el buffer de su sesion; uno
+    compartido recibe en el suyo y copia en el de la sesion que corresponda.
+    La primera respuesta del servidor fija el tid de la sesion, y un socket
+    propio se conecta a el; lo que venga de un tid desconocido se rechaza.
+*/
+
+static void loop_read ( tftp_loop_t *loop, tftp_sock_t *sock ) {
+    struct sockaddr_storage from;
+    socklen_t               size;
+    ssize_t                 received;
+    tftp_hot_t *            hot;
+    tftp_t *                instance;
+    tftp_t *                owner = sock->owner;
+    size_t                  room;
+
+    if ( owner != NULL && owner->connected ) {
+        loop_connected ( owner );
+        return;
+    }
+
+    for ( ;; ) {
+        size     = sizeof ( from );
+        received = owner != NULL
+                       ? recvfrom ( sock->fd, owner->buf, 4 + owner->blksize,
+                                    0, ( struct sockaddr * ) &from, &size )
+                       : recvfrom ( sock->fd, sock->buf, 4 + MAX_BLKSIZE, 0,
+                                    ( struct sockaddr * ) &from, &size );
+
+        if ( received == -1 )
+            return;
+
+        if ( received < 4 )
+            continue;
+
+        hot = table_demux ( &loop->table, ( struct sockaddr * ) &from,
+                            ( struct sockaddr * ) &sock->addr );
+
+        if ( hot == NULL ) {
+            loop_stranger ( sock, owner != NULL ? owner->buf : sock->buf,
+                            ( struct sockaddr * ) &from, size );
+            continue;
+        }
+
+        instance = hot->session;
+
+        if ( owner == NULL ) {
+            room = 4 + ( instance->blksize < BUFSIZE ? BUFSIZE
+                                                     : instance->blksize );
+
+            if ( ( size_t ) received > room )
+                continue;
+
+            memcpy ( instance->buf, sock->buf, received );
+        }
+
+        if ( hot->rport == 0 ) {
+            table_rekey ( instance, addr_port ( ( struct sockaddr * ) &from ) );
+            instance->remote_addr = from;
+            instance->size_remote = size;
+
+            if ( owner != NULL
+                 && connect ( sock->fd, ( struct sockaddr * ) &from, size )
+                        == 0 )
+                owner->connected = true;
+        }
+
+        instance->recv ( instance, received );
+
+        /* Al terminar la sesion se cerro su socket propio */
+
+        if ( owner != NULL && owner->done )
+            return;
+
+        if ( owner != NULL && owner->connected ) {
+            loop_connected ( owner );
+            return;
+        }
+    }
+}
+
+static void sock_ready ( tftp_loop_t *loop, tftp_watch_t *watch,
+                         uint32_t events ) {
+    ( void ) events;
+    loop_read ( loop, ( tftp_sock_t * ) watch );
+}
+
+/*  sock_cancelled
+    Lo que llega al socket propio de una sesion cancelada (sock_linger) se
+    contesta con un ERROR 0. Basta la cabecera, el resto se descarta.
+*/
+
+static void sock_cancelled ( tftp_loop_t *loop, tftp_watch_t *watch,
+                             uint32_t events ) {
+    tftp_sock_t *           sock = ( tftp_sock_t * ) watch;
+    struct sockaddr_storage from;
+    socklen_t               size;
+    u_char                  msg[4];
+    ssize_t                 received;
+
+    ( void ) loop;
+    ( void ) events;
+
+    for ( ;; ) {
+        size     = sizeof ( from );
+        received = recvfrom ( sock->fd, msg, sizeof ( msg ), 0,
+                              ( struct sockaddr * ) &from, &size );
+
+        if ( received == -1 ) {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK )
+                return;
+            continue;
+        }
+
+        if ( received == sizeof ( msg ) )
+            sock_refuse ( sock, msg, ERR_NOT_DEFINED, cancelled_reason,
+                          ( struct sockaddr * ) &from, size );
+    }
+}
+
+/*  sock_expire
+    Termina la espera de un socket de sesion cancelada: se cierra
+*/
+
+static void sock_expire ( tftp_timer_t *timer ) {
+    tftp_sock_t * sock = ( tftp_sock_t * ) ( ( char * ) timer
+                                             - offsetof ( tftp_sock_t, linger ) );
+    tftp_loop_t * loop = sock->loop;
+    tftp_sock_t **p;
+
+    for ( p = &loop->lingering; *p != sock; p = &( *p )->next )
+        ;
+
+    *p = sock->next;
+    sock_close ( loop, sock );
+}
+
+/* Evento que quedo en el lote de un socket ya cerrado (loop_reap) */
+
+static void sock_closed ( tftp_loop_t *loop, tftp_watch_t *watch,
+                          uint32_t events ) {
+    ( void ) loop;
+    ( void ) watch;
+    ( void ) events;
+}
+
+/*  loop_watch
+    Vigila un descriptor que no es de ninguna sesion. Mientras haya alguno
+    loop_run no vuelve aunque no queden sesiones.
+
+    Devuelve 0, o -1 con errno
+*/
+
+int loop_watch ( tftp_loop_t *loop, int fd, tftp_watch_t *watch,
+                 uint32_t events ) {
+    struct epoll_event ev;
+
+    ev.events   = events;
+    ev.data.ptr = watch;
+
+    if ( epoll_ctl ( loop->epfd, EPOLL_CTL_ADD, fd, &ev ) == -1 )
+        return -1;
+
+    loop->watched++;
+
+    return 0;
+}
+
+/*  loop_rewatch
+    Cambia los eventos que se esperan de un descriptor vigilado
+
+    Devuelve 0, o -1 con errno
+*/
+
+int loop_rewatch ( tftp_loop_t *loop, int fd, tftp_watch_t *watch,
+                   uint32_t events ) {
+    struct epoll_event ev;
+
+    ev.events   = events;
+    ev.data.ptr = watch;
+
+    return epoll_ctl ( loop->epfd, EPOLL_CTL_MOD, fd, &ev );
+}
+
+/*  loop_unwatch
+    Deja de vigilar fd (antes de cerrarlo)
+*/
+
+void loop_unwatch ( tftp_loop_t *loop, int fd ) {
+    if ( epoll_ctl ( loop->epfd, EPOLL_CTL_DEL, fd, NULL ) == 0 )
+        loop->watched--;
+}
+
+/*  loop_spin
+    Espera eventos sin dormir durante busy_poll us (o hasta el proximo
+    vencimiento, si es antes), y si no llega nada se bloquea como siempre.
+    Con respuestas rapidas el paquete se recoge sin pasar por despertar el
+    hilo, a cambio de gastar cpu.
+*/
+
+static int loop_spin ( tftp_loop_t *loop, struct epoll_event *ev ) {
+    int      timeout = wheel_next ( &loop->wheel );
+    uint64_t spin    = loop->busy_poll;
+    uint64_t until;
+    int      n;
+
+    if ( timeout >= 0 && ( uint64_t ) timeout * 1000 < spin )
+        spin = ( uint64_t ) timeout * 1000;
+
+    until = loop_now_us () + spin;
+
+    do {
+        n = epoll_wait ( loop->epfd, ev, LOOP_EVENTS, 0 );
+    } while ( n == 0 && loop_now_us () < until );
+
+    if ( n != 0 )
+        return n;
+
+    return epoll_wait ( loop->epfd, ev, LOOP_EVENTS, wheel_next ( &loop->wheel ) );
+}
+
+/*  loop_run
+    Atiende sesiones hasta que no quede ninguna en curso ni ningun
+    descriptor vigilado
+*/
+
+void loop_run ( tftp_loop_t *loop ) {
+    struct epoll_event ev[LOOP_EVENTS];
+    tftp_watch_t *     watch;
+    int                n, i;
+
+    while ( loop->active > 0 || loop->watched > 0 ) {
+        loop_reap ( loop );
+
+        n = loop->busy_poll != 0 ? loop_spin ( loop, ev )
+                                 : epoll_wait ( loop->epfd, ev, LOOP_EVENTS,
+                                                wheel_next ( &loop->wheel ) );
+
+        if ( n == -1 && errno != EINTR ) {
+            syslog ( LOG_ERR, "Error from epoll_wait(): %s", strerror ( errno ) );
+            return;
+        }
+
+        for ( i = 0; i < n; i++ ) {
+            watch = ev[i].data.ptr;
+            watch->ready ( loop, watch, ev[i].events );
+        }
+
+        wheel_advance ( &loop->wheel, loop_now_us () / 1000 );
+    }
+}
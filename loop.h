@@ -0,0 +1,98 @@
+#ifndef LOOP_H
+#define LOOP_H
+
+#include "fair.h"
+#include "table.h"
+#include "timer.h"
+
+#define LOOP_EVENTS 64   /* eventos por llamada a epoll_wait */
+#define MAX_SHARED 1024  /* sockets compartidos como mucho */
+#define MAX_BUSY_POLL 1000000 /* espera activa maxima (us) */
+
+#define RTO_MIN_MS 50    /* cota inferior del timeout adaptativo */
+#define RTO_MAX_MS 10000 /* cota superior, tambien para el backoff */
+
+/*  Socket UDP del bucle. Puede ser de una sola sesion (owner) o compartido
+    por varias, que se distinguen por la 4-tupla en la tabla de sesiones */
+
+typedef struct tftp_sock {
+    tftp_watch_t            watch;   /* registro en epoll */
+    int                     fd;      /* socket UDP no bloqueante */
+    struct sockaddr_storage addr;    /* direccion local ligada */
+    socklen_t               addrlen; /* tamaño de addr */
+    tftp_t *                owner;   /* sesion duena, NULL = compartido */
+    unsigned                users;   /* sesiones que lo usan */
+    u_char *                buf;     /* recepcion de un compartido (pool) */
+    struct tftp_sock *      next;    /* en la lista de cerrados del bucle */
+    tftp_timer_t            linger;  /* cierre del de una sesion cancelada */
+    struct tftp_loop *      loop;    /* bucle, para ese cierre */
+
+} tftp_sock_t;
+
+/*  Bucle de eventos: un epoll con los sockets de todas las sesiones, la tabla
+    de sesiones para demultiplexar y una rueda de temporizadores para los
+    reenvios. Con epoll_wait esperando hasta el proximo vencimiento, un solo
+    hilo lleva cualquier cantidad de transferencias. */
+
+typedef struct tftp_loop {
+    int          epfd;   /* descriptor de epoll */
+    tftp_table_t table;  /* sesiones por 4-tupla */
+    tftp_wheel_t wheel;  /* temporizadores de reenvio */
+    unsigned     active; /* sesiones en curso */
+    unsigned     failed; /* sesiones terminadas con error */
+    tftp_bucket_t rate;  /* limite global de todas las sesiones */
+    tftp_sched_t  sched; /* turnos para ese limite */
+    tftp_sock_t * shared;  /* sockets compartidos, NULL = uno por sesion */
+    unsigned      nshared; /* cuantos */
+    uint32_t      busy_poll; /* espera activa antes de bloquear (us) */
+    unsigned      watched;   /* descriptores ajenos vigilados (loop_watch) */
+    tftp_sock_t * closed;    /* sockets cerrados, al pool tras el lote */
+    tftp_sock_t * lingering; /* de sesiones canceladas, aun contestando */
+
+} tftp_loop_t;
+
+uint64_t loop_now_us ( void );
+
+int loop_init ( tftp_loop_t *loop );
+
+void loop_destroy ( tftp_loop_t *loop );
+
+int loop_share ( tftp_loop_t *loop, unsigned count );
+
+int loop_add ( tftp_loop_t *loop, tftp_t *instance );
+
+int loop_watch ( tftp_loop_t *loop, int fd, tftp_watch_t *watch,
+                 uint32_t events );
+
+int loop_rewatch ( tftp_loop_t *loop, int fd, tftp_watch_t *watch,
+                   uint32_t events );
+
+void loop_unwatch ( tftp_loop_t *loop, int fd );
+
+void loop_run ( tftp_loop_t *loop );
+
+int session_output ( tftp_t *instance );
+
+int session_send ( tftp_t *instance );
+
+int session_burst ( tftp_t *instance );
+
+void session_arm ( tftp_t *instance );
+
+uint64_t session_wait ( tftp_t *instance );
+
+void session_spend ( tftp_t *instance, size_t bytes );
+
+void session_pace ( tftp_t *instance, uint64_t wait );
+
+void session_rtt ( tftp_t *instance );
+
+void session_done ( tftp_t *instance, bool ok );
+
+void session_cancel ( tftp_t *instance );
+
+int session_sleep ( tftp_t *instance, int fd );
+
+void session_error ( tftp_t *instance, const char *format, ... );
+
+#endif
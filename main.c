@@ -1,383 +1,1076 @@
 #include <ctype.h>
 #include "tftp.h"
+#include "loop.h"
+#include "race.h"
+#include "batch.h"
+#include "sync.h"
+#include "daemon.h"
+#include "inflate.h"
+#include "ahead.h"
+#include "reorder.h"
+#include "parse.h"
 #include "cmdline.h"
 
 #define CLIENT_NAME "client"
 
-/*  _exit_free
-    Libera los punteros enviados y se sale del programa
+/* Limite global de ritmo (bytes/s), 0 = sin limite */
 
-    type: tipo de salida, EXIT_SUCCESS o EXIT_FAILURE
-    params: cantidad de parámetros
-    ... : los parámetros en si
+static uint64_t global_rate;
+
+/* Sockets compartidos entre las sesiones, 0 = uno por sesion */
+
+static unsigned shared_sockets;
+
+/* Espera activa antes de bloquear (us), 0 = no */
+
+static uint32_t busy_poll;
+
+/* Mostrar las estadisticas de la transferencia al terminar */
+
+static bool show_stats;
+
+/* Nombre local de la descarga (NULL = el remoto) y descriptor si es stdout */
+
+static const char *output_path;
+static int         output_fd = -1;
+
+/* Archivo local de la subida (NULL = el remoto, "-" = stdin) */
+
+static const char *input_path;
+
+/* Modo lote: transferencias a la vez y peticiones pre-abiertas */
+
+static unsigned batch_jobs = 1;
+static unsigned batch_prefetch = 1;
+
+/* Modo residente: transferencias a la vez por espejo, 0 = sin limite */
+
+static unsigned per_server;
+
+/* Archivo del marcador de espejos entre lotes, o NULL */
+
+static const char *scoreboard_path;
+
+/*  server_error
+    El servidor respondio con un ERROR: lo registramos y terminamos
 */
 
-void _exit_free ( int type, int params, ... ) {
-    va_list p_list;
-    int     i = 0;
+void server_error ( tftp_t *instance, const tftp_msg_t *msg ) {
+    instance->refused = true;
+    instance->code    = msg->block;
 
-    va_start ( p_list, params );
+    session_error ( instance, "Server error %d for %s: %.*s", msg->block,
+                    instance->file, ( int ) msg->len, ( char * ) msg->data );
+}
 
-    for ( ; i < params; i++ )
-        free ( va_arg ( p_list, void * ) );
+/*  reject_oack
+    El OACK no cumple lo que pedimos: se avisa al servidor con el error 8
+*/
+
+void reject_oack ( tftp_t *instance ) {
+    instance->err    = ERR_OPTION;
+    instance->msgerr = "Invalid option negotiation";
+    build_error ( instance );
 
-    va_end ( p_list );
+    session_output ( instance );
 
-    _exit ( type );
+    session_error ( instance, "Invalid OACK for %s", instance->file );
 }
 
-void build_request ( tftp_t *instance, int type ) {
-    u_char *p;
-    memset ( instance->buf, 0, MAX_BUFSIZE );
+/*  wrq_open
+    Abre el archivo a enviar, o toma stdin
 
-    p = instance->buf;
+    Devuelve 0, o -1 tras terminar la sesion con el error
+*/
 
-    if ( type == OPCODE_RRQ ) {
-        *p = ( OPCODE_RRQ >> 8 ) & 0xff;
-        p++;
-        *p = OPCODE_RRQ & 0xff;
-        p++;
+static int wrq_open ( tftp_t *instance ) {
+    const char *path = instance->local != NULL ? instance->local
+                       : input_path != NULL    ? input_path
+                                               : instance->file;
+    struct stat st;
 
-    } else if ( type == OPCODE_WRQ ) {
-        *p = ( OPCODE_WRQ >> 8 ) & 0xff;
-        p++;
-        *p = OPCODE_WRQ & 0xff;
-        p++;
+    instance->fd = !strcmp ( path, "-" ) ? dup ( STDIN_FILENO )
+                                         : open ( path, O_RDONLY );
 
-    } else {
-        puts ( "Unknown type request" );
-        _exit ( EXIT_FAILURE );
+    if ( instance->fd == -1 || fstat ( instance->fd, &st ) == -1 ) {
+        session_error ( instance, "Error opening %s: %s", path,
+                        strerror ( errno ) );
+        return -1;
     }
 
-    memcpy ( p, instance->file, strlen ( instance->file ) );
-    p += strlen ( instance->file ) + 1;
-    memcpy ( p, instance->mode, strlen ( instance->mode ) );
+    /*  Una tuberia no tiene tamaño ni se puede releer: se sabe cual es el
+        ultimo bloque cuando se lee corto */
+
+    instance->sequential = !S_ISREG ( st.st_mode ) && !S_ISBLK ( st.st_mode );
+
+    return 0;
 }
 
-void data_send_cli ( tftp_t *instance ) {
-    ssize_t     sent, received;
-    off_t       offset;
-    static bool timeout = false;
+/*  wrq_pending
+    Quedan bloques de la ventana por enviar: del siguiente sin enviar hasta
+    el confirmado + windowsize, sin pasar del ultimo
+*/
+
+static bool wrq_pending ( const tftp_t *instance ) {
+    return instance->next <= HOT ( instance )->blknum + instance->window
+           && ( instance->last == 0 || instance->next <= instance->last );
+}
+
+/*  wrq_ready
+    El siguiente bloque se puede leer ya. De una tuberia puede no haberlo
+    leido aun el lector anticipado, y entonces avisara (ahead_ready).
+*/
+
+static bool wrq_ready ( tftp_t *instance ) {
+    return instance->ahead == NULL
+        || ahead_ready ( instance->ahead, instance->next );
+}
+
+/*  wrq_block
+    Envia el siguiente bloque. Los bloques se leen por su posicion, asi una
+    ventana perdida se puede repetir; de una tuberia los guarda el lector
+    anticipado (ahead.h) hasta que se confirman. Cada bloque se lee
+    directamente detras de la cabecera en pkt.
+
+    Devuelve 0, o -1 tras terminar la sesion con el error
+*/
+
+static int wrq_block ( tftp_t *instance ) {
+    ssize_t len;
+
+    len = instance->ahead != NULL
+              ? ahead_read ( instance->ahead, instance->next, instance->pkt + 4 )
+              : pread ( instance->fd, instance->pkt + 4, instance->blksize,
+                        ( off_t ) ( instance->next - 1 ) * instance->blksize );
 
-    // Primero se espera el ACK del servidor y luego se responde un DATA
+    if ( len == -1 ) {
+        session_error ( instance, "Error reading %s: %s", instance->file,
+                        strerror ( errno ) );
+        return -1;
+    }
+
+    /* El bloque corto (o vacio) es el ultimo */
+
+    if ( len < instance->blksize )
+        instance->last = instance->next;
+
+    build_data_msg ( instance, BLOCK_WIRE ( instance->next ), len );
+
+    if ( session_burst ( instance ) == -1 ) {
+        session_error ( instance, "Error from sendto() in data_send(): %s",
+                        strerror ( errno ) );
+        return -1;
+    }
+
+    session_spend ( instance, instance->pkt_len );
+
+    /* Las estadisticas cuentan cada bloque una vez, no sus reenvios */
+
+    if ( instance->next > instance->sent )
+        instance->sent = instance->next;
+
+    if ( instance->next > instance->stats.blocks ) {
+        instance->stats.blocks = instance->next;
+        instance->stats.bytes += len;
+    }
 
-    /* Esperamos el siguiente ack */
+    instance->next++;
 
-    received = recvfrom (
-        instance->local_descriptor, instance->buf, MAX_BUFSIZE, 0,
-        ( struct sockaddr * ) &instance->remote_addr, &instance->size_remote );
+    return 0;
+}
 
-    /*  Verificamos que haya llegado un msg válido, se debe cumplir:
-        1. Que received sea distinto a -1
-        2. Que received sea distinto a EWOULDBLOCK
-        3. Que el OPCODE sea OPCODE_ACK
-        4. Que el ack corresponda al blknum que esperamos
-        5. Que el msg sea de donde lo esperamos (mismo tid del inicio de la
-        transferencia) */
+/*  wrq_ack
+    Procesa un msg recibido durante un WRQ. El ACK (o el OACK, que hace de
+    ACK 0) confirma hasta un bloque de los enviados y deja avanzar la ventana;
+    si confirma menos de lo enviado es que el servidor perdio algo y se sigue
+    desde ahi.
 
-    if ( received != -1 && received != EWOULDBLOCK
-         && ( ( instance->buf[0] << 8 ) + instance->buf[1] == OPCODE_ACK )
-         && ( ( instance->buf[2] << 8 ) + instance->buf[3] == instance->blknum )
-         && ( instance->tid == ntohs ( instance->remote_addr.sin_port ) ) ) {
-        instance->retries = 0;
+    Devuelve true si el servidor confirmo algo
+*/
 
-        /*  Si hemos enviado el último msg y recibido el último ack, terminamos  */
+static bool wrq_ack ( tftp_t *instance ) {
+    tftp_hot_t *hot  = HOT ( instance );
+    uint64_t    base = hot->blknum;
+    uint64_t    acked;
+    tftp_msg_t  msg;
 
-        if ( offset < BUFSIZE ) {
-            syslog ( LOG_NOTICE, "File %s sent successfully", instance->file );
+    /* Lo mal formado se ignora, como si se hubiera perdido */
 
-            /* Cerramos el descriptor de archivo y de socket */
+    if ( parse_msg ( instance->buf, instance->co.received, 0, &msg ) == -1 )
+        return false;
 
-            close ( instance->fd );
-            close ( instance->local_descriptor );
+    if ( msg.opcode == OPCODE_ERROR ) {
+        server_error ( instance, &msg );
+        return false;
+    }
 
-            /* Hijo finaliza */
+    /*  Si pedimos opciones, el OACK hace las veces del ACK 0 */
 
-            _exit ( EXIT_SUCCESS );
+    if ( hot->state == STATE_STANDBY && msg.opcode == OPCODE_OACK ) {
+        if ( dec_oack ( instance, &msg ) == -1 ) {
+            reject_oack ( instance );
+            return false;
         }
 
-        /* Limpiamos los buffers */
+        cc_init ( &instance->cc, instance->window );
+        acked = 0;
 
-        memset ( instance->msg, 0, BUFSIZE );
-        memset ( instance->buf, 0, MAX_BUFSIZE );
+    } else if ( msg.opcode == OPCODE_ACK ) {
+        /*  La ventana no pasa de 65535 bloques, asi que solo uno de los
+            bloques en vuelo tiene esos 16 bits. Vale hasta el mayor enviado,
+            aunque next haya vuelto atras por un ACK anterior: un ACK de la
+            ventana previa puede llegar detras */
 
-        /* Aumentamos blknum */
+        acked = BLOCK_UNWRAP ( base, msg.block );
 
-        instance->blknum++;
+        if ( acked > instance->sent )
+            return false;
 
-        /*  Si el blknum es 65536, le asignamos el valor 0 para no salirnos del
-            rango
-            de 2 bytes de la trama para el campo blknum */
+        /*  Un ACK repetido no hace reenviar nada (Sorcerer's Apprentice), de
+            eso se encarga el timeout */
 
-        if ( instance->blknum == 65536 )
-            instance->blknum = 0;
+        if ( acked == base && hot->state != STATE_STANDBY )
+            return false;
 
-        return;
+    } else
+        return false;
+
+    session_rtt ( instance );
+
+    if ( acked > base )
+        cc_ack ( &instance->cc, acked - base, instance->srtt,
+                 4 + instance->blksize );
 
-    }  // end 4-condition if
+    if ( acked + 1 < instance->next ) {
+        cc_loss ( &instance->cc, false, instance->srtt, 4 + instance->blksize );
+        instance->next = acked + 1;
+    } else if ( acked >= instance->next )
+        instance->next = acked + 1;
 
-    /*  Como no hemos recibido el ack correspondiente a la última trama que
-       hemos
-        enviado, ha expirado el tiempo de espera */
+    hot->blknum = acked;
 
-    timeout = true;
-    instance->retries++;
+    if ( instance->ahead != NULL )
+        ahead_release ( instance->ahead, acked + 1 );
+
+    /*  Si hemos enviado el último msg y recibido el último ack, terminamos  */
+
+    if ( instance->last != 0 && acked == instance->last ) {
+        syslog ( LOG_NOTICE, "File %s sent successfully", instance->file );
+        session_done ( instance, true );
+    }
+
+    return true;
+}
+
+/*  wrq_wake
+    Atiende lo que desperto a un WRQ: un msg, o el reenvio, que repite el
+    WRQ si aun no hubo respuesta y si no la ventana desde el primer bloque
+    sin confirmar
+
+    Devuelve true si el servidor confirmo algo
+*/
+
+static bool wrq_wake ( tftp_t *instance ) {
+    if ( instance->co.wake == WAKE_RECV )
+        return wrq_ack ( instance );
+
+    if ( instance->co.wake != WAKE_RETRY )
+        return false;
+
+    if ( HOT ( instance )->state == STATE_STANDBY ) {
+        if ( session_burst ( instance ) == -1 )
+            session_error ( instance, "Error sending write request %s",
+                            strerror ( errno ) );
+        else
+            session_arm ( instance );
+        return false;
+    }
+
+    cc_loss ( &instance->cc, true, instance->srtt, 4 + instance->blksize );
+
+    instance->next = HOT ( instance )->blknum + 1;
+    return false;
+}
+
+/*  wrq_run
+    Corrutina de un WRQ (coro.h): pide escribir el archivo y, cuando el
+    servidor acepta, le envia ventana tras ventana al ritmo que toque hasta
+    que confirma el ultimo bloque
+*/
+
+static void wrq_run ( tftp_t *instance ) {
+    tftp_coro_t *co   = &instance->co;
+    uint64_t     wait = 0;
+
+    CORO_BEGIN ( co );
+
+    if ( wrq_open ( instance ) == -1 )
+        CORO_EXIT ( co );
+
+    instance->next    = 1;
+    instance->sent    = 0;
+    instance->pkt_len = build_request ( instance, OPCODE_WRQ );
+
+    if ( session_send ( instance ) == -1 ) {
+        session_error ( instance, "Error sending write request %s",
+                        strerror ( errno ) );
+        CORO_EXIT ( co );
+    }
+
+    /* Hasta que acepte (con el OACK o el ACK 0) solo se repite el WRQ */
+
+    do
+        CORO_YIELD ( co );
+    while ( !wrq_wake ( instance ) && !instance->done );
+
+    if ( instance->done )
+        CORO_EXIT ( co );
+
+    /*  El lector empieza con el blksize y la ventana ya negociados. Si la
+        tuberia no da datos a tiempo la sesion duerme hasta que los haya. */
+
+    if ( instance->sequential
+         && ( instance->ahead = ahead_start ( instance->fd, instance->blksize,
+                                              instance->window + AHEAD_SLOTS ) )
+                == NULL ) {
+        session_error ( instance, "Error reading %s: %s", instance->file,
+                        strerror ( errno ) );
+        CORO_EXIT ( co );
+    }
+
+    for ( ;; ) {
+        /*  Sale lo que falte de la ventana mientras el ritmo lo permita y
+            haya datos; si hay que esperar, se sigue cuando lo diga
+            session_pace o el lector anticipado (session_sleep) */
+
+        while ( wrq_pending ( instance ) ) {
+            if ( !wrq_ready ( instance ) ) {
+                if ( session_sleep ( instance, instance->ahead->efd ) == -1 ) {
+                    session_error ( instance, "Waiting for %s: %s",
+                                    instance->file, strerror ( errno ) );
+                    CORO_EXIT ( co );
+                }
+
+                break;
+            }
+
+            if ( ( wait = session_wait ( instance ) ) != 0 ) {
+                session_pace ( instance, wait );
+                break;
+            }
+
+            if ( wrq_block ( instance ) == -1 )
+                CORO_EXIT ( co );
+        }
+
+        HOT ( instance )->state = STATE_DATA_SENT;
+
+        if ( instance->next > HOT ( instance )->blknum + 1 )
+            session_arm ( instance );
+
+        /* Hasta un ACK, el reenvio o el fin de la espera */
+
+        CORO_YIELD ( co );
+        wrq_wake ( instance );
+
+        if ( instance->done )
+            CORO_EXIT ( co );
+    }
+
+    CORO_END ( co );
 }
 
 void start_wrq ( tftp_t *instance ) {
-    ssize_t sent, received;
+    coro_start ( instance, wrq_run );
+}
+
+/*  rrq_open
+    Prepara donde se guarda la descarga
 
-    build_request ( instance, OPCODE_WRQ );
+    Devuelve 0, o -1 tras terminar la sesion con el error
+*/
+
+static int rrq_open ( tftp_t *instance ) {
+    /* A stdout (o la tuberia que haya detras) sale tal cual */
+
+    if ( output_fd != -1 )
+        out_stream ( &instance->out, output_fd );
 
-    sent = sendto ( instance->local_descriptor, instance->buf, 4 + strlen(instance->file) + strlen(instance->mode), 0,
-                    ( struct sockaddr * ) &instance->remote_addr,
-                    instance->size_remote );
+    /* Comprobamos si hay errores */
 
-    if ( sent != 4 + strlen(instance->file) + strlen(instance->mode) ) {
-        printf ( "ERROR Sending write request %s\n", strerror ( errno ) );
-        close ( instance->local_descriptor );
-        _exit_free ( EXIT_FAILURE, 1, instance );
+    else if ( output_path == NULL && instance->local == NULL
+              && access ( ".", W_OK ) != 0 ) {
+        session_error ( instance, "There are no permissions to write." );
+        return -1;
     }
 
-    /* Iniciamos el temporizador */
+    /*  Escribimos en un temporal del mismo directorio, el archivo solo aparece
+        con su nombre cuando la transferencia termina bien */
 
-    instance->timeout.tv_sec  = DEF_TIMEOUT_SEC;
-    instance->timeout.tv_usec = DEF_TIMEOUT_USEC;
+    else if ( out_open ( &instance->out, instance->local != NULL ? instance->local
+                                         : output_path != NULL   ? output_path
+                                                                 : instance->file )
+              == -1 ) {
+        session_error ( instance, "Creating temporary file for %s %s",
+                        instance->file, strerror ( errno ) );
+        return -1;
+    }
 
-    /* Inicializamos las variables a usar */
+    /*  El hilo descompresor escribe en el temporal lo que vaya llegando. Su
+        anillo tiene que poder con la ventana mas grande que se pide */
+
+    if ( instance->compressed
+         && ( instance->out.inflate = inflate_start (
+                  &instance->out,
+                  ( size_t ) ( instance->window_opt != 0 ? instance->window_opt : 1 )
+                      * ( instance->blksize_opt != 0 ? instance->blksize_opt
+                                                     : BUFSIZE ) ) )
+                == NULL ) {
+        session_error ( instance, "Starting decompression for %s %s",
+                        instance->file, strerror ( errno ) );
+        return -1;
+    }
 
-    instance->blknum = 0;
-    instance->fd     = open ( instance->file, O_WRONLY | O_CREAT | O_TRUNC,
-                              S_IRWXU | S_IRWXG | S_IRWXO );
+    return 0;
+}
+
+/*  rrq_publish
+    Ya esta todo en el temporal: se publica el archivo con su nombre, sale
+    el ultimo ACK y la sesion termina
+*/
+
+static void rrq_publish ( tftp_t *instance ) {
+    if ( out_commit ( &instance->out ) == -1 ) {
+        session_error ( instance, "Error saving %s: %s", instance->file,
+                        strerror ( errno ) );
+        return;
+    }
 
-    if ( setsockopt ( instance->local_descriptor, SOL_SOCKET, SO_RCVTIMEO,
-                      ( char * ) &instance->timeout,
-                      sizeof ( instance->timeout ) )
-         < 0 ) {
-        printf ( "ERROR Sending write request (setsockopt) %s \n",
+    /* Enviamos el último ack */
+
+    if ( session_output ( instance ) == -1 )
+        syslog ( LOG_WARNING, "Error from sendto() in ack_send(): %s",
                  strerror ( errno ) );
 
-        /* Cerramos el descriptor de archivo y de socket */
+    syslog ( LOG_NOTICE, "File %s received successfully", instance->file );
+    session_done ( instance, true );
+}
+
+/*  data_take
+    Escribe los len bytes del DATA en orden que hay en buf y prepara su ACK.
+    Si es el ultimo publica el archivo y termina la sesion; si se
+    descomprime, antes tiene que acabar el hilo y eso lo espera rrq_run.
+*/
+
+static void data_take ( tftp_t *instance, size_t len ) {
+    tftp_hot_t *hot = HOT ( instance );
 
-        close ( instance->fd );
-        close ( instance->local_descriptor );
+    /* Los datos se escriben desde el msg recibido, sin copiarlos antes */
 
-        _exit_free ( EXIT_FAILURE, 1, instance );
+    if ( out_write ( &instance->out, instance->buf + 4, len ) == -1 ) {
+        session_error ( instance, "Error writing %s: %s", instance->file,
+                        strerror ( errno ) );
+        return;
     }
 
-    /* Seguimos */
-    for ( ;; )
-        data_send_cli ( instance );
+    /*  Incrementamos blknum y preparamos su ACK, que sale al completar la
+        ventana */
+
+    hot->blknum++;
+    instance->unacked++;
+    instance->stats.blocks++;
+    instance->stats.bytes += len;
+    build_ack_msg ( instance );
+
+    /* Verificamos si es el último msg por recibir */
+
+    if ( len < instance->blksize ) {
+        if ( instance->out.inflate == NULL )
+            rrq_publish ( instance );
+
+        else {
+            inflate_close ( instance->out.inflate );
+            instance->draining = true;
+        }
+    }
 }
 
-void ack_send_cli ( tftp_t *instance ) {
-    ssize_t sent;
-    ssize_t received;
-    off_t   offset;
+/*  rrq_data
+    Procesa un msg recibido durante un RRQ: cada DATA en orden se escribe y
+    prepara su ACK, que solo sale al completar la ventana
 
-    /*  Asignamos -1 a blknum en caso de ser 65535 para evitar un rango
-        incorrecto
-        en los ack */
+    Devuelve true si el ACK que hay en pkt tiene que salir: la ventana esta
+    completa, o llego el OACK y se confirma con el ACK del bloque 0
+*/
 
-    if ( instance->blknum == 65535 )
-        instance->blknum = -1;
+static bool rrq_data ( tftp_t *instance ) {
+    tftp_hot_t *hot = HOT ( instance );
+    uint64_t    block;
+    u_char *    held;
+    size_t      len;
+    tftp_msg_t  msg;
 
-    /* Esperamos el siguiente msg */
+    /* Lo mal formado (o un DATA mas largo que el blksize) se ignora */
 
-    received = recvfrom (
-        instance->local_descriptor, instance->buf, MAX_BUFSIZE, 0,
-        ( struct sockaddr * ) &instance->remote_addr, &instance->size_remote );
+    if ( parse_msg ( instance->buf, instance->co.received, instance->blksize,
+                     &msg )
+         == -1 )
+        return false;
 
-    /* Verificamos que haya llegado un msg válido, se debe cumplir: */
-    /* 1. Que received sea distinto a -1 */
-    /* 2. Que received sea distinto a EWOULDBLOCK */
-    /* 3. Que el OPCODE sea OPCODE_DATA */
-    /* 4. Que el blknum sea el que esperamos */
-    /*  5. Que el msg sea de donde lo esperamos (mismo tid del inicio de la
-        transferencia) */
+    if ( msg.opcode == OPCODE_ERROR ) {
+        server_error ( instance, &msg );
+        return false;
+    }
 
-    if ( received != -1 && received != EWOULDBLOCK
-         && ( ( instance->buf[0] << 8 ) + instance->buf[1] == OPCODE_DATA )
-         && ( ( instance->buf[2] << 8 ) + instance->buf[3]
-              == instance->blknum + 1 )
-         && instance->tid == ntohs ( instance->remote_addr.sin_port ) ) {
-        /*  Llegando un msg válido, reiniciamos a cero el número máximo de
-            reintentos
-            permitidos */
+    /*  Si pedimos opciones el servidor puede responder con un OACK en vez del
+        primer DATA */
 
-        instance->retries = 0;
+    if ( hot->state == STATE_STANDBY && msg.opcode == OPCODE_OACK ) {
+        if ( dec_oack ( instance, &msg ) == -1 ) {
+            reject_oack ( instance );
+            return false;
+        }
 
-        /* Procesamos los datos recibidos */
+        session_rtt ( instance );
+        hot->state = STATE_ACK_SENT;
+        build_ack_msg ( instance );
+        return true;
+    }
 
-        dec_data ( instance );
+    if ( msg.opcode != OPCODE_DATA )
+        return false;
 
-        /* Verificamos si es el último msg por recibir */
+    /*  Los bloques ya escritos (duplicados) quedan detras del esperado: con
+        la vuelta de 16 bits caen mas alla de la ventana y se ignoran. Nunca
+        se contesta a un duplicado, si el servidor no recibio nuestro ACK lo
+        reenvia el bucle al vencer el timeout (Sorcerer's Apprentice). */
 
-        if ( received < MAX_BUFSIZE ) {
-            /* Escribimos en el archivo */
+    block = BLOCK_UNWRAP ( hot->blknum + 1, msg.block );
 
-            write ( instance->fd, instance->msg, received - ACK_BUFSIZE );
+    /*  Uno adelantado dentro de la ventana se guarda hasta que llegue el que
+        falta, asi la ventana no se repite entera por un desorden */
 
-            /* Generamos el último ack */
+    if ( block != hot->blknum + 1 ) {
+        if ( block - hot->blknum > instance->window
+             || block - hot->blknum > REORDER_SLOTS )
+            return false;
 
-            instance->blknum++;
-            build_ack_msg ( instance );
+        if ( instance->reorder == NULL
+             && ( instance->reorder = reorder_new () ) == NULL )
+            return false;
 
-            /* Enviamos el último msg */
+        reorder_hold ( instance->reorder, block, &instance->buf,
+                       instance->co.received );
+        return false;
+    }
+
+    session_rtt ( instance );
+    hot->state = STATE_ACK_SENT;
+
+    data_take ( instance, msg.len );
 
-            sent = sendto ( instance->local_descriptor, instance->buf,
-                            ACK_BUFSIZE, 0,
-                            ( struct sockaddr * ) &instance->remote_addr,
-                            instance->size_remote );
+    /* Siguen en orden los que se guardaron */
 
-            /* Verificamos que se haya enviado correctamente */
+    while ( !instance->done && !instance->draining && instance->reorder != NULL
+            && ( held = reorder_take ( instance->reorder, hot->blknum + 1, &len ) )
+                   != NULL ) {
+        pool_put ( instance->buf );
+        instance->buf = held;
+        data_take ( instance, len - 4 );
+    }
 
-            if ( sent != ACK_BUFSIZE )
-                _err_log_exit ( LOG_ERR,
-                                "Error from sendto() in ack_send(): %s",
-                                strerror ( errno ) );
+    if ( instance->done || instance->draining )
+        return false;
 
-            /* Cerramos el descriptor de archivo y de socket */
+    if ( instance->unacked >= instance->window )
+        return true;
 
-            close ( instance->fd );
-            close ( instance->local_descriptor );
+    /*  A mitad de ventana no se confirma, pero si no llega el resto se
+        confirmara este bloque */
 
-            syslog ( LOG_NOTICE, "File %s received successfully",
-                     instance->file );
+    session_arm ( instance );
+    return false;
+}
 
-            /* Hijo finaliza */
+/*  rrq_room
+    Cabe en el descompresor la ventana que pediria el ACK. Si no, el ACK se
+    retiene: el servidor no manda mas y la descarga va al paso del hilo.
+*/
+
+static bool rrq_room ( tftp_t *instance ) {
+    return instance->out.inflate == NULL
+        || inflate_room ( instance->out.inflate,
+                          ( size_t ) instance->window * instance->blksize );
+}
+
+/*  rrq_wake
+    Atiende lo que desperto a un RRQ: un msg, o el reenvio. Si no llego el
+    resto de la ventana se confirma el ultimo bloque en orden y el servidor
+    repite desde ahi (RFC 7440); sin respuesta aun, se repite el RRQ.
+
+    Devuelve true si hay un ACK que tiene que salir en cuanto se pueda
+*/
 
-            _exit ( EXIT_SUCCESS );
+static bool rrq_wake ( tftp_t *instance ) {
+    if ( instance->co.wake == WAKE_RECV )
+        return rrq_data ( instance );
+
+    if ( instance->co.wake != WAKE_RETRY )
+        return false;
+
+    /* Sin turno, o sin sitio para descomprimir, solo se repite el RRQ */
+
+    if ( ( instance->held || !rrq_room ( instance ) )
+         && HOT ( instance )->state != STATE_STANDBY )
+        return true;
+
+    instance->unacked = 0;
+
+    if ( session_burst ( instance ) == -1 ) {
+        session_error ( instance, "Error from sendto() retrying %s: %s",
+                        instance->file, strerror ( errno ) );
+        return false;
+    }
+
+    session_arm ( instance );
+    return false;
+}
+
+/*  rrq_run
+    Corrutina de un RRQ (coro.h): pide el archivo y confirma cada ventana
+    cuando el limite de ritmo lo permite. Retrasar el ACK frena al servidor,
+    que no envia la siguiente ventana hasta recibirlo, asi que esa ventana se
+    cobra al pedirla: el reparto del limite global (fair.h) ve lo que cuesta
+    cada turno antes de darle el siguiente a otra. Una descarga pre-abierta
+    (batch.h) se queda con el ACK hasta que le toca, y una comprimida hasta
+    que el descompresor tiene sitio (inflate.h); la ultima, hasta que el
+    hilo acaba y el archivo se publica.
+*/
+
+static void rrq_run ( tftp_t *instance ) {
+    tftp_coro_t *co   = &instance->co;
+    uint64_t     wait = 0;
+
+    CORO_BEGIN ( co );
+
+    if ( rrq_open ( instance ) == -1 )
+        CORO_EXIT ( co );
+
+    // Enviamos el RRQ
+
+    instance->pkt_len = build_request ( instance, OPCODE_RRQ );
+
+    if ( session_send ( instance ) == -1 ) {
+        session_error ( instance, "Sending RRQ %s", strerror ( errno ) );
+        CORO_EXIT ( co );
+    }
+
+    for ( ;; ) {
+        /* Llegan bloques hasta completar la ventana (o el OACK) */
+
+        do
+            CORO_YIELD ( co );
+        while ( !rrq_wake ( instance ) && !instance->done
+                && !instance->draining );
+
+        /*  Llego el ultimo bloque de una comprimida: la sesion duerme hasta
+            que el hilo descomprima lo que quede, sin hacer caso de lo que
+            llegue entretanto (el servidor repetira el ultimo DATA) */
+
+        while ( instance->draining && !instance->done ) {
+            if ( inflate_done ( instance->out.inflate ) ) {
+                rrq_publish ( instance );
+                break;
+            }
+
+            if ( session_sleep ( instance, instance->out.inflate->efd ) == -1 ) {
+                session_error ( instance, "Waiting for decompression of %s: %s",
+                                instance->file, strerror ( errno ) );
+                break;
+            }
+
+            CORO_YIELD ( co );
         }
 
-        /* Escribimos en el archivo */
+        /*  El ACK sale cuando le toque, quepa la ventana siguiente en el
+            descompresor y el ritmo lo deje */
 
-        offset = write ( instance->fd, instance->msg, received - ACK_BUFSIZE );
+        for ( ;; ) {
+            if ( instance->done )
+                CORO_EXIT ( co );
 
-        /* Limpiamos buffer y msg */
+            if ( instance->held )
+                instance->parked = true;
 
-        memset ( instance->buf, 0, MAX_BUFSIZE );
-        memset ( instance->msg, 0, BUFSIZE );
+            else if ( !rrq_room ( instance ) ) {
+                if ( session_sleep ( instance, instance->out.inflate->efd ) == -1 ) {
+                    session_error ( instance, "Waiting for decompression of %s: %s",
+                                    instance->file, strerror ( errno ) );
+                    CORO_EXIT ( co );
+                }
 
-        /* Incrementamos blknum */
+            } else if ( ( wait = session_wait ( instance ) ) != 0 )
+                session_pace ( instance, wait );
 
-        instance->blknum++;
-        return;
+            else
+                break;
 
-    }  // end 4-condition if
+            CORO_YIELD ( co );
+            rrq_wake ( instance );
+        }
 
-    instance->retries++;
+        instance->unacked = 0;
+        session_spend ( instance,
+                        ( size_t ) instance->window * ( instance->blksize + 4 ) );
 
-    if ( instance->retries == DEF_RETRIES )
-        _err_log_exit ( LOG_ERR, "Retries limit reached." );
+        if ( session_send ( instance ) == -1 ) {
+            session_error ( instance, "Error from sendto() in ack_send(): %s",
+                            strerror ( errno ) );
+            CORO_EXIT ( co );
+        }
+    }
 
-    syslog ( LOG_NOTICE, "Retry number %d in ack_send(); blknum %d",
-             instance->retries, instance->blknum + 1 );
+    CORO_END ( co );
 }
 
 void start_rrq ( tftp_t *instance ) {
-    ssize_t sent, received;
+    coro_start ( instance, rrq_run );
+}
 
-    /* Comprobamos si hay errores */
+/*  open_loop
+    Prepara el bucle de eventos con los limites y sockets pedidos
+
+    Devuelve NULL, o el paso que fallo con errno
+*/
 
-    if ( access ( ".", W_OK ) != 0 ) {
-        printf ( "ERROR There are no permissions to write.\n" );
-        _exit ( EXIT_FAILURE );
+static const char *open_loop ( tftp_loop_t *loop ) {
+    int error;
+
+    if ( loop_init ( loop ) == -1 )
+        return "Creating event loop";
+
+    bucket_init ( &loop->rate, global_rate, loop_now_us () );
+    loop->busy_poll = busy_poll;
+
+    if ( shared_sockets != 0 && loop_share ( loop, shared_sockets ) == -1 ) {
+        error = errno;
+        loop_destroy ( loop );
+        errno = error;
+        return "Creating shared sockets";
     }
 
-    build_request ( instance, OPCODE_RRQ );
+    return NULL;
+}
+
+/*  restartable
+    Un espejo respondio y luego fallo a mitad: se puede repetir desde el
+    principio con otro, salvo que ya haya salido algo por stdout o la subida
+    venga de una tuberia que ya no se puede releer
+*/
 
+static bool restartable ( const tftp_race_t *race, const tftp_t *winner,
+                          const tftp_result_t *result ) {
+    if ( winner != race->winner || !( winner->lost || winner->refused ) )
+        return false;
 
-    if ( sent != 4 + strlen(instance->file) + strlen(instance->mode) ) {
-        printf ( "ERROR Sending RRQ %s\n", strerror ( errno ) );
-        _exit ( EXIT_FAILURE );
+    if ( output_fd != -1 && result->bytes > 0 )
+        return false;
+
+    return !winner->sequential;
+}
+
+/*  start_protocol
+    Envia la peticion a las direcciones del servidor (Happy Eyeballs) y
+    atiende la transferencia hasta que termina. El bucle de eventos le da
+    socket a cada intento. Si el espejo que gano falla a mitad, se repite con
+    los que queden. Nada de la transferencia termina el proceso: lo
+    que paso queda en result.
+
+    Devuelve EXIT_SUCCESS o EXIT_FAILURE
+*/
+
+int start_protocol ( tftp_t *instance, int type, tftp_race_t *race,
+                     tftp_result_t *result ) {
+    tftp_loop_t loop;
+    tftp_t *    winner, *retry;
+    const char *step;
+    char        reason[RESULT_MSGSIZE];
+
+    if ( ( step = open_loop ( &loop ) ) != NULL ) {
+        snprintf ( reason, sizeof ( reason ), "%s %s", step, strerror ( errno ) );
+        tftp_set_reason ( instance, reason );
+        tftp_result ( instance, result );
+        tftp_free ( instance );
+        return EXIT_FAILURE;
     }
 
-    /*  Asignamos el temporizador para que el socket envía señal cada vez que
-        llega (o no) algo */
+    /*  Se ejecuta la peticion dependiendo del tipo que sea. Los RRQ se lanzan
+        en paralelo a las distintas direcciones; un WRQ solo pasa a la
+        siguiente si falla, para no escribir el archivo en dos servidores */
 
-    if ( setsockopt ( instance->local_descriptor, SOL_SOCKET, SO_RCVTIMEO,
-                      ( char * ) &instance->timeout,
-                      sizeof ( instance->timeout ) )
-         < 0 ) {
-        printf ( "ERROR Sending read request (setsockopt) %s \n",
-                 strerror ( errno ) );
-        _exit ( EXIT_FAILURE );
+    for ( ;; ) {
+        race_start ( race, &loop, instance, OPCODE_RRQ == type ? start_rrq
+                                                               : start_wrq,
+                     OPCODE_RRQ == type );
+
+        loop_run ( &loop );
+
+        /*  El resultado es el del intento que recibio respuesta; si ninguno
+            la recibio, el de la sesion original */
+
+        winner = race_outcome ( race );
+        tftp_result ( winner, result );
+
+        if ( result->ok || !restartable ( race, winner, result )
+             || race_failover ( race, winner ) == -1
+             || ( retry = tftp_clone ( instance ) ) == NULL )
+            break;
+
+        syslog ( LOG_NOTICE, "Retrying %s on another server: %s",
+                 instance->file, result->message );
+
+        race_free ( race );
+        tftp_free ( instance );
+        instance = retry;
     }
 
-    /* Inicializamos las variables a usar */
+    if ( show_stats )
+        stats_print ( stdout, winner->file, &winner->stats );
 
-    instance->blknum = 0;
-    instance->fd     = open ( instance->file, O_WRONLY | O_CREAT | O_TRUNC,
-                              S_IRWXU | S_IRWXG | S_IRWXO );
+    race_free ( race );
+    tftp_free ( instance );
+    loop_destroy ( &loop );
 
-    // Enviamos el RRQ
+    return result->ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*  open_board
+    Con varios espejos el trabajo se reparte segun el marcador (score.h), que
+    se recupera de scoreboard_path; sin el archivo (la primera vez) se
+    empieza sin saber nada
 
-    sent = sendto ( instance->local_descriptor, instance->buf, 4 + strlen(instance->file) + strlen(instance->mode), 0,
-                    ( struct sockaddr * ) &instance->remote_addr,
-                    instance->size_remote );
+    Devuelve el marcador, o NULL si solo hay un espejo
+*/
 
-    /* Seguimos */
-    for ( ;; )
-        ack_send_cli ( instance );
+static tftp_board_t *open_board ( const tftp_race_t *server ) {
+    static tftp_board_t board;
+
+    if ( server->nhosts < 2 )
+        return NULL;
+
+    board_init ( &board );
+
+    if ( scoreboard_path != NULL && board_load ( &board, server, scoreboard_path ) == -1
+         && errno != ENOENT )
+        syslog ( LOG_WARNING, "Error reading scoreboard %s: %s",
+                 scoreboard_path, strerror ( errno ) );
+
+    return &board;
 }
 
-void start_protocol ( tftp_t *instance, int type ) {
+/*  close_board
+    Guarda lo aprendido para la proxima vez
+*/
 
+static void close_board ( const tftp_board_t *board, const tftp_race_t *server ) {
+    if ( board != NULL && scoreboard_path != NULL
+         && board_save ( board, server, scoreboard_path ) == -1 )
+        syslog ( LOG_WARNING, "Error saving scoreboard %s: %s",
+                 scoreboard_path, strerror ( errno ) );
+}
 
+/*  run_batch
+    Descarga los archivos de la lista de batch del servidor, con las opciones
+    de model, en un solo bucle (batch.h). El marcador de los espejos
+    (score.h) se recupera de scoreboard_path y se guarda al terminar.
 
-    // Costruimos socket del cliente
+    Devuelve EXIT_SUCCESS si se descargaron todos, o EXIT_FAILURE
+*/
 
-    memset ( &instance->local_addr, 0, sizeof ( struct sockaddr_in ) );
-    instance->local_descriptor = socket ( AF_INET, SOCK_DGRAM, 0 );
+static int run_batch ( tftp_batch_t *batch, tftp_t *model, tftp_race_t *server ) {
+    tftp_loop_t loop;
+    const char *step;
 
-    if ( bind ( instance->local_descriptor,
-                ( struct sockaddr * ) &instance->local_addr,
-                sizeof ( struct sockaddr_in ) )
-         == -1 )
-        printf ( "ERROR Binding Client socket %s\n", strerror ( errno ) );
+    if ( ( step = open_loop ( &loop ) ) != NULL ) {
+        printf ( "ERROR %s %s\n", step, strerror ( errno ) );
+        return EXIT_FAILURE;
+    }
+
+    batch->board    = open_board ( server );
+    batch->loop     = &loop;
+    batch->model    = model;
+    batch->server   = server;
+    batch->start    = start_rrq;
+    batch->jobs     = batch_jobs;
+    batch->prefetch = batch_prefetch;
+    batch->stats    = show_stats;
+
+    batch_run ( batch );
+    loop_destroy ( &loop );
+    close_board ( batch->board, server );
 
-    instance->local_addr.sin_family      = AF_INET;
-    instance->local_addr.sin_addr.s_addr = INADDR_ANY;
-    instance->local_addr.sin_port = htons(0);
+    return batch->failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/*  start_batch
+    Descarga todos los archivos listados en manifest
+
+    Devuelve EXIT_SUCCESS si se descargaron todos, o EXIT_FAILURE
+*/
+
+int start_batch ( tftp_t *model, const char *manifest, tftp_race_t *server ) {
+    static tftp_batch_t batch;
+    int                 status;
 
-    /* Se ejecuta la peticion dependiendo del tipo que sea */
+    if ( batch_load ( &batch, manifest ) == -1 ) {
+        printf ( "ERROR Reading manifest %s %s\n", manifest, strerror ( errno ) );
+        tftp_free ( model );
+        return EXIT_FAILURE;
+    }
 
-    if ( OPCODE_RRQ == type )
-        start_rrq ( instance );
+    status = run_batch ( &batch, model, server );
 
-    else
-        start_wrq ( instance );
+    batch_free ( &batch );
+    tftp_free ( model );
 
-    free ( instance );
+    return status;
 }
 
-int main ( int argc, char **argv ) {
+/*  start_daemon
+    Se queda residente en el socket path atendiendo transferencias (daemon.h)
+    con las opciones de model, hasta que llegue SIGINT o SIGTERM
 
-    struct gengetopt_args_info args_info;
-    tftp_t instance;
-    int type;
+    Devuelve EXIT_SUCCESS, o EXIT_FAILURE si no pudo empezar
+*/
 
-    instance.mode        = MODE_OCTET;
+int start_daemon ( tftp_t *model, const char *path, tftp_race_t *server ) {
+    static tftp_daemon_t daemon;
+    tftp_loop_t          loop;
+    const char *         step;
 
-    memset(&instance.remote_addr,0,sizeof(struct sockaddr_in));
+    if ( ( step = open_loop ( &loop ) ) != NULL ) {
+        printf ( "ERROR %s %s\n", step, strerror ( errno ) );
+        tftp_free ( model );
+        return EXIT_FAILURE;
+    }
 
-    instance.remote_addr.sin_family = AF_INET;
-    instance.size_remote = sizeof ( struct sockaddr_in );
-    instance.size_local  = sizeof ( struct sockaddr_in );
-    instance.remote_addr.sin_port = htons( DEFAULT_SERVER_PORT );
+    daemon.loop       = &loop;
+    daemon.model      = model;
+    daemon.server     = server;
+    daemon.board      = open_board ( server );
+    daemon.start_rrq  = start_rrq;
+    daemon.start_wrq  = start_wrq;
+    daemon.jobs       = batch_jobs;
+    daemon.per_server = per_server;
+
+    if ( daemon_open ( &daemon, path ) == -1 ) {
+        printf ( "ERROR Listening on %s %s\n", path, strerror ( errno ) );
+        loop_destroy ( &loop );
+        tftp_free ( model );
+        return EXIT_FAILURE;
+    }
 
+    daemon_run ( &daemon );
 
+    close_board ( daemon.board, server );
+    loop_destroy ( &loop );
+    tftp_free ( model );
 
+    return EXIT_SUCCESS;
+}
+
+/*  start_sync
+    Descarga el manifest remoto al directorio actual y despues solo los
+    archivos cuya copia local no coincide con el (sync.h)
+
+    Devuelve EXIT_SUCCESS si todo coincide al terminar, o EXIT_FAILURE
+*/
+
+int start_sync ( tftp_t *model, const char *manifest, tftp_race_t *server ) {
+    static tftp_batch_t batch;
+    static tftp_sync_t  sync;
+    tftp_t *            fetch;
+    tftp_result_t       result;
+    int                 status = EXIT_FAILURE;
+
+    if ( tftp_set_file ( model, manifest ) == -1
+         || ( fetch = tftp_clone ( model ) ) == NULL ) {
+        printf ( "ERROR Fetching %s %s\n", manifest, strerror ( ENOMEM ) );
+        tftp_free ( model );
+        return EXIT_FAILURE;
+    }
+
+    if ( start_protocol ( fetch, OPCODE_RRQ, server, &result ) != EXIT_SUCCESS ) {
+        printf ( "ERROR Fetching manifest %s: %s\n", manifest, result.message );
+        tftp_free ( model );
+        return EXIT_FAILURE;
+    }
+
+    if ( sync_load ( &sync, manifest ) == -1 ) {
+        printf ( "ERROR Reading manifest %s %s\n", manifest, strerror ( errno ) );
+        tftp_free ( model );
+        return EXIT_FAILURE;
+    }
+
+    if ( sync_plan ( &sync, &batch ) == -1 )
+        printf ( "ERROR Comparing local files %s\n", strerror ( errno ) );
+
+    else {
+        status = batch.nfiles == 0 ? EXIT_SUCCESS
+                                   : run_batch ( &batch, model, server );
+
+        if ( sync_verify ( &sync ) == -1 )
+            status = EXIT_FAILURE;
+    }
+
+    printf ( "sync: %u files, %u fetched, %u unchanged, %u mismatched\n",
+             sync.count, sync.fetched, sync.count - sync.fetched, sync.mismatch );
+
+    batch_free ( &batch );
+    sync_free ( &sync );
+    tftp_free ( model );
+
+    return status;
+}
+
+int main ( int argc, char **argv ) {
+
+    struct gengetopt_args_info args_info;
+    static tftp_race_t race;
+    const char *port = DEFAULT_SERVER_PORT_STR;
+    tftp_t *instance;
+    tftp_result_t result;
+    int type;
+    int status;
+
+    if ( ( instance = tftp_new () ) == NULL ) {
+        puts ( "Not enough memory" );
+        exit ( EXIT_FAILURE );
+    }
+
+    instance->out.policy  = DURABILITY_END;
+    instance->out.flush_bytes = ( off_t ) DEF_FLUSH_MB << 20;
 
 
     /* Obtenemos las opciones de comando */
     if (cmdline_parser (argc, argv, &args_info) != 0)
         exit(EXIT_FAILURE) ;
 
+    /*  Con -o - los datos salen por stdout, asi que los mensajes pasan a
+        stderr para no mezclarse con ellos */
+
+    if ( args_info.output_given && !strcmp ( args_info.output_arg, "-" )
+         && !args_info.put_given ) {
+        if ( ( output_fd = dup ( STDOUT_FILENO ) ) == -1
+             || dup2 ( STDERR_FILENO, STDOUT_FILENO ) == -1 ) {
+            perror ( "dup" );
+            exit ( EXIT_FAILURE );
+        }
+    }
+
     /* Revisamos que sean mutuamente excluyentes get y put */
 
-    if ( (args_info.get_given && args_info.put_given)  /* Que sean mutuamente excluyentes get y put */
+    if ( (args_info.get_given + args_info.put_given + args_info.manifest_given + args_info.sync_given + args_info.listen_given > 1)  /* Que sean mutuamente excluyentes get, put, manifest, sync y listen */
          || ( args_info.put_given && ( !strcmp(args_info.put_arg,"g") /* Que put no esté de la forma --put,-p  [g, --get, -g] */
                                        || !strcmp(args_info.put_arg,"--get")
                                        || !strcmp(args_info.put_arg,"-g")) )
@@ -387,24 +1080,259 @@ int main ( int argc, char **argv ) {
         puts( "You only can put or get a file at a time, not both." );
         exit(EXIT_FAILURE);
     }
+
+    if ( !args_info.get_given && !args_info.put_given && !args_info.manifest_given
+         && !args_info.sync_given && !args_info.listen_given ) {
+        puts( "You must get or put a file, give a manifest, or listen on a socket." );
+        exit(EXIT_FAILURE);
+    }
     printf("Número de argumentos sin nombre: %d\n", args_info.inputs_num);
     if ( args_info.get_given ){
         printf( "get: %s\n", args_info.get_arg);
-        strcpy(instance.file,args_info.get_arg);
+        if ( tftp_set_file ( instance, args_info.get_arg ) == -1 ) {
+            printf ( "Invalid file name %s\n", strerror ( errno ) );
+            exit ( EXIT_FAILURE );
+        }
         type = OPCODE_RRQ;
     }
 
     if ( args_info.put_given ) {
+        const char *remote = args_info.put_arg;
+
         printf( "put: %s\n", args_info.put_arg);
-        strcpy(instance.file, args_info.put_arg);
+
+        /*  Con -o el archivo se sube con otro nombre; desde stdin hace falta
+            uno */
+
+        if ( args_info.output_given ) {
+            if ( ( input_path = strdup ( args_info.put_arg ) ) == NULL ) {
+                puts ( "Not enough memory" );
+                exit ( EXIT_FAILURE );
+            }
+
+            remote = args_info.output_arg;
+
+        } else if ( !strcmp ( args_info.put_arg, "-" ) ) {
+            puts ( "Uploading from stdin needs a remote name (-o name)." );
+            exit ( EXIT_FAILURE );
+        }
+
+        if ( tftp_set_file ( instance, remote ) == -1 ) {
+            printf ( "Invalid file name %s\n", strerror ( errno ) );
+            exit ( EXIT_FAILURE );
+        }
         type = OPCODE_WRQ;
     }
 
+    /* Nombre local de la descarga, o stdout */
+
+    if ( args_info.output_given && !args_info.put_given ) {
+        if ( !args_info.get_given ) {
+            puts ( "Output only applies to --get and --put." );
+            exit ( EXIT_FAILURE );
+        }
+
+        /* Las opciones se liberan antes de empezar, nos quedamos una copia */
+
+        if ( output_fd == -1 && ( output_path = strdup ( args_info.output_arg ) ) == NULL ) {
+            puts ( "Not enough memory" );
+            exit ( EXIT_FAILURE );
+        }
+    }
+
+    /* Politica de durabilidad del archivo descargado */
+
+    if ( args_info.durability_given
+         && ( instance->out.policy = out_policy ( args_info.durability_arg ) )
+                == -1 ) {
+        printf ( "Unknown durability policy %s (none, end, range)\n",
+                 args_info.durability_arg );
+        exit ( EXIT_FAILURE );
+    }
+
+    instance->out.direct = args_info.direct_given;
+
+    if ( args_info.flush_mb_given ) {
+        char *tmp;
+        long  mb = strtol ( args_info.flush_mb_arg, &tmp, 10 );
+
+        if ( *tmp != '\0' || mb <= 0 ) {
+            printf ( "Invalid flush interval %s\n", args_info.flush_mb_arg );
+            exit ( EXIT_FAILURE );
+        }
+
+        instance->out.flush_bytes = ( off_t ) mb << 20;
+    }
+
+    /* Tamaño de bloque a negociar (RFC 2348) */
+
+    if ( args_info.blksize_given ) {
+        char *tmp;
+        long  blksize = strtol ( args_info.blksize_arg, &tmp, 10 );
+
+        if ( *tmp != '\0' || blksize < MIN_BLKSIZE || blksize > MAX_BLKSIZE ) {
+            printf ( "Invalid block size %s\n", args_info.blksize_arg );
+            exit ( EXIT_FAILURE );
+        }
+
+        if ( blksize != BUFSIZE )
+            instance->blksize_opt = blksize;
+    }
+
+    /* Tamaño de ventana a negociar (RFC 7440) */
+
+    if ( args_info.windowsize_given ) {
+        char *tmp;
+        long  window = strtol ( args_info.windowsize_arg, &tmp, 10 );
+
+        if ( *tmp != '\0' || window < 1 || window > MAX_WINDOWSIZE ) {
+            printf ( "Invalid window size %s\n", args_info.windowsize_arg );
+            exit ( EXIT_FAILURE );
+        }
+
+        if ( window != 1 )
+            instance->window_opt = window;
+    }
+
+    /* Control de congestion de las subidas por ventanas */
+
+    instance->cc.ops = &cc_aimd;
+
+    if ( args_info.congestion_given
+         && ( instance->cc.ops = cc_find ( args_info.congestion_arg ) )
+                == NULL ) {
+        printf ( "Unknown rate controller %s (fixed, aimd)\n",
+                 args_info.congestion_arg );
+        exit ( EXIT_FAILURE );
+    }
+
+    /* Limites de ritmo, de esta transferencia y de todas */
+
+    if ( args_info.rate_given ) {
+        char *tmp;
+        long  rate = strtol ( args_info.rate_arg, &tmp, 10 );
+
+        if ( *tmp != '\0' || rate <= 0 ) {
+            printf ( "Invalid rate %s\n", args_info.rate_arg );
+            exit ( EXIT_FAILURE );
+        }
+
+        bucket_init ( &instance->rate, ( uint64_t ) rate << 10, loop_now_us () );
+    }
+
+    if ( args_info.global_rate_given ) {
+        char *tmp;
+        long  rate = strtol ( args_info.global_rate_arg, &tmp, 10 );
+
+        if ( *tmp != '\0' || rate <= 0 ) {
+            printf ( "Invalid rate %s\n", args_info.global_rate_arg );
+            exit ( EXIT_FAILURE );
+        }
+
+        global_rate = ( uint64_t ) rate << 10;
+    }
+
+    if ( args_info.sockets_given ) {
+        char *tmp;
+        long  count = strtol ( args_info.sockets_arg, &tmp, 10 );
+
+        if ( *tmp != '\0' || count < 0 || count > MAX_SHARED ) {
+            printf ( "Invalid socket count %s\n", args_info.sockets_arg );
+            exit ( EXIT_FAILURE );
+        }
+
+        shared_sockets = count;
+    }
+
+    /* Modo de baja latencia, gastando cpu en esperar cada respuesta */
+
+    if ( args_info.busy_poll_given ) {
+        char *tmp;
+        long  us = strtol ( args_info.busy_poll_arg, &tmp, 10 );
+
+        if ( *tmp != '\0' || us <= 0 || us > MAX_BUSY_POLL ) {
+            printf ( "Invalid busy poll time %s\n", args_info.busy_poll_arg );
+            exit ( EXIT_FAILURE );
+        }
+
+        busy_poll = us;
+    }
+
+    show_stats = args_info.stats_given;
+
+    /* Descargas comprimidas, descomprimidas al vuelo */
+
+    if ( args_info.compressed_given ) {
+        if ( args_info.put_given ) {
+            puts ( "Compression only applies to downloads." );
+            exit ( EXIT_FAILURE );
+        }
+
+        instance->compressed = true;
+    }
+
+    /* Descargas en lote */
+
+    if ( args_info.jobs_given ) {
+        char *tmp;
+        long  count = strtol ( args_info.jobs_arg, &tmp, 10 );
+
+        if ( *tmp != '\0' || count < 1 || count > MAX_JOBS ) {
+            printf ( "Invalid job count %s\n", args_info.jobs_arg );
+            exit ( EXIT_FAILURE );
+        }
+
+        batch_jobs = count;
+    }
+
+    if ( args_info.prefetch_given ) {
+        char *tmp;
+        long  count = strtol ( args_info.prefetch_arg, &tmp, 10 );
+
+        if ( *tmp != '\0' || count < 0 || count > MAX_PREFETCH ) {
+            printf ( "Invalid prefetch count %s\n", args_info.prefetch_arg );
+            exit ( EXIT_FAILURE );
+        }
+
+        batch_prefetch = count;
+    }
+
+    /* Marcador de espejos, solo tiene sentido en lote */
+
+    if ( args_info.scoreboard_given ) {
+        if ( !args_info.manifest_given && !args_info.sync_given
+             && !args_info.listen_given ) {
+            puts ( "The scoreboard only applies to --manifest, --sync and --listen." );
+            exit ( EXIT_FAILURE );
+        }
+
+        scoreboard_path = args_info.scoreboard_arg;
+    }
+
+    /* Transferencias a la vez contra cada espejo en el modo residente */
+
+    if ( args_info.per_server_given ) {
+        char *tmp;
+        long  count = strtol ( args_info.per_server_arg, &tmp, 10 );
+
+        if ( !args_info.listen_given ) {
+            puts ( "The per-server limit only applies to --listen." );
+            exit ( EXIT_FAILURE );
+        }
+
+        if ( *tmp != '\0' || count < 1 || count > MAX_JOBS ) {
+            printf ( "Invalid per-server count %s\n", args_info.per_server_arg );
+            exit ( EXIT_FAILURE );
+        }
+
+        per_server = count;
+    }
+
     /* Revisamos que sea una dirección y puerto válidos */
     /* Si no se especifica puerto, se usará el 69 */
 
     if ( args_info.inputs_num == 0 ) { /* Si no hay parámetros, no ha especificado la dirección del servidor */
-        puts( "You must specify a server IP address." );
+        puts( "You must specify a server address." );
         exit(EXIT_FAILURE);
     }
 
@@ -412,39 +1340,65 @@ int main ( int argc, char **argv ) {
         puts( "Too much arguments." );
         exit(EXIT_FAILURE);
     }
-    for ( unsigned i = 0 ; i < args_info.inputs_num ; ++i ) { /* Deben ser en el orden "dirección puerto(opcional)" */
 
-        if ( i == 0) { /* Autenticamos la dirección del servidor */
-            if ( inet_pton ( AF_INET, args_info.inputs[i], &instance.remote_addr ) != 1 ) {// Copiamos la dirección en la estructura remote_addr
-                printf ( "Error parsing IPv4 server address %s\n", strerror ( errno ) );
-                _exit ( EXIT_FAILURE );
-            }
-            printf("%s es una IP válida\n",args_info.inputs[i]);
+    if ( args_info.inputs_num == 2 ) { /* Verificamos que el puerto esté en un rango válido ( 1 - 65535) */
+        char *tmp;
+        long  number = strtol ( args_info.inputs[1], &tmp, 10 );
 
+        if ( *tmp != '\0' || number <= 0 || number > 65535 ) {
+            printf ( "Invalid server port %s\n", args_info.inputs[1] );
+            exit ( EXIT_FAILURE );
+        }
 
-        } else  { /* Verificamos que el puerto esté en un rango válido ( 0 - 65535) */
+        port = args_info.inputs[1];
+    }
 
-            char *tmp;
-            int number = strtol(args_info.inputs[i], &tmp, 10);
+    /*  El servidor puede ser un nombre o una direccion IPv4 o IPv6; nos
+        quedamos con todas sus direcciones para probarlas */
 
-            if (  ( errno == ERANGE )
-                  || ( number <= 0 )
-                  || ( number >= 65535 ) ) {
-                printf ( "Error parsing port server  %s\n", strerror ( errno ) );
-                _exit ( EXIT_FAILURE );
-            }
-            printf("%d es un puerto válido\n",number);
-            instance.remote_addr.sin_port = htons(number);//copiamos el puerto
+    if ( race_resolve ( &race, args_info.inputs[0], port ) == -1 ) {
+        printf ( "Cannot resolve server %s\n", args_info.inputs[0] );
+        exit ( EXIT_FAILURE );
+    }
+
+    if ( args_info.manifest_given ) {
+        status = start_batch ( instance, args_info.manifest_arg, &race );
+
+        cmdline_parser_free (&args_info);
+        return status;
+    }
+
+    if ( args_info.listen_given ) {
+        status = start_daemon ( instance, args_info.listen_arg, &race );
+
+        cmdline_parser_free (&args_info);
+        return status;
+    }
+
+    /*  El espejo se hace dentro del destino: manifest, indice y archivos son
+        relativos a el */
+
+    if ( args_info.sync_given ) {
+        if ( args_info.dest_given && chdir ( args_info.dest_arg ) == -1 ) {
+            printf ( "ERROR Entering %s %s\n", args_info.dest_arg, strerror ( errno ) );
+            exit ( EXIT_FAILURE );
         }
+
+        if ( !args_info.jobs_given )
+            batch_jobs = SYNC_JOBS;
+
+        status = start_sync ( instance, args_info.sync_arg, &race );
+
+        cmdline_parser_free (&args_info);
+        return status;
     }
-   instance.remote_addr.sin_addr.s_addr = inet_addr("8.12.0.174");
-    instance.remote_addr.sin_family = AF_INET;
-    //instance.remote_addr.sin_port = htons( DEFAULT_SERVER_PORT );
-    instance.timeout.tv_usec =  DEF_TIMEOUT_USEC;
-    instance.timeout.tv_sec =  DEF_TIMEOUT_SEC;
+
     cmdline_parser_free (&args_info); /* liberamos la memoria alojada */
-    start_protocol(&instance, type);
 
+    status = start_protocol ( instance, type, &race, &result );
 
-    return EXIT_SUCCESS;
+    if ( !result.ok )
+        printf ( "ERROR %s\n", result.message );
+
+    return status;
 }
@@ -0,0 +1,655 @@
+#define _GNU_SOURCE /* sync_file_range, O_DIRECT, mkostemp, vmsplice */
+
+#include "output.h"
+#include "inflate.h"
+#include "pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <syslog.h>
+#include <unistd.h>
+
+/* Bloques alineados libres, compartidos por todas las salidas O_DIRECT */
+
+static char *chunk_pool[DIRECT_POOL];
+static int   chunk_free = 0;
+
+static char *chunk_get ( void ) {
+    void *p;
+
+    if ( chunk_free > 0 )
+        return chunk_pool[--chunk_free];
+
+    if ( posix_memalign ( &p, DIRECT_ALIGN, DIRECT_CHUNK ) != 0 )
+        return NULL;
+
+    return p;
+}
+
+static void chunk_put ( char *chunk ) {
+    if ( chunk == NULL )
+        return;
+
+    if ( chunk_free < DIRECT_POOL )
+        chunk_pool[chunk_free++] = chunk;
+    else
+        free ( chunk );
+}
+
+/*  direct_pwrite
+    Escribe len bytes de chunk en la posicion out->flushed del temporal. Con
+    O_DIRECT tanto len como el offset deben ser multiplos de DIRECT_ALIGN,
+    salvo la cola final que se escribe ya sin O_DIRECT.
+*/
+
+static int direct_pwrite ( tftp_out_t *out, const char *chunk, size_t len ) {
+    ssize_t n;
+
+    while ( len > 0 ) {
+        n = pwrite ( out->fd, chunk, len, out->flushed );
+
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+
+        chunk += n;
+        len -= n;
+        out->flushed += n;
+    }
+
+    return 0;
+}
+
+/*  direct_tail
+    Vuelca lo que queda en el bloque alineado: la parte alineada con
+    O_DIRECT y el resto quitando O_DIRECT del descriptor
+*/
+
+static int direct_tail ( tftp_out_t *out ) {
+    size_t aligned = out->fill & ~( size_t ) ( DIRECT_ALIGN - 1 );
+    int    flags;
+
+    if ( aligned > 0 && direct_pwrite ( out, out->chunk, aligned ) == -1 )
+        return -1;
+
+    if ( out->fill > aligned ) {
+        flags = fcntl ( out->fd, F_GETFL );
+
+        if ( flags == -1 || fcntl ( out->fd, F_SETFL, flags & ~O_DIRECT ) == -1 )
+            return -1;
+
+        if ( direct_pwrite ( out, out->chunk + aligned, out->fill - aligned )
+             == -1 )
+            return -1;
+    }
+
+    out->fill = 0;
+    return 0;
+}
+
+/*  out_policy
+    Traduce el nombre de una politica de durabilidad a su constante
+
+    name: "none", "end" o "range"
+
+    Devuelve -1 si el nombre no es valido
+*/
+
+int out_policy ( const char *name ) {
+    if ( !strcasecmp ( name, "none" ) )
+        return DURABILITY_NONE;
+
+    if ( !strcasecmp ( name, "end" ) )
+        return DURABILITY_END;
+
+    if ( !strcasecmp ( name, "range" ) )
+        return DURABILITY_RANGE;
+
+    return -1;
+}
+
+/*  out_umask
+    La mascara de creacion del proceso, leida de /proc sin cambiarla: con
+    umask() habria que ponerla a 0 un momento, y los hilos (inflate.h,
+    ahead.h) crearian entretanto archivos con todos los permisos. Sin /proc
+    (kernel anterior a 4.7) se supone 022.
+*/
+
+static mode_t out_umask ( void ) {
+    static int mask = -1;
+    FILE *     status;
+    char       line[64];
+    unsigned   value;
+
+    if ( mask != -1 )
+        return mask;
+
+    mask = S_IWGRP | S_IWOTH;
+
+    if ( ( status = fopen ( "/proc/self/status", "re" ) ) == NULL )
+        return mask;
+
+    while ( fgets ( line, sizeof ( line ), status ) != NULL )
+        if ( sscanf ( line, "Umask: %o", &value ) == 1 ) {
+            mask = value & ( S_IRWXU | S_IRWXG | S_IRWXO );
+            break;
+        }
+
+    fclose ( status );
+    return mask;
+}
+
+/*  out_open
+    Crea un archivo temporal en el mismo directorio que path. El archivo
+    definitivo no se toca hasta out_commit, asi una transferencia fallida no
+    deja archivos a medias ni destruye la copia anterior.
+
+    out->policy y out->flush_bytes deben estar asignados antes de llamarla.
+*/
+
+int out_open ( tftp_out_t *out, const char *path ) {
+    const char *base;
+    int         len;
+
+    if ( strlen ( path ) >= sizeof ( out->path ) ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy ( out->path, path );
+    out->written = 0;
+    out->flushed = 0;
+    out->inflate = NULL;
+    out->stream  = false;
+    out->ring    = NULL;
+    out->nring   = 0;
+
+    /* El temporal es "<dir>/.<archivo>.XXXXXX" para que rename sea atomico */
+
+    base = strrchr ( path, '/' );
+    base = base ? base + 1 : path;
+    len  = snprintf ( out->tmp, sizeof ( out->tmp ), "%.*s.%s.XXXXXX",
+                      ( int ) ( base - path ), path, base );
+
+    if ( len < 0 || ( size_t ) len >= sizeof ( out->tmp ) ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    out->chunk = NULL;
+    out->fill  = 0;
+
+    if ( out->direct ) {
+        out->fd = mkostemp ( out->tmp, O_DIRECT );
+
+        /*  Hay sistemas de archivos (tmpfs) sin O_DIRECT, en ese caso seguimos
+            con escritura normal */
+
+        if ( out->fd == -1 && errno == EINVAL ) {
+            syslog ( LOG_NOTICE, "O_DIRECT not supported for %s, using buffered "
+                                 "writes",
+                     path );
+            out->direct = false;
+            strcpy ( out->tmp + len - 6, "XXXXXX" );
+        }
+    }
+
+    if ( !out->direct )
+        out->fd = mkstemp ( out->tmp );
+
+    if ( out->fd == -1 )
+        return -1;
+
+    if ( out->direct && ( out->chunk = chunk_get () ) == NULL ) {
+        errno = ENOMEM;
+        out_abort ( out );
+        return -1;
+    }
+
+    /* mkstemp crea con 0600, respetamos los permisos de siempre */
+
+    fchmod ( out->fd, ( S_IRWXU | S_IRWXG | S_IRWXO ) & ~out_umask () );
+
+    return 0;
+}
+
+/*  Bloques de vmsplice que la tuberia aun referenciaba al cerrar su salida:
+    se liberan cuando se vacia */
+
+static char *   stream_retired[2 * STREAM_RING];
+static unsigned stream_nretired = 0;
+
+/*  stream_pending
+    Bytes entregados a la tuberia que el lector aun no consumio
+
+    Devuelve los bytes, o -1 si no se sabe
+*/
+
+static int stream_pending ( int fd ) {
+    int pending;
+
+    return ioctl ( fd, FIONREAD, &pending ) == 0 ? pending : -1;
+}
+
+/*  stream_reclaim
+    Libera los bloques retirados si la tuberia ya se vacio
+*/
+
+static void stream_reclaim ( int fd ) {
+    if ( stream_nretired == 0 || stream_pending ( fd ) != 0 )
+        return;
+
+    while ( stream_nretired > 0 )
+        free ( stream_retired[--stream_nretired] );
+}
+
+/*  out_stream
+    Salida a un descriptor ya abierto (stdout, una tuberia): lo recibido sale
+    tal cual, sin temporal ni rename. Si fd es una tuberia los datos se pasan
+    con vmsplice desde un anillo de bloques alineados a pagina, sin copiarlos
+    al kernel ni regalarle las paginas (SPLICE_F_GIFT). Un bloque entregado
+    solo se vuelve a llenar cuando el lector ya paso de el (FIONREAD); si aun
+    no, esos datos salen con write(), que copia. El anillo, y con el la
+    memoria, queda acotado por el tamaño de la tuberia.
+*/
+
+int out_stream ( tftp_out_t *out, int fd ) {
+    struct stat st;
+    int         size;
+    unsigned    i;
+    void *      buf;
+
+    out->fd      = fd;
+    out->stream  = true;
+    out->direct  = false;
+    out->policy  = DURABILITY_NONE;
+    out->written = 0;
+    out->flushed = 0;
+    out->inflate = NULL;
+    out->chunk   = NULL;
+    out->fill    = 0;
+    out->ring    = NULL;
+    out->nring   = 0;
+    out->cur     = 0;
+    out->tmp[0]  = '\0';
+    strcpy ( out->path, "-" );
+
+    if ( fstat ( fd, &st ) == -1 || !S_ISFIFO ( st.st_mode )
+         || ( size = fcntl ( fd, F_GETPIPE_SZ ) ) == -1
+         || size / STREAM_CHUNK + 2 > STREAM_RING )
+        return 0;
+
+    stream_reclaim ( fd );
+
+    out->nring = size / STREAM_CHUNK + 2;
+    out->ring  = pool_get ( out->nring * sizeof ( tftp_splice_t ) );
+
+    for ( i = 0; out->ring != NULL && i < out->nring; i++ ) {
+        if ( posix_memalign ( &buf, sysconf ( _SC_PAGESIZE ), STREAM_CHUNK ) != 0 )
+            break;
+
+        out->ring[i].buf = buf;
+        out->ring[i].end = 0;
+    }
+
+    /* Sin memoria para el anillo se escribe con write(), que tambien vale */
+
+    if ( out->ring == NULL || i < out->nring ) {
+        while ( out->ring != NULL && i > 0 )
+            free ( out->ring[--i].buf );
+
+        pool_put ( out->ring );
+        out->ring  = NULL;
+        out->nring = 0;
+    }
+
+    return 0;
+}
+
+/*  stream_copy
+    Escribe len bytes de p en la tuberia copiandolos, como cualquier write()
+*/
+
+static int stream_copy ( tftp_out_t *out, const char *p, size_t len ) {
+    ssize_t n;
+
+    while ( len > 0 ) {
+        n = write ( out->fd, p, len );
+
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*  stream_splice
+    Entrega el bloque en curso, lleno, a la tuberia sin copiarlo
+*/
+
+static int stream_splice ( tftp_out_t *out ) {
+    tftp_splice_t *chunk = &out->ring[out->cur];
+    struct iovec   iov   = { chunk->buf, STREAM_CHUNK };
+    ssize_t        n;
+
+    while ( iov.iov_len > 0 ) {
+        n = vmsplice ( out->fd, &iov, 1, 0 );
+
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+
+        iov.iov_base = ( char * ) iov.iov_base + n;
+        iov.iov_len -= n;
+    }
+
+    out->written += STREAM_CHUNK;
+    chunk->end = out->written;
+    out->cur   = ( out->cur + 1 ) % out->nring;
+    out->fill  = 0;
+    return 0;
+}
+
+/*  stream_store
+    Acumula en el bloque en curso del anillo y lo entrega al llenarse. Si la
+    tuberia aun tiene paginas del bloque que toca llenar, lo que llega sale
+    copiado hasta que quede libre.
+*/
+
+static ssize_t stream_store ( tftp_out_t *out, const char *p, size_t len ) {
+    size_t left = len;
+    size_t n;
+    int    pending;
+
+    while ( left > 0 ) {
+        n = STREAM_CHUNK - out->fill;
+
+        if ( n > left )
+            n = left;
+
+        if ( out->fill == 0 && out->ring[out->cur].end != 0
+             && ( ( pending = stream_pending ( out->fd ) ) == -1
+                  || out->written - pending < out->ring[out->cur].end ) ) {
+            if ( stream_copy ( out, p, n ) == -1 )
+                return -1;
+
+            out->written += n;
+
+        } else {
+            memcpy ( out->ring[out->cur].buf + out->fill, p, n );
+            out->fill += n;
+
+            if ( out->fill == STREAM_CHUNK && stream_splice ( out ) == -1 )
+                return -1;
+        }
+
+        p += n;
+        left -= n;
+    }
+
+    return len;
+}
+
+/*  stream_close
+    Libera el anillo, o retira los bloques que la tuberia aun referencia
+    para liberarlos cuando se vacie. El descriptor no es nuestro, no se
+    cierra.
+*/
+
+static void stream_close ( tftp_out_t *out ) {
+    bool     drained = out->ring == NULL || stream_pending ( out->fd ) == 0;
+    unsigned i;
+
+    stream_reclaim ( out->fd );
+
+    for ( i = 0; i < out->nring; i++ ) {
+        if ( drained || out->ring[i].end == 0 )
+            free ( out->ring[i].buf );
+
+        else if ( stream_nretired < sizeof ( stream_retired ) / sizeof ( char * ) )
+            stream_retired[stream_nretired++] = out->ring[i].buf;
+
+        /* Sin sitio para recordarlo, liberarlo seria peor que perderlo */
+    }
+
+    pool_put ( out->ring );
+    out->ring  = NULL;
+    out->nring = 0;
+    out->fd    = -1;
+}
+
+/*  out_write
+    Escribe len bytes recibidos: al descompresor si la descarga viene
+    comprimida, o directamente al temporal
+*/
+
+ssize_t out_write ( tftp_out_t *out, const void *data, size_t len ) {
+    if ( out->inflate != NULL )
+        return inflate_push ( out->inflate, data, len );
+
+    return out_store ( out, data, len );
+}
+
+/*  out_store
+    Escribe len bytes en el temporal y, con DURABILITY_RANGE, manda a
+    writeback cada flush_bytes esperando el tramo anterior para no acumular
+    paginas sucias. Con descompresion la llama el hilo descompresor.
+*/
+
+ssize_t out_store ( tftp_out_t *out, const void *data, size_t len ) {
+    const char *p    = data;
+    size_t      left = len;
+    ssize_t     n;
+
+    if ( out->ring != NULL )
+        return stream_store ( out, data, len );
+
+    /* Con O_DIRECT acumulamos en el bloque alineado y escribimos al llenarlo */
+
+    if ( out->direct ) {
+        while ( left > 0 ) {
+            n = DIRECT_CHUNK - out->fill;
+
+            if ( ( size_t ) n > left )
+                n = left;
+
+            memcpy ( out->chunk + out->fill, p, n );
+            out->fill += n;
+            p += n;
+            left -= n;
+
+            if ( out->fill == DIRECT_CHUNK ) {
+                if ( direct_pwrite ( out, out->chunk, DIRECT_CHUNK ) == -1 )
+                    return -1;
+
+                out->fill = 0;
+            }
+        }
+
+        out->written += len;
+        return len;
+    }
+
+    while ( left > 0 ) {
+        n = write ( out->fd, p, left );
+
+        if ( n == -1 ) {
+            if ( errno == EINTR )
+                continue;
+            return -1;
+        }
+
+        p += n;
+        left -= n;
+    }
+
+    out->written += len;
+
+    if ( out->policy != DURABILITY_RANGE || out->flush_bytes <= 0 )
+        return len;
+
+    while ( out->written - out->flushed >= out->flush_bytes ) {
+        /* Iniciamos la escritura del tramo nuevo */
+
+        sync_file_range ( out->fd, out->flushed, out->flush_bytes,
+                          SYNC_FILE_RANGE_WRITE );
+
+        /* Y esperamos a que termine el anterior */
+
+        if ( out->flushed >= out->flush_bytes )
+            sync_file_range ( out->fd, out->flushed - out->flush_bytes,
+                              out->flush_bytes,
+                              SYNC_FILE_RANGE_WAIT_BEFORE
+                                  | SYNC_FILE_RANGE_WRITE
+                                  | SYNC_FILE_RANGE_WAIT_AFTER );
+
+        out->flushed += out->flush_bytes;
+    }
+
+    return len;
+}
+
+/*  out_commit
+    Sincroniza segun la politica, cierra el temporal y lo renombra al nombre
+    definitivo. Si hay politica de durabilidad, tambien se sincroniza el
+    directorio para que el rename sobreviva a un corte; si eso falla el
+    archivo ya esta publicado y solo se avisa.
+
+    Devuelve 0 si el archivo quedo con su nombre, o -1 con errno
+*/
+
+int out_commit ( tftp_out_t *out ) {
+    char        dir[OUT_NAMESIZE];
+    const char *base;
+    int         dfd;
+    int         error;
+
+    /*  El hilo descompresor ya acabo (inflate_done): lo que dijo decide si
+        el temporal esta completo */
+
+    if ( out->inflate != NULL ) {
+        error        = inflate_finish ( out->inflate );
+        out->inflate = NULL;
+
+        if ( error == -1 ) {
+            out_abort ( out );
+            return -1;
+        }
+    }
+
+    /*  A un descriptor ya abierto solo le falta lo que quede en el anillo,
+        que sale copiado: sin esperar al lector, los bloques que aun tenga
+        la tuberia se retiran (stream_close) */
+
+    if ( out->stream ) {
+        if ( out->ring != NULL && out->fill > 0
+             && stream_copy ( out, out->ring[out->cur].buf, out->fill ) == -1 ) {
+            out_abort ( out );
+            return -1;
+        }
+
+        stream_close ( out );
+        return 0;
+    }
+
+    if ( out->direct ) {
+        if ( direct_tail ( out ) == -1 ) {
+            out_abort ( out );
+            return -1;
+        }
+
+        chunk_put ( out->chunk );
+        out->chunk = NULL;
+    }
+
+    if ( out->policy != DURABILITY_NONE && fdatasync ( out->fd ) == -1 ) {
+        out_abort ( out );
+        return -1;
+    }
+
+    if ( close ( out->fd ) == -1 ) {
+        out->fd = -1;
+        out_abort ( out );
+        return -1;
+    }
+
+    out->fd = -1;
+
+    if ( rename ( out->tmp, out->path ) == -1 ) {
+        out_abort ( out );
+        return -1;
+    }
+
+    if ( out->policy == DURABILITY_NONE )
+        return 0;
+
+    base = strrchr ( out->path, '/' );
+
+    if ( base )
+        snprintf ( dir, sizeof ( dir ), "%.*s", ( int ) ( base - out->path + 1 ),
+                   out->path );
+    else
+        strcpy ( dir, "." );
+
+    /*  El archivo ya esta publicado con su nombre: si el directorio no se
+        puede sincronizar solo se pierde la garantia de que el rename
+        sobreviva a un corte, y se avisa sin dar la transferencia por fallida */
+
+    if ( ( dfd = open ( dir, O_RDONLY | O_DIRECTORY ) ) == -1 || fsync ( dfd ) == -1 )
+        syslog ( LOG_WARNING, "Error syncing directory %s for %s: %s", dir,
+                 out->path, strerror ( errno ) );
+
+    if ( dfd != -1 )
+        close ( dfd );
+
+    return 0;
+}
+
+/*  out_abort
+    Descarta el temporal, el archivo definitivo queda como estaba
+*/
+
+void out_abort ( tftp_out_t *out ) {
+    int saved = errno;
+
+    if ( out->inflate != NULL ) {
+        inflate_stop ( out->inflate );
+        out->inflate = NULL;
+    }
+
+    /* Lo que ya salio por el descriptor no se puede deshacer */
+
+    if ( out->stream ) {
+        stream_close ( out );
+        errno = saved;
+        return;
+    }
+
+    if ( out->fd != -1 )
+        close ( out->fd );
+
+    chunk_put ( out->chunk );
+
+    out->fd    = -1;
+    out->chunk = NULL;
+    unlink ( out->tmp );
+
+    errno = saved;
+}
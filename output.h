@@ -0,0 +1,66 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define DURABILITY_NONE 0  /* solo rename, sin sincronizar */
+#define DURABILITY_END 1   /* fdatasync al terminar, antes del rename */
+#define DURABILITY_RANGE 2 /* sync_file_range cada flush_bytes + fdatasync */
+
+struct tftp_inflate;
+
+#define DEF_FLUSH_MB 8
+#define OUT_NAMESIZE 255
+
+#define DIRECT_ALIGN 4096          /* alineacion exigida por O_DIRECT */
+#define DIRECT_CHUNK ( 1 << 20 )   /* tamaño de cada bloque alineado */
+#define DIRECT_POOL 4              /* bloques alineados reutilizables */
+
+#define STREAM_CHUNK ( 64 << 10 )  /* bloque de cada vmsplice, paginas enteras */
+#define STREAM_RING 32             /* bloques del anillo como mucho */
+
+/*  Bloque del anillo de vmsplice. La tuberia se queda con referencias a sus
+    paginas, no con una copia: no se puede volver a llenar ni liberar hasta
+    que el lector haya consumido hasta end */
+
+typedef struct tftp_splice {
+    char *buf; /* alineado a pagina */
+    off_t end; /* written al entregarlo, 0 = nunca entregado */
+
+} tftp_splice_t;
+
+typedef struct tftp_out {
+    int    fd;                     /* descriptor del archivo temporal */
+    int    policy;                 /* politica de durabilidad */
+    off_t  flush_bytes;            /* intervalo para DURABILITY_RANGE */
+    off_t  written;                /* bytes escritos */
+    off_t  flushed;                /* bytes ya enviados a writeback */
+    bool   direct;                 /* escribir con O_DIRECT */
+    char * chunk;                  /* bloque alineado en curso (O_DIRECT) */
+    size_t fill;                   /* bytes acumulados en chunk */
+    struct tftp_inflate *inflate;  /* descompresion en otro hilo, o NULL */
+    bool   stream;                 /* fd ya abierto (stdout), sin temporal */
+    tftp_splice_t *ring;           /* bloques para vmsplice, o NULL */
+    unsigned nring;                /* cuantos */
+    unsigned cur;                  /* el que se esta llenando */
+    char   path[OUT_NAMESIZE];     /* nombre definitivo */
+    char   tmp[OUT_NAMESIZE + 16]; /* nombre del temporal */
+
+} tftp_out_t;
+
+int out_policy ( const char *name );
+
+int out_open ( tftp_out_t *out, const char *path );
+
+int out_stream ( tftp_out_t *out, int fd );
+
+ssize_t out_write ( tftp_out_t *out, const void *data, size_t len );
+
+ssize_t out_store ( tftp_out_t *out, const void *data, size_t len );
+
+int out_commit ( tftp_out_t *out );
+
+void out_abort ( tftp_out_t *out );
+
+#endif
@@ -0,0 +1,88 @@
+#include "parse.h"
+#include "tftp.h"
+
+#include <string.h>
+
+/*  parse_options
+    Recorre los pares "opcion\0valor\0" de un OACK entre p y end. Ninguno
+    puede estar vacio ni quedar sin terminar.
+
+    Devuelve 0, o -1 si el OACK esta mal formado
+*/
+
+static int parse_options ( const u_char *p, const u_char *end,
+                           tftp_msg_t *msg ) {
+    const u_char *stop;
+
+    msg->nopts = 0;
+
+    while ( p < end ) {
+        if ( msg->nopts == PARSE_MAX_OPTS )
+            return -1;
+
+        /* Nombre */
+
+        if ( ( stop = memchr ( p, '\0', end - p ) ) == NULL || stop == p )
+            return -1;
+
+        msg->name[msg->nopts] = ( const char * ) p;
+        p                     = stop + 1;
+
+        /* Valor */
+
+        if ( p >= end || ( stop = memchr ( p, '\0', end - p ) ) == NULL
+             || stop == p )
+            return -1;
+
+        msg->value[msg->nopts++] = ( const char * ) p;
+        p                        = stop + 1;
+    }
+
+    return 0;
+}
+
+/*  parse_msg
+    Valida de una pasada el msg de len bytes en buf y lo deja en msg. Un DATA
+    no puede traer mas de max_data bytes (el blksize) y lo que siga a un ACK
+    se ignora. De un ERROR basta la cabecera: el texto puede faltar o venir
+    sin terminar, se corta en el primer '\0'. Las peticiones no se aceptan,
+    un cliente no las recibe.
+
+    Devuelve 0, o -1 si el msg no es valido
+*/
+
+int parse_msg ( const u_char *buf, size_t len, size_t max_data,
+                tftp_msg_t *msg ) {
+    const u_char *stop;
+
+    /*  Todo msg trae al menos 4 bytes; un OACK sin opciones (2) tampoco se
+        acepta, un servidor que no acepta ninguna no debe mandarlo (RFC 2347)
+        y el bucle descarta lo que sea mas corto */
+
+    if ( len < 4 )
+        return -1;
+
+    msg->opcode = ( buf[0] << 8 ) | buf[1];
+    msg->block  = ( buf[2] << 8 ) | buf[3];
+    msg->data   = buf + 4;
+    msg->len    = len - 4;
+
+    /* Camino rapido: lo que llega con cada bloque */
+
+    if ( msg->opcode == OPCODE_DATA )
+        return msg->len <= max_data ? 0 : -1;
+
+    if ( msg->opcode == OPCODE_ACK )
+        return 0;
+
+    if ( msg->opcode == OPCODE_ERROR ) {
+        if ( ( stop = memchr ( msg->data, '\0', msg->len ) ) != NULL )
+            msg->len = stop - msg->data;
+        return 0;
+    }
+
+    if ( msg->opcode == OPCODE_OACK )
+        return parse_options ( buf + 2, buf + len, msg );
+
+    return -1;
+}
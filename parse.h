@@ -0,0 +1,29 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define PARSE_MAX_OPTS 8 /* opciones de un OACK como mucho */
+
+/*  Msg recibido ya validado, sin copiar nada: los punteros son al buffer de
+    entrada. DATA y ACK, lo que llega con cada bloque, se resuelven con un
+    par de comparaciones; ERROR y OACK, que llegan una vez por sesion, se
+    recorren enteros. */
+
+typedef struct tftp_msg {
+    uint16_t      opcode;                 /* OPCODE_* */
+    uint16_t      block;                  /* DATA/ACK: bloque, ERROR: codigo */
+    const u_char *data;                   /* DATA: datos, ERROR: texto */
+    size_t        len;                    /* bytes de data (sin el '\0') */
+    unsigned      nopts;                  /* OACK: opciones */
+    const char *  name[PARSE_MAX_OPTS];   /* OACK: nombre de cada opcion */
+    const char *  value[PARSE_MAX_OPTS];  /* OACK: valor de cada opcion */
+
+} tftp_msg_t;
+
+int parse_msg ( const u_char *buf, size_t len, size_t max_data,
+                tftp_msg_t *msg );
+
+#endif
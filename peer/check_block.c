@@ -0,0 +1,84 @@
+/*  check_block
+    Comprueba BLOCK_WIRE y BLOCK_UNWRAP (tftp.h) alrededor de la vuelta de
+    65535 a 0, tal como los usan rrq_data (base = el bloque esperado) y
+    wrq_ack (base = el ultimo bloque confirmado), con todos los numeros de
+    16 bits que pueden llegar.
+
+    uso: check_block
+*/
+
+#include <assert.h>
+
+#include "../tftp.h"
+
+/*  Bases a cada lado de la primera y la tercera vuelta, y el principio */
+
+static const uint64_t centers[] = { 0, 65536, 3 * 65536 };
+
+#define SPAN 70
+
+/*  check_data
+    rrq_data con blknum escritos: un bloque adelantado hasta MAX_WINDOWSIZE
+    se reconoce y un duplicado de hasta window bloques atras cae mas alla
+    de la ventana
+*/
+
+static void check_data ( uint64_t blknum ) {
+    uint64_t block;
+    uint32_t k;
+
+    for ( k = 1; k <= MAX_WINDOWSIZE; k++ ) {
+        block = BLOCK_UNWRAP ( blknum + 1, BLOCK_WIRE ( blknum + k ) );
+        assert ( block == blknum + k );
+    }
+
+    for ( k = 0; k < 64 && k <= blknum; k++ ) {
+        block = BLOCK_UNWRAP ( blknum + 1, BLOCK_WIRE ( blknum - k ) );
+        assert ( block - blknum > 65535 - 64 );
+    }
+}
+
+/*  check_ack
+    wrq_ack con base confirmado: cualquier ACK de base a base + 65535 sale
+    con su numero logico, y uno viejo cae en o detras de next
+*/
+
+static void check_ack ( uint64_t base ) {
+    uint64_t acked;
+    uint32_t k;
+
+    for ( k = 0; k <= 65535; k++ ) {
+        acked = BLOCK_UNWRAP ( base, BLOCK_WIRE ( base + k ) );
+        assert ( acked == base + k );
+    }
+
+    if ( base > 0 ) {
+        acked = BLOCK_UNWRAP ( base, BLOCK_WIRE ( base - 1 ) );
+        assert ( acked == base + 65535 );
+    }
+}
+
+int main ( void ) {
+    uint64_t center, block;
+    unsigned i, n = 0;
+
+    assert ( BLOCK_WIRE ( 65535 ) == 65535 );
+    assert ( BLOCK_WIRE ( 65536 ) == 0 );
+    assert ( BLOCK_WIRE ( 65537 ) == 1 );
+    assert ( BLOCK_UNWRAP ( 65535, 0 ) == 65536 );
+    assert ( BLOCK_UNWRAP ( 65536, 65535 ) == 65536 + 65535 );
+
+    for ( i = 0; i < sizeof ( centers ) / sizeof ( centers[0] ); i++ ) {
+        center = centers[i];
+        block  = center > SPAN ? center - SPAN : 0;
+
+        for ( ; block <= center + SPAN; block++, n++ ) {
+            check_data ( block );
+            check_ack ( block );
+        }
+    }
+
+    printf ( "block: %u bases ok\n", n );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,546 @@
+/*  peer
+    Servidor TFTP minimo para probar el cliente contra un par que pierde,
+    duplica y desordena DATA. Atiende las peticiones de una en una en
+    127.0.0.1, negocia blksize, windowsize y tsize, y cuenta los bloques con
+    64 bits, asi pasa por la vuelta de 65535 a 0. Los RRQ salen de root y
+    los WRQ se guardan en root/nombre.up. El desorden sale de un generador
+    con semilla fija, la misma ejecucion da siempre la misma secuencia.
+
+    uso: peer [-d pct] [-u pct] [-r pct] [-s semilla] puerto root
+
+    -d  porcentaje de DATA que se pierden
+    -u  porcentaje de DATA que llegan dos veces
+    -r  porcentaje de DATA que llegan detras del siguiente
+
+    En un RRQ se estropean los DATA que envia y en un WRQ los que recibe.
+*/
+
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdbool.h>
+
+#include "../tftp.h"
+
+#define PEER_TIMEOUT_MS 200 /* reenvio */
+#define PEER_TRIES 50       /* timeouts seguidos antes de abandonar */
+#define PEER_WINDOW 64      /* mas ventana no cabe en el buffer del socket */
+
+typedef struct peer {
+    unsigned drop, dup, swap; /* porcentajes de -d, -u y -r */
+    unsigned seed;            /* estado del generador */
+    const char *root;
+
+    int      fd;        /* socket de la transferencia, conectado */
+    uint16_t blksize;   /* negociado */
+    uint16_t window;    /* negociado */
+    bool     oack;      /* se contesto con OACK */
+    u_char   oack_buf[BUFSIZE];
+    size_t   oack_len;
+
+    u_char held[4 + MAX_BLKSIZE]; /* DATA retrasado por el desorden */
+    size_t held_len;              /* 0 = ninguno */
+} peer_t;
+
+static u_char pkt[4 + MAX_BLKSIZE];
+
+/*  chance
+    true con una probabilidad de pct por ciento
+*/
+
+static bool chance ( peer_t *peer, unsigned pct ) {
+    return pct > 0 && ( unsigned ) rand_r ( &peer->seed ) % 100 < pct;
+}
+
+static void put16 ( u_char *p, uint16_t value ) {
+    p[0] = ( value >> 8 ) & 0xff;
+    p[1] = value & 0xff;
+}
+
+static uint16_t get16 ( const u_char *p ) {
+    return ( uint16_t ) ( p[0] << 8 | p[1] );
+}
+
+/*  unwrap
+    Bloque logico con esos 16 bits, el primero desde base
+*/
+
+static uint64_t unwrap ( uint64_t base, uint16_t wire ) {
+    return base + ( uint16_t ) ( wire - ( uint16_t ) base );
+}
+
+static void send_error ( int fd, uint16_t code, const char *text ) {
+    u_char buf[128];
+    size_t len = strlen ( text ) + 1;
+
+    put16 ( buf, OPCODE_ERROR );
+    put16 ( buf + 2, code );
+    memcpy ( buf + 4, text, len );
+    send ( fd, buf, 4 + len, 0 );
+}
+
+static void send_ack ( peer_t *peer, uint64_t block ) {
+    u_char buf[4];
+
+    /*  Antes del primer DATA el OACK hace las veces del ACK 0 */
+
+    if ( block == 0 && peer->oack ) {
+        send ( peer->fd, peer->oack_buf, peer->oack_len, 0 );
+        return;
+    }
+
+    put16 ( buf, OPCODE_ACK );
+    put16 ( buf + 2, ( uint16_t ) block );
+    send ( peer->fd, buf, sizeof ( buf ), 0 );
+}
+
+/*  wait_msg
+    Espera un msg del cliente hasta timeout ms. Devuelve su tamaño, 0 si
+    vencio el timeout o -1 si el cliente mando un ERROR
+*/
+
+static ssize_t wait_msg ( peer_t *peer, int timeout ) {
+    struct pollfd pfd = { .fd = peer->fd, .events = POLLIN };
+    ssize_t       received;
+
+    if ( poll ( &pfd, 1, timeout ) <= 0 )
+        return 0;
+
+    if ( ( received = recv ( peer->fd, pkt, sizeof ( pkt ), 0 ) ) < 4 )
+        return 0;
+
+    return get16 ( pkt ) == OPCODE_ERROR ? -1 : received;
+}
+
+/*  add_opt
+    Añade al OACK una opcion y su valor
+*/
+
+static void add_opt ( peer_t *peer, const char *name, uint64_t value ) {
+    peer->oack_len += snprintf ( ( char * ) peer->oack_buf + peer->oack_len,
+                                 sizeof ( peer->oack_buf ) - peer->oack_len,
+                                 "%s", name ) + 1;
+    peer->oack_len += snprintf ( ( char * ) peer->oack_buf + peer->oack_len,
+                                 sizeof ( peer->oack_buf ) - peer->oack_len,
+                                 "%llu", ( unsigned long long ) value ) + 1;
+}
+
+/*  negotiate
+    Lee las opciones de la peticion (desde p hasta end) y prepara el OACK.
+    tsize es el tamaño del archivo en un RRQ, en un WRQ se devuelve el
+    pedido
+*/
+
+static void negotiate ( peer_t *peer, const char *p, const char *end,
+                        int64_t tsize ) {
+    const char *name, *value;
+    long        n;
+
+    peer->blksize  = BUFSIZE;
+    peer->window   = 1;
+    peer->oack_len = 2;
+    put16 ( peer->oack_buf, OPCODE_OACK );
+
+    while ( p < end ) {
+        name = p;
+        p += strnlen ( p, end - p ) + 1;
+
+        if ( p >= end )
+            break;
+
+        value = p;
+        p += strnlen ( p, end - p ) + 1;
+        n = atol ( value );
+
+        if ( strcasecmp ( name, OPT_BLKSIZE ) == 0 ) {
+            n             = n < MIN_BLKSIZE ? MIN_BLKSIZE : n;
+            peer->blksize = n > MAX_BLKSIZE ? MAX_BLKSIZE : n;
+            add_opt ( peer, OPT_BLKSIZE, peer->blksize );
+
+        } else if ( strcasecmp ( name, OPT_WINDOWSIZE ) == 0 ) {
+            n            = n < 1 ? 1 : n;
+            peer->window = n > PEER_WINDOW ? PEER_WINDOW : n;
+            add_opt ( peer, OPT_WINDOWSIZE, peer->window );
+
+        } else if ( strcasecmp ( name, OPT_TSIZE ) == 0 )
+            add_opt ( peer, OPT_TSIZE, tsize >= 0 ? tsize : n );
+    }
+
+    peer->oack = peer->oack_len > 2;
+}
+
+/*  send_data
+    Envia el DATA de block, o lo pierde, lo duplica o lo retrasa hasta el
+    siguiente
+*/
+
+static void send_data ( peer_t *peer, const u_char *file, size_t size,
+                        uint64_t block ) {
+    size_t  offset = ( block - 1 ) * peer->blksize;
+    size_t  len    = offset < size ? size - offset : 0;
+    u_char *buf    = pkt;
+
+    len = len > peer->blksize ? peer->blksize : len;
+
+    if ( chance ( peer, peer->drop ) )
+        return;
+
+    if ( peer->held_len == 0 && chance ( peer, peer->swap ) )
+        buf = peer->held;
+
+    put16 ( buf, OPCODE_DATA );
+    put16 ( buf + 2, ( uint16_t ) block );
+    memcpy ( buf + 4, file + offset, len );
+
+    if ( buf == peer->held ) {
+        peer->held_len = 4 + len;
+        return;
+    }
+
+    send ( peer->fd, buf, 4 + len, 0 );
+
+    if ( chance ( peer, peer->dup ) )
+        send ( peer->fd, buf, 4 + len, 0 );
+
+    if ( peer->held_len > 0 ) {
+        send ( peer->fd, peer->held, peer->held_len, 0 );
+        peer->held_len = 0;
+    }
+}
+
+/*  serve_rrq
+    Envia el archivo ventana a ventana. base es el primer bloque sin
+    confirmar; un ACK movera base y sin ACK se reenvia desde base
+*/
+
+static bool serve_rrq ( peer_t *peer, const u_char *file, size_t size ) {
+    uint64_t last = size / peer->blksize + 1;
+    uint64_t base = 1, acked, block;
+    unsigned tries = 0;
+    ssize_t  received;
+
+    /*  Con OACK hay que esperar al ACK 0 */
+
+    if ( peer->oack ) {
+        for ( ;; ) {
+            send_ack ( peer, 0 );
+
+            if ( ( received = wait_msg ( peer, PEER_TIMEOUT_MS ) ) < 0 )
+                return false;
+
+            if ( received > 0 && get16 ( pkt ) == OPCODE_ACK
+                 && get16 ( pkt + 2 ) == 0 )
+                break;
+
+            if ( received == 0 && ++tries == PEER_TRIES )
+                return false;
+        }
+    }
+
+    tries = 0;
+
+    while ( base <= last ) {
+        for ( block = base; block < base + peer->window && block <= last;
+              block++ )
+            send_data ( peer, file, size, block );
+
+        if ( peer->held_len > 0 ) {
+            send ( peer->fd, peer->held, peer->held_len, 0 );
+            peer->held_len = 0;
+        }
+
+        /*  Espera un ACK que avance; los viejos se ignoran */
+
+        for ( ;; ) {
+            if ( ( received = wait_msg ( peer, PEER_TIMEOUT_MS ) ) < 0 )
+                return false;
+
+            if ( received == 0 ) {
+                if ( ++tries == PEER_TRIES )
+                    return false;
+                break;
+            }
+
+            if ( get16 ( pkt ) != OPCODE_ACK )
+                continue;
+
+            acked = unwrap ( base - 1, get16 ( pkt + 2 ) );
+
+            if ( acked < base || acked >= block )
+                continue;
+
+            tries = 0;
+            base  = acked + 1;
+            break;
+        }
+    }
+
+    return true;
+}
+
+/*  take_data
+    Procesa un DATA del WRQ. Devuelve true cuando llega el ultimo
+*/
+
+static bool take_data ( peer_t *peer, int out, const u_char *buf, size_t len,
+                        uint64_t *expected, unsigned *count, bool *gap ) {
+    uint64_t block = unwrap ( *expected, get16 ( buf + 2 ) );
+
+    /*  Uno adelantado (falta alguno) o repetido: se confirma lo que hay una
+        vez por hueco y el cliente reenvia desde ahi */
+
+    if ( block != *expected ) {
+        if ( !*gap && block - *expected < peer->window ) {
+            send_ack ( peer, *expected - 1 );
+            *gap   = true;
+            *count = 0;
+        }
+
+        return false;
+    }
+
+    if ( write ( out, buf + 4, len - 4 ) != ( ssize_t ) ( len - 4 ) )
+        return true;
+
+    *gap = false;
+    ( *expected )++;
+
+    if ( len - 4 < peer->blksize )
+        return true;
+
+    if ( ++*count == peer->window ) {
+        send_ack ( peer, *expected - 1 );
+        *count = 0;
+    }
+
+    return false;
+}
+
+/*  serve_wrq
+    Recibe el archivo en out. Cada ventana completa se confirma; sin DATA
+    se vuelve a confirmar el ultimo bloque recibido
+*/
+
+static bool serve_wrq ( peer_t *peer, int out ) {
+    static u_char later[4 + MAX_BLKSIZE];
+    uint64_t      expected = 1;
+    unsigned      count = 0, tries = 0;
+    bool          gap = false, done = false;
+    size_t        later_len = 0;
+    ssize_t       received;
+
+    send_ack ( peer, 0 );
+
+    while ( !done ) {
+        if ( ( received = wait_msg ( peer, PEER_TIMEOUT_MS ) ) < 0 )
+            return false;
+
+        if ( received == 0 ) {
+            /*  Sin nada detras, el retrasado llega ahora */
+
+            if ( later_len > 0 ) {
+                done = take_data ( peer, out, later, later_len, &expected,
+                                   &count, &gap );
+                later_len = 0;
+                continue;
+            }
+
+            if ( ++tries == PEER_TRIES )
+                return false;
+
+            send_ack ( peer, expected - 1 );
+            count = 0;
+            continue;
+        }
+
+        if ( get16 ( pkt ) != OPCODE_DATA )
+            continue;
+
+        tries = 0;
+
+        if ( chance ( peer, peer->drop ) )
+            continue;
+
+        if ( later_len == 0 && chance ( peer, peer->swap ) ) {
+            memcpy ( later, pkt, received );
+            later_len = received;
+            continue;
+        }
+
+        done = take_data ( peer, out, pkt, received, &expected, &count, &gap );
+
+        if ( !done && chance ( peer, peer->dup ) )
+            done = take_data ( peer, out, pkt, received, &expected, &count,
+                               &gap );
+
+        if ( !done && later_len > 0 ) {
+            done = take_data ( peer, out, later, later_len, &expected, &count,
+                               &gap );
+            later_len = 0;
+        }
+    }
+
+    send_ack ( peer, expected - 1 );
+
+    return true;
+}
+
+/*  load
+    Lee el archivo entero; devuelve su tamaño o -1
+*/
+
+static ssize_t load ( const char *path, u_char **file ) {
+    struct stat st;
+    ssize_t     done = 0, n;
+    int         fd;
+
+    if ( ( fd = open ( path, O_RDONLY ) ) == -1 )
+        return -1;
+
+    if ( fstat ( fd, &st ) == -1
+         || ( *file = malloc ( st.st_size + 1 ) ) == NULL ) {
+        close ( fd );
+        return -1;
+    }
+
+    while ( done < st.st_size
+            && ( n = read ( fd, *file + done, st.st_size - done ) ) > 0 )
+        done += n;
+
+    close ( fd );
+
+    return done;
+}
+
+/*  serve
+    Atiende una peticion desde un socket nuevo (el TID del servidor)
+*/
+
+static void serve ( peer_t *peer, const u_char *req, size_t len,
+                    struct sockaddr_in *client ) {
+    struct sockaddr_in local = { .sin_family = AF_INET };
+    const char *       end   = ( const char * ) req + len;
+    const char *       name  = ( const char * ) req + 2;
+    const char *       mode;
+    char               path[PATH_MAX];
+    uint16_t           opcode = get16 ( req );
+    u_char *           file   = NULL;
+    ssize_t            size;
+    bool               ok = false;
+    int                out;
+
+    local.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+
+    if ( ( peer->fd = socket ( AF_INET, SOCK_DGRAM, 0 ) ) == -1 )
+        return;
+
+    if ( bind ( peer->fd, ( struct sockaddr * ) &local, sizeof ( local ) ) == -1
+         || connect ( peer->fd, ( struct sockaddr * ) client,
+                      sizeof ( *client ) ) == -1 ) {
+        close ( peer->fd );
+        return;
+    }
+
+    mode = name + strnlen ( name, end - name ) + 1;
+
+    if ( mode >= end || strchr ( name, '/' ) != NULL ) {
+        send_error ( peer->fd, ERR_ILLEGAL_OP, "Bad request" );
+        close ( peer->fd );
+        return;
+    }
+
+    peer->held_len = 0;
+
+    if ( opcode == OPCODE_RRQ ) {
+        snprintf ( path, sizeof ( path ), "%s/%s", peer->root, name );
+
+        if ( ( size = load ( path, &file ) ) == -1 )
+            send_error ( peer->fd, ERR_NOT_FOUND, "File not found" );
+
+        else {
+            negotiate ( peer, mode + strnlen ( mode, end - mode ) + 1, end,
+                        size );
+            ok = serve_rrq ( peer, file, size );
+        }
+
+        free ( file );
+
+    } else {
+        snprintf ( path, sizeof ( path ), "%s/%s.up", peer->root, name );
+
+        if ( ( out = open ( path, O_WRONLY | O_CREAT | O_TRUNC, 0644 ) ) == -1 )
+            send_error ( peer->fd, ERR_ACCESS_DENIED, "Cannot create" );
+
+        else {
+            negotiate ( peer, mode + strnlen ( mode, end - mode ) + 1, end,
+                        -1 );
+            ok = serve_wrq ( peer, out );
+            close ( out );
+        }
+    }
+
+    fprintf ( stderr, "peer: %s %s %s\n", opcode == OPCODE_RRQ ? "get" : "put",
+              name, ok ? "ok" : "failed" );
+
+    close ( peer->fd );
+}
+
+int main ( int argc, char **argv ) {
+    static u_char      req[BUFSIZE];
+    struct sockaddr_in addr = { .sin_family = AF_INET };
+    peer_t             peer = { .seed = 1 };
+    socklen_t          size;
+    ssize_t            received;
+    int                opt, fd;
+
+    while ( ( opt = getopt ( argc, argv, "d:u:r:s:" ) ) != -1 ) {
+        switch ( opt ) {
+        case 'd':
+            peer.drop = atoi ( optarg );
+            break;
+        case 'u':
+            peer.dup = atoi ( optarg );
+            break;
+        case 'r':
+            peer.swap = atoi ( optarg );
+            break;
+        case 's':
+            peer.seed = atoi ( optarg );
+            break;
+        default:
+            fprintf ( stderr, "uso: peer [-d pct] [-u pct] [-r pct] "
+                              "[-s semilla] puerto root\n" );
+            return EXIT_FAILURE;
+        }
+    }
+
+    if ( argc - optind != 2 ) {
+        fprintf ( stderr, "uso: peer [-d pct] [-u pct] [-r pct] [-s semilla] "
+                          "puerto root\n" );
+        return EXIT_FAILURE;
+    }
+
+    peer.root            = argv[optind + 1];
+    addr.sin_port        = htons ( atoi ( argv[optind] ) );
+    addr.sin_addr.s_addr = htonl ( INADDR_LOOPBACK );
+
+    if ( ( fd = socket ( AF_INET, SOCK_DGRAM, 0 ) ) == -1
+         || bind ( fd, ( struct sockaddr * ) &addr, sizeof ( addr ) ) == -1 ) {
+        perror ( "peer" );
+        return EXIT_FAILURE;
+    }
+
+    for ( ;; ) {
+        size = sizeof ( addr );
+
+        if ( ( received = recvfrom ( fd, req, sizeof ( req ) - 1, 0,
+                                     ( struct sockaddr * ) &addr, &size ) )
+             < 4 )
+            continue;
+
+        req[received] = '\0';
+
+        if ( get16 ( req ) == OPCODE_RRQ || get16 ( req ) == OPCODE_WRQ )
+            serve ( &peer, req, received, &addr );
+    }
+}
@@ -0,0 +1,73 @@
+#!/bin/sh
+#  run.sh
+#  Baja y sube archivos con ./client contra peer/peer en 127.0.0.1 y
+#  compara byte a byte lo que llega. Con blksize 8 un archivo de mas de
+#  65536 bloques cruza la vuelta del numero de bloque en los dos sentidos;
+#  despues peer pierde, duplica y desordena DATA (los que envia en un RRQ y
+#  los que recibe en un WRQ), con y sin ventana.
+#
+#  uso: peer/run.sh [puerto]
+
+PORT=${1:-7069}
+DIR=$(mktemp -d)
+PID=
+FAILED=0
+
+trap 'test -n "$PID" && kill $PID; rm -rf "$DIR"' EXIT
+
+#  start opciones: arranca peer con ese desorden
+
+start () {
+    test -n "$PID" && kill $PID && wait $PID 2>/dev/null
+    ./peer/peer "$@" $PORT "$DIR" 2>/dev/null &
+    PID=$!
+    sleep 0.2
+}
+
+#  check nombre opciones: baja y sube nombre con esas opciones del cliente
+
+check () {
+    name=$1
+    shift
+
+    rm -f "$DIR/out" "$DIR/$name.up"
+
+    timeout 120 ./client "$@" -g $name -o "$DIR/out" 127.0.0.1 $PORT \
+        >"$DIR/get.log" 2>&1 && cmp -s "$DIR/$name" "$DIR/out"
+    get=$?
+
+    timeout 120 ./client "$@" -p - -o $name 127.0.0.1 $PORT \
+        <"$DIR/$name" >"$DIR/put.log" 2>&1 && cmp -s "$DIR/$name" "$DIR/$name.up"
+    put=$?
+
+    if [ $get -eq 0 ] && [ $put -eq 0 ]; then
+        echo "ok      $name $*"
+    else
+        echo "FAILED  $name $* (get $get, put $put)"
+        tail -n 3 "$DIR/get.log" "$DIR/put.log"
+        FAILED=1
+    fi
+}
+
+head -c 560003 /dev/urandom >"$DIR/wrap.bin"
+head -c 100000 /dev/urandom >"$DIR/data.bin"
+head -c 8192 /dev/urandom >"$DIR/exact.bin"
+
+./peer/check_block || exit 1
+
+start
+check wrap.bin -b 8
+check wrap.bin -b 8 -w 16
+
+for impair in "-d 5" "-u 10" "-r 10" "-d 3 -u 5 -r 5"; do
+    start $impair
+    echo "peer $impair"
+
+    for name in data.bin exact.bin; do
+        check $name
+        check $name -w 8
+        check $name -b 1024 -w 16
+    done
+done
+
+exit $FAILED
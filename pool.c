@@ -0,0 +1,176 @@
+#include "pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Cabecera de cada buffer, ocupa 16 bytes para no romper la alineacion */
+
+typedef struct pool_hdr {
+    uint32_t refs; /* referencias vivas */
+    uint32_t cls;  /* clase de tamaño */
+    uint64_t pad;
+
+} pool_hdr_t;
+
+/* Listas de buffers libres por clase, enlazadas a traves de los datos */
+
+static void *   pool_free[POOL_CLASSES];
+static unsigned pool_cached[POOL_CLASSES];
+
+static unsigned pool_class ( size_t size ) {
+    unsigned cls = 0;
+
+    while ( ( ( size_t ) 1 << ( cls + POOL_MIN_SHIFT ) ) < size )
+        cls++;
+
+    return cls;
+}
+
+/*  pool_get
+    Entrega un buffer de al menos size bytes con una referencia. Devuelve NULL
+    si size supera la clase mas grande o no hay memoria.
+*/
+
+void *pool_get ( size_t size ) {
+    pool_hdr_t *hdr;
+    unsigned    cls;
+
+    if ( size > ( ( size_t ) 1 << POOL_MAX_SHIFT ) )
+        return NULL;
+
+    cls = pool_class ( size );
+
+    if ( pool_free[cls] != NULL ) {
+        hdr            = pool_free[cls];
+        pool_free[cls] = *( void ** ) ( hdr + 1 );
+        pool_cached[cls]--;
+
+    } else {
+        hdr = malloc ( sizeof ( pool_hdr_t )
+                       + ( ( size_t ) 1 << ( cls + POOL_MIN_SHIFT ) ) );
+
+        if ( hdr == NULL )
+            return NULL;
+
+        hdr->cls = cls;
+    }
+
+    hdr->refs = 1;
+    return hdr + 1;
+}
+
+/*  pool_ref
+    Añade una referencia al buffer, se usa al compartirlo entre etapas
+*/
+
+void *pool_ref ( void *buf ) {
+    ( ( pool_hdr_t * ) buf - 1 )->refs++;
+    return buf;
+}
+
+/*  pool_put
+    Suelta una referencia. Con la ultima, el buffer vuelve a su clase (o se
+    libera si la clase ya tiene POOL_CACHE buffers guardados)
+*/
+
+void pool_put ( void *buf ) {
+    pool_hdr_t *hdr;
+
+    if ( buf == NULL )
+        return;
+
+    hdr = ( pool_hdr_t * ) buf - 1;
+
+    if ( --hdr->refs > 0 )
+        return;
+
+    if ( pool_cached[hdr->cls] >= POOL_CACHE ) {
+        free ( hdr );
+        return;
+    }
+
+    *( void ** ) buf    = pool_free[hdr->cls];
+    pool_free[hdr->cls] = hdr;
+    pool_cached[hdr->cls]++;
+}
+
+/*  pool_size
+    Capacidad real del buffer (la de su clase)
+*/
+
+size_t pool_size ( const void *buf ) {
+    return ( size_t ) 1 << ( ( ( const pool_hdr_t * ) buf - 1 )->cls
+                             + POOL_MIN_SHIFT );
+}
+
+void slab_init ( tftp_slab_t *slab, size_t size, size_t per_page ) {
+    /* Cada objeto libre guarda el siguiente, y cada pagina la anterior */
+
+    if ( size < sizeof ( void * ) )
+        size = sizeof ( void * );
+
+    slab->size     = ( size + 15 ) & ~( size_t ) 15;
+    slab->per_page = per_page;
+    slab->used     = 0;
+    slab->free     = NULL;
+    slab->pages    = NULL;
+}
+
+/*  slab_alloc
+    Entrega un objeto a cero. Cuando no quedan libres se reserva una pagina
+    entera de per_page objetos de una sola vez.
+*/
+
+void *slab_alloc ( tftp_slab_t *slab ) {
+    char * page;
+    void * obj;
+    size_t i;
+
+    if ( slab->free == NULL ) {
+        page = malloc ( 16 + slab->size * slab->per_page );
+
+        if ( page == NULL )
+            return NULL;
+
+        *( void ** ) page = slab->pages;
+        slab->pages       = page;
+
+        for ( i = 0; i < slab->per_page; i++ ) {
+            obj              = page + 16 + i * slab->size;
+            *( void ** ) obj = slab->free;
+            slab->free       = obj;
+        }
+    }
+
+    obj        = slab->free;
+    slab->free = *( void ** ) obj;
+    slab->used++;
+
+    memset ( obj, 0, slab->size );
+    return obj;
+}
+
+void slab_free ( tftp_slab_t *slab, void *obj ) {
+    if ( obj == NULL )
+        return;
+
+    *( void ** ) obj = slab->free;
+    slab->free       = obj;
+    slab->used--;
+}
+
+/*  slab_destroy
+    Libera todas las paginas, los objetos entregados dejan de ser validos
+*/
+
+void slab_destroy ( tftp_slab_t *slab ) {
+    void *page;
+
+    while ( ( page = slab->pages ) != NULL ) {
+        slab->pages = *( void ** ) page;
+        free ( page );
+    }
+
+    slab->free = NULL;
+    slab->used = 0;
+}
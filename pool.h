@@ -0,0 +1,45 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POOL_MIN_SHIFT 6  /* clase mas pequeña: 64 bytes */
+#define POOL_MAX_SHIFT 17 /* clase mas grande: 128 KiB (blksize 65464 + 4) */
+#define POOL_CLASSES ( POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1 )
+#define POOL_CACHE 256    /* buffers libres retenidos por clase */
+
+#define SLAB_PER_PAGE 64  /* objetos por pagina del slab */
+
+/*  Buffers con contador de referencias, agrupados en clases de potencias de
+    dos. Un buffer vuelve a su clase cuando se suelta la ultima referencia, asi
+    la memoria de una sesion depende del blksize negociado y no del maximo */
+
+void *pool_get ( size_t size );
+
+void *pool_ref ( void *buf );
+
+void pool_put ( void *buf );
+
+size_t pool_size ( const void *buf );
+
+/* Slab de objetos de tamaño fijo, se reservan por paginas y no se devuelven */
+
+typedef struct tftp_slab {
+    size_t size;     /* tamaño de cada objeto */
+    size_t per_page; /* objetos por pagina */
+    size_t used;     /* objetos entregados */
+    void * free;     /* lista de objetos libres */
+    void * pages;    /* lista de paginas reservadas */
+
+} tftp_slab_t;
+
+void slab_init ( tftp_slab_t *slab, size_t size, size_t per_page );
+
+void *slab_alloc ( tftp_slab_t *slab );
+
+void slab_free ( tftp_slab_t *slab, void *obj );
+
+void slab_destroy ( tftp_slab_t *slab );
+
+#endif
@@ -0,0 +1,473 @@
+#include "race.h"
+
+#include <netdb.h>
+
+static void race_launch ( tftp_race_t *race );
+
+/*  resolve_host
+    Resuelve host y puerto (nombres o direcciones de cualquier familia) y
+    deja en addr/size hasta max direcciones alternando familias, empezando
+    por la que getaddrinfo pone primero (RFC 6724)
+
+    Devuelve cuantas, o -1 con errno si no hay ninguna direccion
+*/
+
+static int resolve_host ( const char *host, const char *port,
+                          struct sockaddr_storage *addr, socklen_t *size,
+                          unsigned max ) {
+    struct addrinfo  hints = { 0 };
+    struct addrinfo *list, *ai;
+    struct addrinfo *by[2][RACE_MAX];
+    unsigned         count[2] = { 0, 0 };
+    unsigned         taken[2] = { 0, 0 };
+    unsigned         n        = 0;
+    int              first, f, error;
+
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_protocol = IPPROTO_UDP;
+
+    error = getaddrinfo ( host, port, &hints, &list );
+
+    if ( error != 0 ) {
+        syslog ( LOG_ERR, "Error resolving %s: %s", host, gai_strerror ( error ) );
+        errno = error == EAI_SYSTEM ? errno : EADDRNOTAVAIL;
+        return -1;
+    }
+
+    first = list->ai_family == AF_INET6 ? 0 : 1;
+
+    for ( ai = list; ai != NULL; ai = ai->ai_next ) {
+        f = ai->ai_family == AF_INET6 ? 0 : ai->ai_family == AF_INET ? 1 : -1;
+
+        if ( f != -1 && count[f] < RACE_MAX )
+            by[f][count[f]++] = ai;
+    }
+
+    /* Intercalamos: una de la familia preferida, una de la otra, ... */
+
+    f = first;
+
+    while ( n < max && ( taken[0] < count[0] || taken[1] < count[1] ) ) {
+        if ( taken[f] < count[f] ) {
+            ai = by[f][taken[f]++];
+            memcpy ( &addr[n], ai->ai_addr, ai->ai_addrlen );
+            size[n++] = ai->ai_addrlen;
+        }
+
+        f = !f;
+    }
+
+    freeaddrinfo ( list );
+
+    if ( n == 0 ) {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+
+    return n;
+}
+
+/*  race_resolve
+    Resuelve la lista de espejos separados por comas, cada uno "host",
+    "host:puerto" o "[ipv6]:puerto" (sin puerto se usa port). Las direcciones
+    quedan repartidas por turnos: la primera de cada espejo, luego la
+    segunda... asi las primeras naddr / nhosts cubren a todos. Un espejo que
+    no se resuelve se salta.
+
+    Devuelve 0, o -1 con errno si no hay ninguna direccion
+*/
+
+int race_resolve ( tftp_race_t *race, const char *hosts, const char *port ) {
+    static struct sockaddr_storage addr[RACE_HOSTS][RACE_MAX];
+    static socklen_t               size[RACE_HOSTS][RACE_MAX];
+    int                            count[RACE_HOSTS];
+    char                           list[NAMESIZE + 1];
+    char *                         item, *save, *colon, *host, *at;
+    unsigned                       h, k;
+    size_t                         used = 0, len;
+    bool                           more;
+    int                            error = EADDRNOTAVAIL;
+
+    if ( strlen ( hosts ) > NAMESIZE ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    strcpy ( list, hosts );
+    race->nhosts = 0;
+
+    for ( item = strtok_r ( list, ",", &save );
+          item != NULL && race->nhosts < RACE_HOSTS;
+          item = strtok_r ( NULL, ",", &save ) ) {
+        host = item;
+        at   = ( char * ) port;
+
+        if ( *item == '[' && ( colon = strstr ( item, "]:" ) ) != NULL ) {
+            *colon = '\0';
+            host   = item + 1;
+            at     = colon + 2;
+
+        } else if ( *item == '[' && item[strlen ( item ) - 1] == ']' ) {
+            item[strlen ( item ) - 1] = '\0';
+            host                      = item + 1;
+
+        } else if ( ( colon = strchr ( item, ':' ) ) != NULL
+                    && strchr ( colon + 1, ':' ) == NULL ) {
+            *colon = '\0';
+            at     = colon + 1;
+        }
+
+        /* El nombre como se escribio, para el marcador (score.h) */
+
+        h             = race->nhosts;
+        len           = strcspn ( hosts + ( item - list ), "," );
+        race->name[h] = race->names + used;
+        memcpy ( race->names + used, hosts + ( item - list ), len );
+        race->names[used + len] = '\0';
+
+        count[h] = resolve_host ( host, at, addr[h], size[h], RACE_MAX );
+
+        if ( count[h] == -1 )
+            error = errno;
+        else {
+            used += len + 1;
+            race->nhosts++;
+        }
+    }
+
+    /* Por turnos entre los espejos */
+
+    race->naddr = 0;
+
+    for ( k = 0, more = true; more && race->naddr < RACE_MAX; k++ ) {
+        more = false;
+
+        for ( h = 0; h < race->nhosts && race->naddr < RACE_MAX; h++ ) {
+            if ( ( int ) k >= count[h] )
+                continue;
+
+            race->addr[race->naddr] = addr[h][k];
+            race->size[race->naddr] = size[h][k];
+            race->host[race->naddr] = h;
+            race->naddr++;
+            more = true;
+        }
+    }
+
+    memset ( race->down, 0, sizeof ( race->down ) );
+
+    if ( race->naddr == 0 ) {
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*  race_recv
+    Primera respuesta de un intento: gana, se cancelan los demas y el resto
+    de la transferencia va directamente a su handler. Un ERROR no gana (el
+    archivo puede estar en otro espejo): falla solo ese intento y la carrera
+    sigue con los demas; tampoco gana un msg mal formado (parse_msg), que el
+    handler ignora. Los cancelados (session_cancel) no cuentan como
+    fallidos; al servidor que ya les respondio, o que lo haga en el rto que
+    su socket sigue abierto, le mandan un ERROR 0 (session_cancel).
+*/
+
+static void race_recv ( tftp_t *instance, ssize_t received ) {
+    tftp_race_t *race = instance->race;
+    tftp_msg_t   msg;
+    unsigned     i;
+
+    if ( race->winner == NULL
+         && parse_msg ( instance->buf, received, MAX_BLKSIZE, &msg ) == 0
+         && msg.opcode != OPCODE_ERROR ) {
+        race->winner = instance;
+        timer_cancel ( &race->loop->wheel, &race->timer );
+
+        for ( i = 0; i < race->next; i++ )
+            if ( race->attempt[i] != NULL && race->attempt[i] != instance
+                 && !race->attempt[i]->done )
+                session_cancel ( race->attempt[i] );
+    }
+
+    instance->recv = race->recv;
+    instance->recv ( instance, received );
+}
+
+/*  race_check
+    Avisa a done cuando ya no queda nada en curso: termino el ganador, o sin
+    ganador fallaron todos los intentos
+*/
+
+static void race_check ( tftp_race_t *race ) {
+    unsigned i;
+
+    if ( race->over || race->done == NULL )
+        return;
+
+    if ( race->winner != NULL ) {
+        if ( !race->winner->done )
+            return;
+
+    } else {
+        if ( race->next < race->naddr )
+            return;
+
+        for ( i = 0; i < race->next; i++ )
+            if ( race->attempt[i] != NULL && !race->attempt[i]->done
+                 && !race->attempt[i]->failed )
+                return;
+    }
+
+    race->over = true;
+    race->done ( race );
+}
+
+/*  race_finish
+    Un intento termino. Si fallo sin que nadie haya ganado, se lanza ya el
+    siguiente en lugar de esperar al plazo.
+*/
+
+static void race_finish ( tftp_t *instance ) {
+    tftp_race_t *race = instance->race;
+
+    if ( race->winner == NULL && instance->failed ) {
+        timer_cancel ( &race->loop->wheel, &race->timer );
+        race_launch ( race );
+    }
+
+    race_check ( race );
+}
+
+static void race_expire ( tftp_timer_t *timer ) {
+    tftp_race_t *race = ( tftp_race_t * ) timer;
+
+    if ( race->winner == NULL )
+        race_launch ( race );
+}
+
+/*  race_launch
+    Lanza el intento con la siguiente direccion de un espejo que no este
+    caido. El primero que se lanza es la sesion original, los demas son
+    copias. Si no se puede registrar (una familia sin soporte, por ejemplo)
+    se pasa a la siguiente.
+*/
+
+static void race_launch ( tftp_race_t *race ) {
+    tftp_t * instance;
+    unsigned i;
+
+    while ( race->next < race->naddr ) {
+        i = race->next++;
+
+        if ( race->down[race->host[i]] )
+            continue;
+
+        instance = race->launched == 0 ? race->model : tftp_clone ( race->model );
+
+        if ( instance == NULL )
+            continue;
+
+        memcpy ( &instance->remote_addr, &race->addr[i], race->size[i] );
+        instance->size_remote = race->size[i];
+        instance->race        = race;
+        instance->finish      = race_finish;
+        race->attempt[i]      = instance;
+        race->launched++;
+
+        if ( loop_add ( race->loop, instance ) == -1 ) {
+            syslog ( LOG_WARNING, "Error registering attempt %u: %s", i,
+                     strerror ( errno ) );
+            instance->failed = true;
+            continue;
+        }
+
+        if ( race->parallel && race->next < race->naddr )
+            timer_arm ( &race->loop->wheel, &race->timer,
+                        loop_now_us () / 1000 + RACE_DELAY_MS );
+
+        race->start ( instance );
+
+        if ( !instance->done ) {
+            race->recv     = instance->recv;
+            instance->recv = race_recv;
+        }
+
+        return;
+    }
+}
+
+/*  race_live
+    Espejos que no estan caidos
+*/
+
+static unsigned race_live ( const tftp_race_t *race ) {
+    unsigned h, n = 0;
+
+    for ( h = 0; h < race->nhosts; h++ )
+        n += !race->down[h];
+
+    return n;
+}
+
+/*  race_start
+    Empieza la transferencia de model contra las direcciones resueltas. Con
+    parallel los intentos se solapan (RRQ): sale uno a cada espejo a la vez
+    (o solo probes, ver race_prefer) y las demas direcciones siguen el plazo. Sin el, solo se pasa a la
+    siguiente direccion cuando falla la anterior (WRQ, para no dejar al
+    servidor escribiendo el archivo dos veces). Si race->done esta puesto se
+    le avisa al terminar.
+*/
+
+void race_start ( tftp_race_t *race, tftp_loop_t *loop, tftp_t *model,
+                  void ( *start ) ( tftp_t *instance ), bool parallel ) {
+    unsigned live = !parallel ? 1 : race->probes != 0 ? race->probes
+                                                      : race_live ( race );
+
+    race->loop         = loop;
+    race->model        = model;
+    race->start        = start;
+    race->parallel     = parallel;
+    race->next         = 0;
+    race->launched     = 0;
+    race->winner       = NULL;
+    race->over         = false;
+    race->timer.next   = NULL;
+    race->timer.prev   = NULL;
+    race->timer.expire = race_expire;
+
+    memset ( race->attempt, 0, sizeof ( race->attempt ) );
+
+    /* Las primeras direcciones son una de cada espejo (race_resolve) */
+
+    do
+        race_launch ( race );
+    while ( race->launched < live && race->next < race->naddr
+            && race->winner == NULL );
+
+    race_check ( race );
+}
+
+/*  race_copy
+    Prepara race para probar las mismas direcciones y espejos que server,
+    sin resolver otra vez
+*/
+
+void race_copy ( tftp_race_t *race, const tftp_race_t *server ) {
+    memcpy ( race->addr, server->addr, sizeof ( race->addr ) );
+    memcpy ( race->size, server->size, sizeof ( race->size ) );
+    memcpy ( race->host, server->host, sizeof ( race->host ) );
+    memcpy ( race->down, server->down, sizeof ( race->down ) );
+    race->naddr  = server->naddr;
+    race->nhosts = server->nhosts;
+}
+
+/*  race_prefer
+    Empieza por host: sus direcciones pasan delante, y solo se le lanza a el
+    de entrada; los demas espejos quedan de reserva con el plazo de siempre
+*/
+
+void race_prefer ( tftp_race_t *race, unsigned host ) {
+    struct sockaddr_storage addr[RACE_MAX];
+    socklen_t               size[RACE_MAX];
+    uint8_t                 owner[RACE_MAX];
+    unsigned                i, n = 0, pass;
+
+    for ( pass = 0; pass < 2; pass++ )
+        for ( i = 0; i < race->naddr; i++ )
+            if ( ( race->host[i] == host ) == ( pass == 0 ) ) {
+                addr[n]    = race->addr[i];
+                size[n]    = race->size[i];
+                owner[n++] = race->host[i];
+            }
+
+    memcpy ( race->addr, addr, n * sizeof ( addr[0] ) );
+    memcpy ( race->size, size, n * sizeof ( size[0] ) );
+    memcpy ( race->host, owner, n * sizeof ( owner[0] ) );
+    race->probes = 1;
+}
+
+/*  race_outcome
+    Intento que da el resultado: el ganador; si no hubo, uno al que su
+    servidor respondio con ERROR (dice mas que un timeout); si no, la sesion
+    original
+*/
+
+tftp_t *race_outcome ( tftp_race_t *race ) {
+    unsigned i;
+
+    if ( race->winner != NULL )
+        return race->winner;
+
+    for ( i = 0; i < race->next; i++ )
+        if ( race->attempt[i] != NULL && race->attempt[i]->refused )
+            return race->attempt[i];
+
+    return race->model;
+}
+
+/*  race_host
+    Espejo al que se lanzo instance
+
+    Devuelve su indice, o -1 si no es de esta carrera
+*/
+
+int race_host ( const tftp_race_t *race, const tftp_t *instance ) {
+    unsigned i;
+
+    for ( i = 0; i < race->next; i++ )
+        if ( race->attempt[i] == instance )
+            return race->host[i];
+
+    return -1;
+}
+
+/*  race_failover
+    failed no termino: su espejo queda caido para el siguiente race_start
+
+    Devuelve 0, o -1 si no queda ningun espejo
+*/
+
+int race_failover ( tftp_race_t *race, const tftp_t *failed ) {
+    int host = race_host ( race, failed );
+
+    if ( host != -1 )
+        race->down[host] = true;
+
+    return race_live ( race ) > 0 ? 0 : -1;
+}
+
+/*  race_cancel
+    Cancela todos los intentos (session_cancel) sin lanzar mas. Como al
+    terminar, se avisa a done; race_outcome no tiene nada que dar por bueno.
+*/
+
+void race_cancel ( tftp_race_t *race ) {
+    unsigned launched = race->next;
+    unsigned i;
+
+    timer_cancel ( &race->loop->wheel, &race->timer );
+    race->next = race->naddr;
+
+    for ( i = 0; i < launched; i++ )
+        if ( race->attempt[i] != NULL )
+            session_cancel ( race->attempt[i] );
+
+    race_check ( race );
+}
+
+/*  race_free
+    Libera los intentos clonados; la sesion original es de quien la creo
+*/
+
+void race_free ( tftp_race_t *race ) {
+    unsigned i;
+
+    timer_cancel ( &race->loop->wheel, &race->timer );
+
+    for ( i = 0; i < race->next; i++ )
+        if ( race->attempt[i] != race->model )
+            tftp_free ( race->attempt[i] );
+}
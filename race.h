@@ -0,0 +1,67 @@
+#ifndef RACE_H
+#define RACE_H
+
+#include "loop.h"
+
+#define RACE_DELAY_MS 250 /* espera entre intentos (RFC 8305) */
+#define RACE_MAX 16       /* direcciones que se prueban como mucho */
+#define RACE_HOSTS 8      /* servidores (espejos) de la lista como mucho */
+
+/*  Happy Eyeballs (RFC 8305) para la primera peticion: las direcciones del
+    servidor se prueban alternando familias, lanzando el siguiente intento si
+    el anterior no responde en RACE_DELAY_MS o falla. Cada intento es una
+    sesion completa; la primera que recibe respuesta se queda con la
+    transferencia y las demas se cancelan.
+
+    El servidor puede ser una lista de espejos. En paralelo se lanza de
+    entrada un intento a la primera direccion de cada uno, y el resto de
+    direcciones siguen el plazo de siempre. Un ERROR no gana la carrera (el
+    archivo puede estar en otro espejo). Un espejo que deja de responder a
+    mitad se marca caido (race_failover) y la transferencia se puede repetir
+    con los demas. */
+
+typedef struct tftp_race {
+    tftp_timer_t            timer;           /* siguiente intento */
+    tftp_loop_t *           loop;            /* bucle de los intentos */
+    tftp_t *                model;           /* sesion original, 1er intento */
+    void ( *start ) ( tftp_t *instance );    /* envia la peticion */
+    void ( *recv ) ( tftp_t *instance, ssize_t received ); /* tras start */
+    bool                    parallel;        /* no esperar a que falle */
+    struct sockaddr_storage addr[RACE_MAX];  /* direcciones del servidor */
+    socklen_t               size[RACE_MAX];  /* tamaño de cada una */
+    uint8_t                 host[RACE_MAX];  /* espejo de cada una */
+    unsigned                naddr;           /* cuantas */
+    unsigned                nhosts;          /* espejos */
+    const char *            name[RACE_HOSTS]; /* como se escribio cada uno */
+    char                    names[NAMESIZE + 1]; /* texto de los nombres */
+    bool                    down[RACE_HOSTS]; /* espejo caido, no se prueba */
+    unsigned                launched;        /* intentos lanzados */
+    unsigned                probes;          /* de entrada, 0 = uno por espejo */
+    unsigned                next;            /* siguiente por probar */
+    tftp_t *                attempt[RACE_MAX]; /* intentos lanzados */
+    tftp_t *                winner;          /* el que recibio respuesta */
+    void ( *done ) ( struct tftp_race *race ); /* al acabar, o NULL */
+    bool                    over;            /* ya se aviso a done */
+
+} tftp_race_t;
+
+int race_resolve ( tftp_race_t *race, const char *hosts, const char *port );
+
+void race_start ( tftp_race_t *race, tftp_loop_t *loop, tftp_t *model,
+                  void ( *start ) ( tftp_t *instance ), bool parallel );
+
+void race_copy ( tftp_race_t *race, const tftp_race_t *server );
+
+void race_prefer ( tftp_race_t *race, unsigned host );
+
+tftp_t *race_outcome ( tftp_race_t *race );
+
+int race_host ( const tftp_race_t *race, const tftp_t *instance );
+
+int race_failover ( tftp_race_t *race, const tftp_t *failed );
+
+void race_cancel ( tftp_race_t *race );
+
+void race_free ( tftp_race_t *race );
+
+#endif
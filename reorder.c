@@ -0,0 +1,84 @@
+#include "reorder.h"
+#include "pool.h"
+
+#include <stdlib.h>
+
+/*  reorder_new
+    Devuelve un almacen vacio, o NULL si no hay memoria
+*/
+
+tftp_reorder_t *reorder_new ( void ) {
+    return calloc ( 1, sizeof ( tftp_reorder_t ) );
+}
+
+/*  reorder_hold
+    Guarda el DATA de block que hay en *buf (len bytes) y deja en *buf un
+    buffer nuevo del mismo tamaño para seguir recibiendo. Un bloque que ya
+    estaba guardado no se vuelve a guardar.
+
+    Devuelve 0, o -1 si no se guardo (repetido o sin memoria)
+*/
+
+int reorder_hold ( tftp_reorder_t *reorder, uint64_t block, u_char **buf,
+                   size_t len ) {
+    unsigned i = block % REORDER_SLOTS;
+    u_char * fresh;
+
+    if ( reorder->block[i] == block )
+        return -1;
+
+    if ( ( fresh = pool_get ( pool_size ( *buf ) ) ) == NULL )
+        return -1;
+
+    /* Un slot ocupado por otro bloque ya quedo atras, se sustituye */
+
+    if ( reorder->block[i] != 0 ) {
+        pool_put ( reorder->slot[i] );
+        reorder->count--;
+    }
+
+    reorder->block[i] = block;
+    reorder->slot[i]  = *buf;
+    reorder->len[i]   = len;
+    reorder->count++;
+    *buf = fresh;
+
+    return 0;
+}
+
+/*  reorder_take
+    Saca el DATA de block si esta guardado. Quien lo recibe lo devuelve al
+    pool.
+
+    Devuelve el buffer con su longitud en *len, o NULL si no esta
+*/
+
+u_char *reorder_take ( tftp_reorder_t *reorder, uint64_t block, size_t *len ) {
+    unsigned i = block % REORDER_SLOTS;
+
+    if ( reorder->count == 0 || reorder->block[i] != block )
+        return NULL;
+
+    reorder->block[i] = 0;
+    reorder->count--;
+    *len = reorder->len[i];
+
+    return reorder->slot[i];
+}
+
+/*  reorder_free
+    Devuelve al pool lo que quede guardado
+*/
+
+void reorder_free ( tftp_reorder_t *reorder ) {
+    unsigned i;
+
+    if ( reorder == NULL )
+        return;
+
+    for ( i = 0; i < REORDER_SLOTS; i++ )
+        if ( reorder->block[i] != 0 )
+            pool_put ( reorder->slot[i] );
+
+    free ( reorder );
+}
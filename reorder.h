@@ -0,0 +1,34 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define REORDER_SLOTS 64 /* bloques adelantados guardados como mucho */
+
+/*  Bloques de una descarga con ventana que llegan antes que el siguiente en
+    orden. En vez de tirarlos y esperar a que el servidor repita la ventana,
+    se guarda el DATA recibido tal cual hasta que llegue el que falta. El
+    buffer se cambia por uno nuevo del pool, no se copia; el bloque n va en
+    slot[n % REORDER_SLOTS] y solo se guardan los REORDER_SLOTS siguientes
+    al ultimo en orden, asi no se pisan. */
+
+typedef struct tftp_reorder {
+    uint64_t block[REORDER_SLOTS]; /* bloque de cada slot, 0 = libre */
+    u_char * slot[REORDER_SLOTS];  /* DATA recibido (pool) */
+    size_t   len[REORDER_SLOTS];   /* bytes de cada DATA */
+    unsigned count;                /* slots ocupados */
+
+} tftp_reorder_t;
+
+tftp_reorder_t *reorder_new ( void );
+
+int reorder_hold ( tftp_reorder_t *reorder, uint64_t block, u_char **buf,
+                   size_t len );
+
+u_char *reorder_take ( tftp_reorder_t *reorder, uint64_t block, size_t *len );
+
+void reorder_free ( tftp_reorder_t *reorder );
+
+#endif
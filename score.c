@@ -0,0 +1,208 @@
+#include "score.h"
+
+#include <time.h>
+
+/*  ewma
+    Media movil con 1/4 de peso para la muestra nueva; la primera se toma
+    tal cual
+*/
+
+static uint32_t ewma ( uint32_t average, uint64_t sample, bool first ) {
+    if ( sample > UINT32_MAX )
+        sample = UINT32_MAX;
+
+    return first ? sample : ( 3 * ( uint64_t ) average + sample ) / 4;
+}
+
+/*  board_cost
+    Tiempo esperado (us) de un archivo tipico con el espejo. Sin muestras
+    cuentan solo su carga y sus fallos, asi se prueba pronto.
+*/
+
+static uint64_t board_cost ( const tftp_score_t *score ) {
+    uint64_t cost;
+
+    if ( score->samples == 0 )
+        return ( 1 + ( uint64_t ) score->active ) << score->failures;
+
+    cost = score->srtt;
+
+    if ( score->rate > 0 )
+        cost += SCORE_BYTES * 1000000ULL / score->rate;
+
+    cost += cost * score->loss * 4 / SCORE_UNIT;
+    cost *= 1 + score->active;
+
+    return cost << score->failures;
+}
+
+/*  board_init
+    Marcador vacio
+*/
+
+void board_init ( tftp_board_t *board ) {
+    memset ( board, 0, sizeof ( tftp_board_t ) );
+    board->seed = time ( NULL ) ^ getpid ();
+}
+
+/*  board_load
+    Recupera lo aprendido de los espejos de server que esten en path (una
+    linea por espejo: nombre srtt rate loss failures samples). Los que ya no
+    estan en la lista se ignoran.
+
+    Devuelve 0, o -1 con errno
+*/
+
+int board_load ( tftp_board_t *board, const tftp_race_t *server,
+                 const char *path ) {
+    FILE *       file = fopen ( path, "r" );
+    char         line[NAMESIZE + 64];
+    char         name[NAMESIZE + 1];
+    tftp_score_t score;
+    unsigned     h;
+
+    if ( file == NULL )
+        return -1;
+
+    while ( fgets ( line, sizeof ( line ), file ) != NULL ) {
+        memset ( &score, 0, sizeof ( score ) );
+
+        if ( sscanf ( line, "%255s %u %u %u %u %u", name, &score.srtt,
+                      &score.rate, &score.loss, &score.failures,
+                      &score.samples ) != 6 )
+            continue;
+
+        if ( score.failures > SCORE_MAX_FAILURES )
+            score.failures = SCORE_MAX_FAILURES;
+
+        if ( score.loss > SCORE_UNIT )
+            score.loss = SCORE_UNIT;
+
+        for ( h = 0; h < server->nhosts; h++ )
+            if ( !strcmp ( server->name[h], name ) )
+                board->score[h] = score;
+    }
+
+    fclose ( file );
+
+    return 0;
+}
+
+/*  board_save
+    Escribe el marcador en path, pasando por un temporal para que otro
+    proceso nunca lea uno a medias
+
+    Devuelve 0, o -1 con errno
+*/
+
+int board_save ( const tftp_board_t *board, const tftp_race_t *server,
+                 const char *path ) {
+    char                tmp[NAMESIZE + 8];
+    const tftp_score_t *score;
+    FILE *              file;
+    unsigned            h;
+    int                 error;
+
+    if ( snprintf ( tmp, sizeof ( tmp ), "%s.tmp", path ) >= ( int ) sizeof ( tmp ) ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if ( ( file = fopen ( tmp, "w" ) ) == NULL )
+        return -1;
+
+    for ( h = 0; h < server->nhosts; h++ ) {
+        score = &board->score[h];
+
+        if ( score->samples > 0 || score->failures > 0 )
+            fprintf ( file, "%s %u %u %u %u %u\n", server->name[h], score->srtt,
+                      score->rate, score->loss, score->failures,
+                      score->samples );
+    }
+
+    if ( ferror ( file ) ) {
+        error = errno;
+        fclose ( file );
+        unlink ( tmp );
+        errno = error;
+        return -1;
+    }
+
+    if ( fclose ( file ) == EOF || rename ( tmp, path ) == -1 ) {
+        error = errno;
+        unlink ( tmp );
+        errno = error;
+        return -1;
+    }
+
+    return 0;
+}
+
+/*  board_pick
+    Elige espejo para un archivo: el de menor coste de dos vivos al azar,
+    sin contar los que marque full (NULL = ninguno)
+
+    Devuelve su indice, o -1 si no queda ninguno vivo
+*/
+
+int board_pick ( tftp_board_t *board, const tftp_race_t *server,
+                 const bool *full ) {
+    unsigned live[RACE_HOSTS];
+    unsigned n = 0, h, a, b;
+
+    for ( h = 0; h < server->nhosts; h++ )
+        if ( !server->down[h] && ( full == NULL || !full[h] ) )
+            live[n++] = h;
+
+    if ( n == 0 )
+        return -1;
+
+    if ( n == 1 )
+        return live[0];
+
+    a = rand_r ( &board->seed ) % n;
+    b = rand_r ( &board->seed ) % ( n - 1 );
+
+    if ( b >= a )
+        b++;
+
+    return board_cost ( &board->score[live[b]] )
+                   < board_cost ( &board->score[live[a]] )
+               ? live[b]
+               : live[a];
+}
+
+/*  board_learn
+    Aprende de una sesion que termino con el espejo host. Un fallo solo
+    cuenta si el servidor dejo de responder; un ERROR suyo (archivo que no
+    existe) no dice nada de su salud.
+*/
+
+void board_learn ( tftp_board_t *board, unsigned host, const tftp_t *instance,
+                   bool ok ) {
+    tftp_score_t *      score = &board->score[host];
+    const tftp_stats_t *stats = &instance->stats;
+    bool                first = score->samples == 0;
+    uint64_t            elapsed;
+
+    if ( !ok ) {
+        if ( instance->lost && score->failures < SCORE_MAX_FAILURES )
+            score->failures++;
+        return;
+    }
+
+    score->failures /= 2;
+    elapsed = stats->end - stats->start;
+
+    if ( instance->srtt != 0 )
+        score->srtt = ewma ( score->srtt, instance->srtt, first );
+
+    if ( elapsed > 0 )
+        score->rate = ewma ( score->rate, stats->bytes * 1000000 / elapsed, first );
+
+    score->loss = ewma ( score->loss,
+                         stats->resent * SCORE_UNIT
+                             / ( stats->blocks + stats->resent + 1 ),
+                         first );
+    score->samples++;
+}
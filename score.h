@@ -0,0 +1,50 @@
+#ifndef SCORE_H
+#define SCORE_H
+
+#include "race.h"
+
+#define SCORE_UNIT 1024       /* perdida 1.0 en punto fijo */
+#define SCORE_BYTES 65536     /* archivo tipico para estimar el coste */
+#define SCORE_MAX_FAILURES 8  /* fallos recientes que se cuentan */
+
+/*  Lo aprendido de un espejo con las sesiones que terminaron: medias
+    moviles (1/4 de peso a cada sesion) del rtt, del ritmo y de la perdida,
+    y los fallos recientes, que se reducen a la mitad con cada exito */
+
+typedef struct tftp_score {
+    uint32_t srtt;     /* rtt suavizado (us) */
+    uint32_t rate;     /* bytes/s suavizado */
+    uint32_t loss;     /* reenvios por msg, en SCORE_UNIT */
+    uint32_t failures; /* fallos recientes */
+    uint32_t samples;  /* sesiones aprendidas, 0 = nada aun */
+    unsigned active;   /* transferencias en curso con el */
+
+} tftp_score_t;
+
+/*  Marcador de los espejos de un lote. Cada archivo se asigna por dos
+    opciones al azar (power of two choices): de dos espejos vivos se elige el
+    de menor coste esperado, rtt mas el tiempo de SCORE_BYTES a su ritmo,
+    penalizado por perdida, carga y fallos. Se guarda en un archivo de texto
+    para que el lote siguiente no empiece a ciegas. */
+
+typedef struct tftp_board {
+    tftp_score_t score[RACE_HOSTS]; /* uno por espejo de server */
+    unsigned     seed;              /* para rand_r */
+
+} tftp_board_t;
+
+void board_init ( tftp_board_t *board );
+
+int board_load ( tftp_board_t *board, const tftp_race_t *server,
+                 const char *path );
+
+int board_save ( const tftp_board_t *board, const tftp_race_t *server,
+                 const char *path );
+
+int board_pick ( tftp_board_t *board, const tftp_race_t *server,
+                 const bool *full );
+
+void board_learn ( tftp_board_t *board, unsigned host, const tftp_t *instance,
+                   bool ok );
+
+#endif
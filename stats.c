@@ -0,0 +1,96 @@
+#include "stats.h"
+
+/*  lat_bucket
+    Cubo de un valor: los 8 primeros valores van uno por cubo, a partir de ahi
+    el exponente elige la potencia de dos y los 3 bits siguientes al mas alto
+    el subcubo
+*/
+
+static unsigned lat_bucket ( uint32_t us ) {
+    unsigned log;
+
+    if ( us < ( 1u << LAT_SUB_BITS ) )
+        return us;
+
+    log = 31 - __builtin_clz ( us );
+
+    return ( ( log - LAT_SUB_BITS + 1 ) << LAT_SUB_BITS )
+           | ( ( us >> ( log - LAT_SUB_BITS ) ) & ( ( 1u << LAT_SUB_BITS ) - 1 ) );
+}
+
+/*  lat_value
+    Limite inferior de los valores de un cubo
+*/
+
+static uint32_t lat_value ( unsigned bucket ) {
+    unsigned shift = bucket >> LAT_SUB_BITS;
+    unsigned sub   = bucket & ( ( 1u << LAT_SUB_BITS ) - 1 );
+
+    if ( shift == 0 )
+        return sub;
+
+    return ( ( 1u << LAT_SUB_BITS ) | sub ) << ( shift - 1 );
+}
+
+void lat_add ( tftp_lat_t *lat, uint64_t us ) {
+    uint32_t value = us > UINT32_MAX ? UINT32_MAX : us;
+
+    if ( lat->count == 0 || value < lat->min )
+        lat->min = value;
+
+    if ( value > lat->max )
+        lat->max = value;
+
+    lat->count++;
+    lat->sum += value;
+    lat->hist[lat_bucket ( value )]++;
+}
+
+/*  lat_quantile
+    Valor bajo el que quedan permille milesimas de las muestras, con la
+    precision del cubo en que cae
+*/
+
+uint32_t lat_quantile ( const tftp_lat_t *lat, unsigned permille ) {
+    uint64_t rank = ( lat->count * permille + 999 ) / 1000;
+    uint64_t seen = 0;
+    unsigned i;
+
+    if ( lat->count == 0 )
+        return 0;
+
+    if ( rank == 0 )
+        rank = 1;
+
+    for ( i = 0; i < LAT_BUCKETS; i++ ) {
+        seen += lat->hist[i];
+
+        if ( seen >= rank )
+            return lat_value ( i ) > lat->max ? lat->max
+                   : lat_value ( i ) < lat->min ? lat->min
+                                                : lat_value ( i );
+    }
+
+    return lat->max;
+}
+
+void stats_print ( FILE *stream, const char *name, const tftp_stats_t *stats ) {
+    double seconds = ( stats->end - stats->start ) / 1e6;
+
+    fprintf ( stream, "%s: %llu bytes in %llu blocks, %.3f s, %.1f KiB/s\n",
+              name, ( unsigned long long ) stats->bytes,
+              ( unsigned long long ) stats->blocks, seconds,
+              seconds > 0 ? stats->bytes / 1024.0 / seconds : 0.0 );
+
+    if ( stats->lat.count == 0 )
+        return;
+
+    fprintf ( stream,
+              "%s: block latency us min %u avg %llu p50 %u p90 %u p99 %u "
+              "max %u (%llu samples)\n",
+              name, stats->lat.min,
+              ( unsigned long long ) ( stats->lat.sum / stats->lat.count ),
+              lat_quantile ( &stats->lat, 500 ), lat_quantile ( &stats->lat, 900 ),
+              lat_quantile ( &stats->lat, 990 ), stats->lat.max,
+              ( unsigned long long ) stats->lat.count );
+}
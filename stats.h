@@ -0,0 +1,42 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LAT_SUB_BITS 3                       /* 8 subcubos por potencia de 2 */
+#define LAT_BUCKETS ( 32 << LAT_SUB_BITS ) /* hasta 2^32 us */
+
+/*  Histograma de latencias en us, de precision relativa constante (1/8):
+    cada potencia de dos se parte en 8 cubos. Sirve para sacar percentiles
+    sin guardar las muestras. */
+
+typedef struct tftp_lat {
+    uint64_t count;               /* muestras */
+    uint64_t sum;                 /* suma, para la media */
+    uint32_t min;                 /* minima */
+    uint32_t max;                 /* maxima */
+    uint32_t hist[LAT_BUCKETS];   /* muestras por cubo */
+
+} tftp_lat_t;
+
+/*  Resumen de una transferencia: volumen, duracion y la latencia de cada
+    bloque, desde que sale nuestro msg hasta que llega su respuesta */
+
+typedef struct tftp_stats {
+    uint64_t   start;  /* inicio (us) */
+    uint64_t   end;    /* fin (us) */
+    uint64_t   bytes;  /* bytes de datos transferidos */
+    uint64_t   blocks; /* bloques de datos transferidos */
+    uint64_t   resent; /* reenvios por timeout */
+    tftp_lat_t lat;    /* latencia por bloque */
+
+} tftp_stats_t;
+
+void lat_add ( tftp_lat_t *lat, uint64_t us );
+
+uint32_t lat_quantile ( const tftp_lat_t *lat, unsigned permille );
+
+void stats_print ( FILE *stream, const char *name, const tftp_stats_t *stats );
+
+#endif
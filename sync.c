@@ -0,0 +1,519 @@
+#include "sync.h"
+
+#include <ctype.h>
+
+/*  sha256
+    SHA-256 (FIPS 180-4) de lo que se le va pasando con sha256_update
+*/
+
+typedef struct sha256 {
+    uint32_t state[8];
+    uint64_t length;                 /* bytes procesados */
+    u_char   block[64];              /* bloque a medio llenar */
+    size_t   fill;                   /* bytes en block */
+
+} sha256_t;
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR( x, n ) ( ( ( x ) >> ( n ) ) | ( ( x ) << ( 32 - ( n ) ) ) )
+
+static void sha256_block ( sha256_t *sha, const u_char *p ) {
+    uint32_t w[64], s[8], t1, t2;
+    int      i;
+
+    for ( i = 0; i < 16; i++ )
+        w[i] = ( uint32_t ) p[4 * i] << 24 | ( uint32_t ) p[4 * i + 1] << 16
+               | ( uint32_t ) p[4 * i + 2] << 8 | p[4 * i + 3];
+
+    for ( ; i < 64; i++ )
+        w[i] = ( ROR ( w[i - 2], 17 ) ^ ROR ( w[i - 2], 19 ) ^ ( w[i - 2] >> 10 ) )
+               + w[i - 7]
+               + ( ROR ( w[i - 15], 7 ) ^ ROR ( w[i - 15], 18 ) ^ ( w[i - 15] >> 3 ) )
+               + w[i - 16];
+
+    memcpy ( s, sha->state, sizeof ( s ) );
+
+    for ( i = 0; i < 64; i++ ) {
+        t1 = s[7] + ( ROR ( s[4], 6 ) ^ ROR ( s[4], 11 ) ^ ROR ( s[4], 25 ) )
+             + ( ( s[4] & s[5] ) ^ ( ~s[4] & s[6] ) ) + sha256_k[i] + w[i];
+        t2 = ( ROR ( s[0], 2 ) ^ ROR ( s[0], 13 ) ^ ROR ( s[0], 22 ) )
+             + ( ( s[0] & s[1] ) ^ ( s[0] & s[2] ) ^ ( s[1] & s[2] ) );
+
+        memmove ( s + 1, s, 7 * sizeof ( uint32_t ) );
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+
+    for ( i = 0; i < 8; i++ )
+        sha->state[i] += s[i];
+}
+
+static void sha256_init ( sha256_t *sha ) {
+    static const uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                   0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                   0x1f83d9ab, 0x5be0cd19 };
+
+    memcpy ( sha->state, h, sizeof ( h ) );
+    sha->length = 0;
+    sha->fill   = 0;
+}
+
+static void sha256_update ( sha256_t *sha, const u_char *p, size_t len ) {
+    size_t n;
+
+    sha->length += len;
+
+    while ( len > 0 ) {
+        n = 64 - sha->fill < len ? 64 - sha->fill : len;
+        memcpy ( sha->block + sha->fill, p, n );
+        sha->fill += n;
+        p += n;
+        len -= n;
+
+        if ( sha->fill == 64 ) {
+            sha256_block ( sha, sha->block );
+            sha->fill = 0;
+        }
+    }
+}
+
+static void sha256_final ( sha256_t *sha, u_char *digest ) {
+    uint64_t bits = sha->length * 8;
+    int      i;
+
+    sha->block[sha->fill++] = 0x80;
+
+    if ( sha->fill > 56 ) {
+        memset ( sha->block + sha->fill, 0, 64 - sha->fill );
+        sha256_block ( sha, sha->block );
+        sha->fill = 0;
+    }
+
+    memset ( sha->block + sha->fill, 0, 56 - sha->fill );
+
+    for ( i = 0; i < 8; i++ )
+        sha->block[56 + i] = bits >> ( 56 - 8 * i );
+
+    sha256_block ( sha, sha->block );
+
+    for ( i = 0; i < 32; i++ )
+        digest[i] = sha->state[i / 4] >> ( 24 - 8 * ( i % 4 ) );
+}
+
+/*  sync_hash
+    sha256 del archivo path
+
+    Devuelve 0, o -1 con errno
+*/
+
+static int sync_hash ( const char *path, u_char *digest ) {
+    sha256_t sha;
+    u_char * buf;
+    ssize_t  len;
+    int      fd = open ( path, O_RDONLY );
+
+    if ( fd == -1 )
+        return -1;
+
+    if ( ( buf = pool_get ( SYNC_READ ) ) == NULL ) {
+        close ( fd );
+        errno = ENOMEM;
+        return -1;
+    }
+
+    sha256_init ( &sha );
+
+    while ( ( len = read ( fd, buf, SYNC_READ ) ) > 0 )
+        sha256_update ( &sha, buf, len );
+
+    pool_put ( buf );
+    close ( fd );
+
+    if ( len == -1 )
+        return -1;
+
+    sha256_final ( &sha, digest );
+    return 0;
+}
+
+/*  sync_unhex
+    Pasa los 64 digitos hexadecimales de text a digest
+
+    Devuelve 0, o -1 si text no es un sha256
+*/
+
+static int sync_unhex ( const char *text, u_char *digest ) {
+    int i, hi, lo;
+
+    if ( strlen ( text ) != 2 * SYNC_DIGEST )
+        return -1;
+
+    for ( i = 0; i < SYNC_DIGEST; i++ ) {
+        hi = text[2 * i];
+        lo = text[2 * i + 1];
+
+        if ( !isxdigit ( hi ) || !isxdigit ( lo ) )
+            return -1;
+
+        hi        = isdigit ( hi ) ? hi - '0' : tolower ( hi ) - 'a' + 10;
+        lo        = isdigit ( lo ) ? lo - '0' : tolower ( lo ) - 'a' + 10;
+        digest[i] = hi << 4 | lo;
+    }
+
+    return 0;
+}
+
+/*  sync_safe
+    Un nombre del manifest tiene que quedar dentro del destino: relativo, sin
+    componentes ".." y que no pise el indice ni su copia temporal
+*/
+
+static bool sync_safe ( const char *name ) {
+    const char *p = name;
+    size_t      len;
+
+    if ( *name == '\0' || *name == '/' || strlen ( name ) >= NAMESIZE
+         || !strcmp ( name, SYNC_INDEX )
+         || !strcmp ( name, SYNC_INDEX ".tmp" ) )
+        return false;
+
+    while ( *p != '\0' ) {
+        len = strcspn ( p, "/" );
+
+        if ( len == 2 && p[0] == '.' && p[1] == '.' )
+            return false;
+
+        p += len;
+
+        if ( *p == '/' )
+            p++;
+    }
+
+    return true;
+}
+
+static int sync_compare ( const void *a, const void *b ) {
+    return strcmp ( ( ( const tftp_entry_t * ) a )->name,
+                    ( ( const tftp_entry_t * ) b )->name );
+}
+
+/*  sync_add
+    Reserva sitio para una entrada mas en list
+
+    Devuelve la entrada, o NULL si no hay memoria
+*/
+
+static tftp_entry_t *sync_add ( tftp_entry_t **list, unsigned *count ) {
+    tftp_entry_t *grown;
+
+    if ( ( *count & ( *count - 1 ) ) == 0 ) {
+        grown = realloc ( *list, ( *count == 0 ? 1 : 2 * *count )
+                                     * sizeof ( tftp_entry_t ) );
+
+        if ( grown == NULL )
+            return NULL;
+
+        *list = grown;
+    }
+
+    memset ( &( *list )[*count], 0, sizeof ( tftp_entry_t ) );
+
+    return &( *list )[( *count )++];
+}
+
+/*  sync_index_load
+    Carga el indice del destino. Sin indice (o con uno ilegible) simplemente
+    se calculan los digest; no es un error.
+*/
+
+static void sync_index_load ( tftp_sync_t *sync ) {
+    FILE *             stream = fopen ( SYNC_INDEX, "r" );
+    char               line[NAMESIZE + 128];
+    char               hex[2 * SYNC_DIGEST + 1];
+    char               name[NAMESIZE + 1];
+    unsigned long long mtime, ino, size;
+    tftp_entry_t *     entry;
+
+    if ( stream == NULL )
+        return;
+
+    while ( fgets ( line, sizeof ( line ), stream ) != NULL ) {
+        if ( sscanf ( line, "%llu %llu %llu %64s %255s", &mtime, &ino, &size,
+                      hex, name )
+             != 5 )
+            continue;
+
+        if ( ( entry = sync_add ( &sync->index, &sync->nindex ) ) == NULL
+             || ( entry->name = strdup ( name ) ) == NULL )
+            break;
+
+        if ( sync_unhex ( hex, entry->local ) == -1 ) {
+            free ( entry->name );
+            sync->nindex--;
+            continue;
+        }
+
+        entry->mtime      = mtime;
+        entry->ino        = ino;
+        entry->local_size = size;
+        entry->hashed     = true;
+    }
+
+    fclose ( stream );
+
+    qsort ( sync->index, sync->nindex, sizeof ( tftp_entry_t ), sync_compare );
+}
+
+/*  sync_index_save
+    Guarda el stat y el digest de las copias locales conocidas, en un
+    temporal que reemplaza al indice anterior
+
+    Devuelve 0, o -1 con errno
+*/
+
+static int sync_index_save ( tftp_sync_t *sync ) {
+    FILE *   stream = fopen ( SYNC_INDEX ".tmp", "w" );
+    unsigned i, j;
+
+    if ( stream == NULL )
+        return -1;
+
+    for ( i = 0; i < sync->count; i++ ) {
+        if ( !sync->entry[i].present || !sync->entry[i].hashed )
+            continue;
+
+        fprintf ( stream, "%llu %llu %llu ",
+                  ( unsigned long long ) sync->entry[i].mtime,
+                  ( unsigned long long ) sync->entry[i].ino,
+                  ( unsigned long long ) sync->entry[i].local_size );
+
+        for ( j = 0; j < SYNC_DIGEST; j++ )
+            fprintf ( stream, "%02x", sync->entry[i].local[j] );
+
+        fprintf ( stream, " %s\n", sync->entry[i].name );
+    }
+
+    if ( fclose ( stream ) == EOF ) {
+        unlink ( SYNC_INDEX ".tmp" );
+        return -1;
+    }
+
+    return rename ( SYNC_INDEX ".tmp", SYNC_INDEX );
+}
+
+/*  sync_load
+    Lee el manifest (una linea "nombre tamaño sha256" por archivo) y el
+    indice del destino, que debe ser el directorio actual. El manifest se
+    descarga en el destino con su nombre; si se lista a si mismo (hecho con
+    sha256sum sobre el arbol) esa linea se salta, nunca coincidiria con su
+    propio digest.
+
+    Devuelve 0, o -1 con errno
+*/
+
+int sync_load ( tftp_sync_t *sync, const char *manifest ) {
+    FILE *        stream = fopen ( manifest, "r" );
+    char          line[NAMESIZE + 128];
+    char *        name, *size, *digest, *end, *save;
+    tftp_entry_t *entry;
+
+    memset ( sync, 0, sizeof ( tftp_sync_t ) );
+
+    if ( stream == NULL )
+        return -1;
+
+    while ( fgets ( line, sizeof ( line ), stream ) != NULL ) {
+        name = strtok_r ( line, " \t\r\n", &save );
+
+        if ( name == NULL || *name == '#' || !strcmp ( name, manifest ) )
+            continue;
+
+        size   = strtok_r ( NULL, " \t\r\n", &save );
+        digest = strtok_r ( NULL, " \t\r\n", &save );
+
+        if ( size == NULL || digest == NULL || !sync_safe ( name ) ) {
+            syslog ( LOG_WARNING, "Skipping manifest line for %s", name );
+            continue;
+        }
+
+        if ( ( entry = sync_add ( &sync->entry, &sync->count ) ) == NULL
+             || ( entry->name = strdup ( name ) ) == NULL ) {
+            fclose ( stream );
+            sync_free ( sync );
+            errno = ENOMEM;
+            return -1;
+        }
+
+        entry->size = strtoull ( size, &end, 10 );
+
+        if ( *end != '\0' || sync_unhex ( digest, entry->digest ) == -1 ) {
+            syslog ( LOG_WARNING, "Skipping manifest line for %s", name );
+            free ( entry->name );
+            sync->count--;
+        }
+    }
+
+    fclose ( stream );
+    sync_index_load ( sync );
+
+    return 0;
+}
+
+/*  sync_local
+    Averigua como esta la copia local de entry. Si el tamaño no coincide ya
+    es distinta; si coincide, el digest se reutiliza cuando el stat es el
+    mismo que cuando se calculo (en el indice, o en una pasada anterior) y si
+    no se calcula leyendo el archivo.
+
+    Devuelve true si la copia local es igual a la del manifest
+*/
+
+static bool sync_local ( tftp_sync_t *sync, tftp_entry_t *entry ) {
+    struct stat         st;
+    tftp_entry_t        before = *entry;
+    const tftp_entry_t *cached = &before;
+
+    entry->present = false;
+    entry->hashed  = false;
+
+    if ( stat ( entry->name, &st ) == -1 || !S_ISREG ( st.st_mode ) )
+        return false;
+
+    entry->present    = true;
+    entry->local_size = st.st_size;
+    entry->mtime      = ( uint64_t ) st.st_mtim.tv_sec * 1000000000
+                   + st.st_mtim.tv_nsec;
+    entry->ino        = st.st_ino;
+
+    if ( entry->local_size != entry->size )
+        return false;
+
+    if ( !before.hashed )
+        cached = sync->nindex == 0
+                     ? NULL
+                     : bsearch ( entry, sync->index, sync->nindex,
+                                 sizeof ( tftp_entry_t ), sync_compare );
+
+    if ( cached != NULL && cached->mtime == entry->mtime
+         && cached->ino == entry->ino && cached->local_size == entry->local_size )
+        memcpy ( entry->local, cached->local, SYNC_DIGEST );
+
+    else if ( sync_hash ( entry->name, entry->local ) == -1 ) {
+        syslog ( LOG_WARNING, "Error reading %s: %s", entry->name,
+                 strerror ( errno ) );
+        return false;
+    }
+
+    entry->hashed = true;
+
+    return !memcmp ( entry->local, entry->digest, SYNC_DIGEST );
+}
+
+/*  sync_mkdirs
+    Crea los directorios intermedios de name que falten
+*/
+
+static void sync_mkdirs ( const char *name ) {
+    char  path[NAMESIZE];
+    char *slash;
+
+    strcpy ( path, name );
+
+    for ( slash = strchr ( path, '/' ); slash != NULL;
+          slash = strchr ( slash + 1, '/' ) ) {
+        *slash = '\0';
+
+        if ( mkdir ( path, 0755 ) == -1 && errno != EEXIST )
+            syslog ( LOG_WARNING, "Error creating %s: %s", path,
+                     strerror ( errno ) );
+
+        *slash = '/';
+    }
+}
+
+/*  sync_plan
+    Compara cada archivo del manifest con su copia local y pone en la lista
+    de batch los que hay que descargar
+
+    Devuelve 0, o -1 si no hay memoria
+*/
+
+int sync_plan ( tftp_sync_t *sync, tftp_batch_t *batch ) {
+    unsigned i;
+
+    batch->files  = sync->count == 0 ? NULL : calloc ( sync->count, sizeof ( char * ) );
+    batch->nfiles = 0;
+    sync->fetched = 0;
+
+    if ( sync->count != 0 && batch->files == NULL )
+        return -1;
+
+    for ( i = 0; i < sync->count; i++ ) {
+        if ( sync_local ( sync, &sync->entry[i] ) )
+            continue;
+
+        sync_mkdirs ( sync->entry[i].name );
+
+        if ( ( batch->files[batch->nfiles] = strdup ( sync->entry[i].name ) )
+             == NULL ) {
+            batch_free ( batch );
+            return -1;
+        }
+
+        batch->nfiles++;
+        sync->fetched++;
+    }
+
+    return 0;
+}
+
+/*  sync_verify
+    Tras las descargas vuelve a comparar todo con el manifest (lo que no
+    cambio sale del indice sin leerlo) y guarda el indice actualizado
+
+    Devuelve 0 si todo coincide, o -1
+*/
+
+int sync_verify ( tftp_sync_t *sync ) {
+    unsigned i;
+
+    sync->mismatch = 0;
+
+    for ( i = 0; i < sync->count; i++ )
+        if ( !sync_local ( sync, &sync->entry[i] ) ) {
+            printf ( "ERROR %s does not match the manifest\n", sync->entry[i].name );
+            sync->mismatch++;
+        }
+
+    if ( sync_index_save ( sync ) == -1 )
+        syslog ( LOG_WARNING, "Error saving %s: %s", SYNC_INDEX, strerror ( errno ) );
+
+    return sync->mismatch == 0 ? 0 : -1;
+}
+
+void sync_free ( tftp_sync_t *sync ) {
+    unsigned i;
+
+    for ( i = 0; i < sync->count; i++ )
+        free ( sync->entry[i].name );
+
+    for ( i = 0; i < sync->nindex; i++ )
+        free ( sync->index[i].name );
+
+    free ( sync->entry );
+    free ( sync->index );
+    memset ( sync, 0, sizeof ( tftp_sync_t ) );
+}
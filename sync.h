@@ -0,0 +1,50 @@
+#ifndef SYNC_H
+#define SYNC_H
+
+#include "batch.h"
+
+#define SYNC_INDEX ".tftp_index"     /* indice local, en el directorio destino */
+#define SYNC_JOBS 4                  /* descargas a la vez si no se pide otra cosa */
+#define SYNC_DIGEST 32               /* bytes de un sha256 */
+#define SYNC_READ ( 64 << 10 )       /* lectura al calcular un digest */
+
+/*  Archivo del manifest (nombre, tamaño y sha256 esperados) con lo que se
+    sabe de la copia local: su stat y su digest, del indice o calculado */
+
+typedef struct tftp_entry {
+    char *   name;                   /* ruta relativa al destino */
+    uint64_t size;                   /* tamaño esperado */
+    u_char   digest[SYNC_DIGEST];    /* sha256 esperado */
+    bool     present;                /* hay copia local */
+    uint64_t local_size;             /* tamaño de la copia */
+    uint64_t mtime;                  /* su mtime (ns) */
+    uint64_t ino;                    /* su inodo */
+    u_char   local[SYNC_DIGEST];     /* su sha256, valido si hashed */
+    bool     hashed;                 /* local esta calculado o en el indice */
+
+} tftp_entry_t;
+
+/*  Espejo de un directorio descrito por un manifest remoto. El indice guarda
+    el digest de cada copia local junto a su stat: mientras el stat no cambie
+    el digest no se recalcula, y un archivo igual al del manifest no cuesta ni
+    una lectura ni un paquete. */
+
+typedef struct tftp_sync {
+    tftp_entry_t *entry;             /* archivos del manifest */
+    unsigned      count;             /* cuantos */
+    tftp_entry_t *index;             /* indice cargado, por nombre */
+    unsigned      nindex;            /* cuantos */
+    unsigned      fetched;           /* archivos a descargar */
+    unsigned      mismatch;          /* distintos tras descargar */
+
+} tftp_sync_t;
+
+int sync_load ( tftp_sync_t *sync, const char *manifest );
+
+int sync_plan ( tftp_sync_t *sync, tftp_batch_t *batch );
+
+int sync_verify ( tftp_sync_t *sync );
+
+void sync_free ( tftp_sync_t *sync );
+
+#endif
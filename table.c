@@ -0,0 +1,293 @@
+#include "table.h"
+
+/*  table_hash
+    Mezcla la 4-tupla en 32 bits (finalizador de murmur3)
+*/
+
+static uint32_t table_hash ( uint32_t raddr, uint16_t rport, uint32_t laddr,
+                             uint16_t lport ) {
+    uint64_t h;
+
+    h = ( ( uint64_t ) raddr << 32 ) | ( ( uint32_t ) rport << 16 ) | lport;
+    h ^= laddr * 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return ( uint32_t ) h;
+}
+
+/*  addr_key
+    Direccion de la clave de la tabla: la IPv4 tal cual (orden de red), de
+    una IPv6 sus cuatro palabras mezcladas
+*/
+
+uint32_t addr_key ( const struct sockaddr *addr ) {
+    const uint32_t *w;
+
+    if ( addr->sa_family == AF_INET6 ) {
+        w = ( const uint32_t * ) &( ( const struct sockaddr_in6 * ) addr )
+                ->sin6_addr;
+        return w[0] ^ w[1] ^ w[2] ^ ( w[3] * 0x9e3779b1u );
+    }
+
+    return ( ( const struct sockaddr_in * ) addr )->sin_addr.s_addr;
+}
+
+/*  addr_port
+    Puerto de una direccion de cualquier familia (orden de red)
+*/
+
+uint16_t addr_port ( const struct sockaddr *addr ) {
+    if ( addr->sa_family == AF_INET6 )
+        return ( ( const struct sockaddr_in6 * ) addr )->sin6_port;
+
+    return ( ( const struct sockaddr_in * ) addr )->sin_port;
+}
+
+/*  addr_same_host
+    Si dos direcciones son del mismo host, sin mirar el puerto
+*/
+
+bool addr_same_host ( const struct sockaddr *a, const struct sockaddr *b ) {
+    if ( a->sa_family != b->sa_family )
+        return false;
+
+    if ( a->sa_family == AF_INET6 )
+        return !memcmp ( &( ( const struct sockaddr_in6 * ) a )->sin6_addr,
+                         &( ( const struct sockaddr_in6 * ) b )->sin6_addr,
+                         sizeof ( struct in6_addr ) );
+
+    return ( ( const struct sockaddr_in * ) a )->sin_addr.s_addr
+           == ( ( const struct sockaddr_in * ) b )->sin_addr.s_addr;
+}
+
+static uint32_t table_home ( const tftp_table_t *table, const tftp_hot_t *e ) {
+    return table_hash ( e->raddr, e->rport, e->laddr, e->lport ) & table->mask;
+}
+
+static tftp_hot_t *table_alloc ( uint32_t capacity ) {
+    tftp_hot_t *hot;
+
+    /* Alineado a linea de cache para que cada entrada caiga en una sola */
+
+    hot = aligned_alloc ( 64, capacity * sizeof ( tftp_hot_t ) );
+
+    if ( hot != NULL )
+        memset ( hot, 0, capacity * sizeof ( tftp_hot_t ) );
+
+    return hot;
+}
+
+/*  table_place
+    Copia e en el primer hueco desde su posicion natural y actualiza el slot
+    de la sesion. Se asume que hay sitio.
+*/
+
+static tftp_hot_t *table_place ( tftp_table_t *table, const tftp_hot_t *e ) {
+    uint32_t i = table_home ( table, e );
+
+    while ( table->hot[i].session != NULL )
+        i = ( i + 1 ) & table->mask;
+
+    table->hot[i]    = *e;
+    e->session->slot = i;
+    table->count++;
+
+    return &table->hot[i];
+}
+
+static int table_grow ( tftp_table_t *table ) {
+    tftp_hot_t *old  = table->hot;
+    uint32_t    size = table->mask + 1;
+    uint32_t    i;
+
+    table->hot = table_alloc ( size * 2 );
+
+    if ( table->hot == NULL ) {
+        table->hot = old;
+        errno      = ENOMEM;
+        return -1;
+    }
+
+    table->mask  = size * 2 - 1;
+    table->count = 0;
+
+    for ( i = 0; i < size; i++ )
+        if ( old[i].session != NULL )
+            table_place ( table, &old[i] );
+
+    free ( old );
+    return 0;
+}
+
+/*  table_init
+    Prepara una tabla para al menos capacity sesiones sin tener que crecer
+*/
+
+int table_init ( tftp_table_t *table, uint32_t capacity ) {
+    uint32_t size = TABLE_MIN;
+
+    while ( size * TABLE_LOAD_NUM < capacity * TABLE_LOAD_DEN )
+        size *= 2;
+
+    table->hot   = table_alloc ( size );
+    table->mask  = size - 1;
+    table->count = 0;
+
+    if ( table->hot == NULL ) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    return 0;
+}
+
+void table_destroy ( tftp_table_t *table ) {
+    free ( table->hot );
+
+    table->hot   = NULL;
+    table->mask  = 0;
+    table->count = 0;
+}
+
+/*  table_insert
+    Registra la sesion con la direccion remota y local que tenga asignadas. El
+    tid del servidor aun no se conoce, asi que entra como pendiente (rport 0)
+    hasta que table_rekey lo fije con la primera respuesta.
+*/
+
+tftp_hot_t *table_insert ( tftp_table_t *table, tftp_t *instance ) {
+    tftp_hot_t e = { 0 };
+
+    if ( ( table->count + 1 ) * TABLE_LOAD_DEN
+             > ( table->mask + 1 ) * TABLE_LOAD_NUM
+         && table_grow ( table ) == -1 )
+        return NULL;
+
+    e.raddr   = addr_key ( ( struct sockaddr * ) &instance->remote_addr );
+    e.laddr   = addr_key ( ( struct sockaddr * ) &instance->local_addr );
+    e.lport   = addr_port ( ( struct sockaddr * ) &instance->local_addr );
+    e.session = instance;
+
+    instance->table = table;
+    return table_place ( table, &e );
+}
+
+/*  table_find
+    Recorre entradas contiguas desde la posicion natural de la 4-tupla hasta
+    el primer hueco: con la carga limitada a 7/10 suelen ser una o dos lineas
+    de cache. Con from, la direccion completa de la sesion tiene que ser la de
+    from (para IPv6, cuya clave es parcial).
+*/
+
+static tftp_hot_t *table_find ( tftp_table_t *table, uint32_t raddr,
+                                uint16_t rport, uint32_t laddr, uint16_t lport,
+                                const struct sockaddr *from ) {
+    uint32_t    i = table_hash ( raddr, rport, laddr, lport ) & table->mask;
+    tftp_hot_t *e;
+
+    for ( ;; ) {
+        e = &table->hot[i];
+
+        if ( e->session == NULL )
+            return NULL;
+
+        if ( e->raddr == raddr && e->rport == rport && e->lport == lport
+             && e->laddr == laddr
+             && ( from == NULL || from->sa_family != AF_INET6
+                  || addr_same_host (
+                         from,
+                         ( struct sockaddr * ) &e->session->remote_addr ) ) )
+            return e;
+
+        i = ( i + 1 ) & table->mask;
+    }
+}
+
+/*  table_lookup
+    Busca la sesion de una 4-tupla (claves de addr_key, puertos en orden de
+    red)
+*/
+
+tftp_hot_t *table_lookup ( tftp_table_t *table, uint32_t raddr, uint16_t rport,
+                           uint32_t laddr, uint16_t lport ) {
+    return table_find ( table, raddr, rport, laddr, lport, NULL );
+}
+
+/*  table_demux
+    Sesion a la que va un paquete recibido de from en el socket local. Si
+    ninguna tiene ya ese tid, se prueba con las pendientes de ese servidor.
+*/
+
+tftp_hot_t *table_demux ( tftp_table_t *table, const struct sockaddr *from,
+                          const struct sockaddr *local ) {
+    uint32_t    raddr = addr_key ( from );
+    uint32_t    laddr = addr_key ( local );
+    uint16_t    lport = addr_port ( local );
+    tftp_hot_t *e;
+
+    e = table_find ( table, raddr, addr_port ( from ), laddr, lport, from );
+
+    if ( e == NULL )
+        e = table_find ( table, raddr, 0, laddr, lport, from );
+
+    return e;
+}
+
+/*  table_rekey
+    Cambia el tid remoto de la sesion (orden de red). La entrada se mueve, se
+    devuelve su nueva posicion.
+*/
+
+tftp_hot_t *table_rekey ( tftp_t *instance, uint16_t rport ) {
+    tftp_table_t *table = instance->table;
+    tftp_hot_t    e     = *HOT ( instance );
+
+    table_remove ( instance );
+
+    e.rport         = rport;
+    instance->table = table;
+
+    return table_place ( table, &e );
+}
+
+/*  table_remove
+    Saca la sesion de su tabla. Las entradas siguientes se desplazan hacia
+    atras para no dejar marcas de borrado que alarguen las busquedas.
+*/
+
+void table_remove ( tftp_t *instance ) {
+    tftp_table_t *table = instance->table;
+    uint32_t      i     = instance->slot;
+    uint32_t      j     = i;
+    uint32_t      k;
+
+    if ( table == NULL )
+        return;
+
+    table->hot[i].session = NULL;
+    table->count--;
+    instance->table = NULL;
+
+    for ( ;; ) {
+        j = ( j + 1 ) & table->mask;
+
+        if ( table->hot[j].session == NULL )
+            return;
+
+        /* Si su posicion natural esta entre el hueco y j, se queda donde esta */
+
+        k = table_home ( table, &table->hot[j] );
+
+        if ( i <= j ? ( i < k && k <= j ) : ( i < k || k <= j ) )
+            continue;
+
+        table->hot[i]               = table->hot[j];
+        table->hot[i].session->slot = i;
+        table->hot[j].session       = NULL;
+        i                           = j;
+    }
+}
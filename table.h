@@ -0,0 +1,66 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include "tftp.h"
+
+#define TABLE_MIN 64          /* capacidad inicial minima */
+#define TABLE_LOAD_NUM 7      /* carga maxima 7/10 antes de crecer */
+#define TABLE_LOAD_DEN 10
+
+/*  Entrada caliente de la tabla de sesiones: la clave de demultiplexado (la
+    4-tupla) y los campos que se tocan con cada paquete. Ocupa 32 bytes, dos
+    por linea de cache; el resto de la sesion (archivo, buffers, errores,
+    direcciones completas) queda en el tftp_t al que apunta. Una direccion
+    IPv6 no cabe: la clave guarda 32 bits de ella y al encontrarla se compara
+    entera con la del tftp_t. El numero de bloque es el logico, sin la vuelta
+    de los 16 bits de la trama; comparte palabra con el estado y los
+    reintentos para seguir en 32 bytes, y 48 bits dan para cualquier archivo
+    aun con bloques de MIN_BLKSIZE */
+
+typedef struct tftp_hot {
+    uint32_t raddr;    /* direccion remota (addr_key) */
+    uint32_t laddr;    /* direccion local (addr_key) */
+    uint16_t rport;    /* tid remoto (orden de red), 0 = aun sin tid */
+    uint16_t lport;    /* puerto local (orden de red) */
+    uint32_t deadline; /* vencimiento del timeout (ms) */
+    uint64_t blknum : 48; /* ultimo bloque confirmado (logico) */
+    uint64_t state : 8;   /* estado */
+    uint64_t retries : 8; /* reintentos */
+    tftp_t * session;  /* datos frios, NULL = hueco libre */
+
+} tftp_hot_t;
+
+typedef struct tftp_table {
+    tftp_hot_t *hot;   /* entradas, direccionamiento abierto lineal */
+    uint32_t    mask;  /* capacidad - 1 (potencia de dos) */
+    uint32_t    count; /* entradas ocupadas */
+
+} tftp_table_t;
+
+/* Entrada caliente de una sesion registrada en su tabla */
+
+#define HOT( instance ) ( &( instance )->table->hot[( instance )->slot] )
+
+uint32_t addr_key ( const struct sockaddr *addr );
+
+uint16_t addr_port ( const struct sockaddr *addr );
+
+bool addr_same_host ( const struct sockaddr *a, const struct sockaddr *b );
+
+int table_init ( tftp_table_t *table, uint32_t capacity );
+
+void table_destroy ( tftp_table_t *table );
+
+tftp_hot_t *table_insert ( tftp_table_t *table, tftp_t *instance );
+
+tftp_hot_t *table_lookup ( tftp_table_t *table, uint32_t raddr, uint16_t rport,
+                           uint32_t laddr, uint16_t lport );
+
+tftp_hot_t *table_demux ( tftp_table_t *table, const struct sockaddr *from,
+                          const struct sockaddr *local );
+
+tftp_hot_t *table_rekey ( tftp_t *instance, uint16_t rport );
+
+void table_remove ( tftp_t *instance );
+
+#endif
@@ -1,67 +1,407 @@
 #include "tftp.h"
+#include "table.h"
+#include "reorder.h"
+#include "inflate.h"
+#include "fair.h"
 
-void err_log_exit ( int priority, const char *format, ... ) {
-    va_list args;
+#include <strings.h>
 
-    va_start ( args, format );
-    vsyslog ( priority, format, args );
-    va_end ( args );
+/* Las sesiones salen de un slab, sus buffers del pool segun el blksize */
 
-    syslog ( LOG_CRIT, "FATAL ERROR. Shutting down server ..." );
-    _exit ( EXIT_FAILURE );
+static tftp_slab_t sessions = { 0 };
+
+/*  tftp_new
+    Crea una sesion con los valores por defecto (octet, blksize 512) y sus
+    buffers para ese tamaño. Devuelve NULL si no hay memoria.
+*/
+
+tftp_t *tftp_new ( void ) {
+    tftp_t *instance;
+
+    if ( sessions.size == 0 )
+        slab_init ( &sessions, sizeof ( tftp_t ), SLAB_PER_PAGE );
+
+    instance = slab_alloc ( &sessions );
+
+    if ( instance == NULL )
+        return NULL;
+
+    instance->local_descriptor = -1;
+    instance->fd               = -1;
+    instance->out.fd           = -1;
+    instance->mode             = MODE_OCTET;
+    instance->window           = 1;
+    instance->tsize            = -1;
+    instance->prio             = SCHED_DEFAULT;
+
+    if ( tftp_resize ( instance, BUFSIZE ) == -1 ) {
+        tftp_free ( instance );
+        return NULL;
+    }
+
+    return instance;
 }
 
-void _err_log_exit ( int priority, const char *format, ... ) {
-    va_list args;
+/*  tftp_clone
+    Crea una sesion nueva con el archivo y las opciones de model (modo,
+    opciones a negociar, salida, control de ritmo), sin nada de su estado
+*/
+
+tftp_t *tftp_clone ( const tftp_t *model ) {
+    tftp_t *instance = tftp_new ();
+
+    if ( instance == NULL )
+        return NULL;
 
-    va_start ( args, format );
-    vsyslog ( priority, format, args );
-    va_end ( args );
+    if ( tftp_set_file ( instance, model->file ) == -1
+         || ( model->local != NULL
+              && tftp_set_local ( instance, model->local ) == -1 ) ) {
+        tftp_free ( instance );
+        return NULL;
+    }
 
-    syslog ( LOG_CRIT, "FATAL ERROR. Killing child ..." );
-    _exit ( EXIT_FAILURE );
+    instance->mode             = model->mode;
+    instance->blksize_opt      = model->blksize_opt;
+    instance->window_opt       = model->window_opt;
+    instance->tsize_opt        = model->tsize_opt;
+    instance->out.policy       = model->out.policy;
+    instance->out.flush_bytes  = model->out.flush_bytes;
+    instance->out.direct       = model->out.direct;
+    instance->cc.ops           = model->cc.ops;
+    instance->rate             = model->rate;
+    instance->prio             = model->prio;
+    instance->held             = model->held;
+    instance->compressed       = model->compressed;
+
+    return instance;
 }
 
-void build_data_msg ( tftp_t *instance ) {
-    u_char *p;
-    memset ( &instance->buf, 0, MAX_BUFSIZE );
-    p          = instance->buf;
-    *( p + 0 ) = ( OPCODE_DATA >> 8 ) & 0xff;
-    *( p + 1 ) = OPCODE_DATA & 0xff;
-    *( p + 2 ) = ( instance->blknum >> 8 ) & 0xff;
-    *( p + 3 ) = ( instance->blknum ) & 0xff;
-    p += 4;
-    memcpy ( p, instance->msg, BUFSIZE );
+/*  tftp_free
+    Devuelve los buffers al pool y la sesion al slab
+*/
+
+void tftp_free ( tftp_t *instance ) {
+    if ( instance == NULL )
+        return;
+
+    table_remove ( instance );
+    reorder_free ( instance->reorder );
+    pool_put ( instance->file );
+    pool_put ( instance->local );
+    pool_put ( instance->reason );
+    pool_put ( instance->buf );
+    pool_put ( instance->pkt );
+    slab_free ( &sessions, instance );
 }
 
+/*  tftp_set_file
+    Copia el nombre del archivo a un buffer del pool de su tamaño
+*/
+
+int tftp_set_file ( tftp_t *instance, const char *file ) {
+    size_t len = strlen ( file );
+    char * copy;
+
+    if ( len >= NAMESIZE ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    copy = pool_get ( len + 1 );
+
+    if ( copy == NULL ) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memcpy ( copy, file, len + 1 );
+    pool_put ( instance->file );
+    instance->file = copy;
+
+    return 0;
+}
+
+/*  tftp_set_local
+    Nombre local del archivo, si no es el remoto (el demonio lo da por
+    peticion); NULL vuelve al remoto
+*/
+
+int tftp_set_local ( tftp_t *instance, const char *local ) {
+    size_t len  = local != NULL ? strlen ( local ) : 0;
+    char * copy = NULL;
+
+    if ( len >= NAMESIZE ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    if ( local != NULL && ( copy = pool_get ( len + 1 ) ) == NULL ) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if ( copy != NULL )
+        memcpy ( copy, local, len + 1 );
+
+    pool_put ( instance->local );
+    instance->local = copy;
+
+    return 0;
+}
+
+/*  tftp_set_reason
+    Guarda por que fallo la sesion, para dar el resultado a quien la lanzo
+*/
+
+int tftp_set_reason ( tftp_t *instance, const char *reason ) {
+    size_t len = strlen ( reason );
+    char * copy = pool_get ( len + 1 );
+
+    if ( copy == NULL ) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    memcpy ( copy, reason, len + 1 );
+    pool_put ( instance->reason );
+    instance->reason = copy;
+
+    return 0;
+}
+
+/*  tftp_result
+    Resume una sesion terminada (o que no llego a terminar) en result
+*/
+
+void tftp_result ( const tftp_t *instance, tftp_result_t *result ) {
+    const tftp_stats_t *stats = &instance->stats;
+
+    result->ok    = instance->done && !instance->failed;
+    result->bytes = stats->bytes;
+    result->usec  = stats->end > stats->start ? stats->end - stats->start : 0;
+    result->code  = instance->refused ? instance->code : -1;
+
+    if ( result->ok )
+        result->message[0] = '\0';
+
+    else
+        snprintf ( result->message, sizeof ( result->message ), "%s",
+                   instance->reason != NULL ? instance->reason
+                                            : "Transfer did not finish" );
+}
+
+/*  tftp_resize
+    Cambia los buffers de la sesion por unos del tamaño de blksize. Las
+    peticiones y los errores tambien usan estos buffers, asi que nunca bajan
+    de MAX_BUFSIZE. El ultimo msg enviado se conserva.
+*/
+
+int tftp_resize ( tftp_t *instance, uint16_t blksize ) {
+    u_char *buf, *pkt;
+    size_t  size = blksize < BUFSIZE ? MAX_BUFSIZE : 4 + blksize;
+
+    buf = pool_get ( size );
+    pkt = pool_get ( size );
+
+    if ( buf == NULL || pkt == NULL ) {
+        pool_put ( buf );
+        pool_put ( pkt );
+        errno = ENOMEM;
+        return -1;
+    }
+
+    if ( instance->pkt != NULL )
+        memcpy ( pkt, instance->pkt, instance->pkt_len );
+
+    pool_put ( instance->buf );
+    pool_put ( instance->pkt );
+
+    instance->buf     = buf;
+    instance->pkt     = pkt;
+    instance->blksize = blksize;
+
+    return 0;
+}
+
+/*  put_uint
+    Escribe value en decimal terminado en '\0', sin pasar por printf
+
+    Devuelve los bytes escritos, con el '\0'
+*/
+
+static size_t put_uint ( u_char *p, unsigned value ) {
+    char   digits[10];
+    size_t n = 0;
+    size_t i;
+
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while ( value != 0 );
+
+    for ( i = 0; i < n; i++ )
+        p[i] = digits[n - 1 - i];
+
+    p[n] = '\0';
+
+    return n + 1;
+}
+
+/*  build_request
+    Construye en pkt la peticion type (OPCODE_RRQ u OPCODE_WRQ) con las
+    opciones a negociar. Se escribe cada byte una vez, sin limpiar antes el
+    buffer.
+
+    Devuelve la longitud de la peticion
+*/
+
+size_t build_request ( tftp_t *instance, int type ) {
+    u_char *p = instance->pkt;
+    size_t  len;
+
+    *p++ = ( type >> 8 ) & 0xff;
+    *p++ = type & 0xff;
+
+    len = strlen ( instance->file );
+    memcpy ( p, instance->file, len );
+    p += len;
+
+    /* Comprimido se pide archivo.gz, que se guarda descomprimido como archivo */
+
+    if ( instance->compressed && type == OPCODE_RRQ ) {
+        memcpy ( p, INFLATE_SUFFIX, sizeof ( INFLATE_SUFFIX ) - 1 );
+        p += sizeof ( INFLATE_SUFFIX ) - 1;
+    }
+
+    *p++ = '\0';
+
+    len = strlen ( instance->mode ) + 1;
+    memcpy ( p, instance->mode, len );
+    p += len;
+
+    /* Opciones (RFC 2347), solo si se pidió algo distinto al defecto */
+
+    if ( instance->blksize_opt != 0 ) {
+        memcpy ( p, OPT_BLKSIZE, sizeof ( OPT_BLKSIZE ) );
+        p += sizeof ( OPT_BLKSIZE );
+        p += put_uint ( p, instance->blksize_opt );
+    }
+
+    if ( instance->window_opt != 0 ) {
+        memcpy ( p, OPT_WINDOWSIZE, sizeof ( OPT_WINDOWSIZE ) );
+        p += sizeof ( OPT_WINDOWSIZE );
+        p += put_uint ( p, instance->window_opt );
+    }
+
+    /* En un RRQ el tamaño se pide con 0 y el servidor lo pone en el OACK */
+
+    if ( instance->tsize_opt && type == OPCODE_RRQ ) {
+        memcpy ( p, OPT_TSIZE, sizeof ( OPT_TSIZE ) );
+        p += sizeof ( OPT_TSIZE );
+        p += put_uint ( p, 0 );
+    }
+
+    return p - instance->pkt;
+}
+
+/*  build_data_msg
+    Pone la cabecera del DATA blknum a los len bytes que ya se leyeron en
+    pkt + 4
+*/
+
+void build_data_msg ( tftp_t *instance, uint16_t blknum, size_t len ) {
+    u_char *p = instance->pkt;
+
+    p[0] = ( OPCODE_DATA >> 8 ) & 0xff;
+    p[1] = OPCODE_DATA & 0xff;
+    p[2] = ( blknum >> 8 ) & 0xff;
+    p[3] = blknum & 0xff;
+
+    instance->pkt_len = 4 + len;
+}
+
+/*  build_error
+    Construye en pkt el ERROR err con el texto de msgerr
+*/
+
 void build_error ( tftp_t *instance ) {
-    u_char *p;
-    memset ( &instance->buf, 0, MAX_BUFSIZE );
-    p          = instance->buf;
-    *( p + 0 ) = ( OPCODE_ERROR >> 8 ) & 0xff;
-    *( p + 1 ) = OPCODE_ERROR & 0xff;
-    *( p + 2 ) = ( instance->err >> 8 ) & 0xff;
-    *( p + 3 ) = instance->err & 0xff;
-    p += 4;
-    memcpy ( p, instance->msgerr, strlen ( instance->msgerr ) );
+    u_char *p   = instance->pkt;
+    size_t  len = strlen ( instance->msgerr ) + 1;
+
+    p[0] = ( OPCODE_ERROR >> 8 ) & 0xff;
+    p[1] = OPCODE_ERROR & 0xff;
+    p[2] = ( instance->err >> 8 ) & 0xff;
+    p[3] = instance->err & 0xff;
+    memcpy ( p + 4, instance->msgerr, len );
+
+    instance->pkt_len = 4 + len;
 }
 
+/*  build_ack_msg
+    Construye en pkt el ACK del ultimo bloque recibido en orden
+*/
+
 void build_ack_msg ( tftp_t *instance ) {
-    u_char *p;
-    memset ( instance->buf, 0, MAX_BUFSIZE );
-    p = instance->buf;
-
-    *( p + 0 ) = ( OPCODE_ACK >> 8 ) & 0xff;
-    *( p + 1 ) = OPCODE_ACK & 0xff;
-    *( p + 2 ) = ( instance->blknum >> 8 ) & 0xff;
-    *( p + 3 ) = instance->blknum & 0xff;
-    p += 4;
-    memset ( p, 0, BUFSIZE );
+    uint16_t blknum = BLOCK_WIRE ( HOT ( instance )->blknum );
+    u_char * p      = instance->pkt;
+
+    p[0] = ( OPCODE_ACK >> 8 ) & 0xff;
+    p[1] = OPCODE_ACK & 0xff;
+    p[2] = ( blknum >> 8 ) & 0xff;
+    p[3] = blknum & 0xff;
+
+    instance->pkt_len = ACK_BUFSIZE;
 }
 
-void dec_data ( tftp_t *instance ) {
-    u_char *p;
-    p = instance->buf;
-    p += 4;
-    memcpy ( instance->msg, p, BUFSIZE );
+/*  dec_oack
+    Aplica un OACK ya validado por parse_msg. Solo se aceptan opciones
+    pedidas, cada una una vez, y valores que no superen lo pedido; si todo va
+    bien se ajustan los buffers al blksize acordado y se guarda el windowsize
+    y el tsize.
+
+    Devuelve -1 si el OACK no es aceptable
+*/
+
+int dec_oack ( tftp_t *instance, const tftp_msg_t *msg ) {
+    char *   stop;
+    long     number;
+    long     blksize = BUFSIZE;
+    long     window  = 1;
+    int64_t  tsize   = instance->tsize;
+    unsigned i, j;
+
+    for ( i = 0; i < msg->nopts; i++ ) {
+        number = strtol ( msg->value[i], &stop, 10 );
+
+        if ( *stop != '\0' )
+            return -1;
+
+        /* Una opcion repetida es ambigua, no vale la ultima */
+
+        for ( j = 0; j < i; j++ )
+            if ( !strcasecmp ( msg->name[i], msg->name[j] ) )
+                return -1;
+
+        if ( !strcasecmp ( msg->name[i], OPT_BLKSIZE )
+             && instance->blksize_opt != 0 && number >= MIN_BLKSIZE
+             && number <= instance->blksize_opt )
+            blksize = number;
+
+        else if ( !strcasecmp ( msg->name[i], OPT_WINDOWSIZE )
+                  && instance->window_opt != 0 && number >= 1
+                  && number <= instance->window_opt )
+            window = number;
+
+        else if ( !strcasecmp ( msg->name[i], OPT_TSIZE )
+                  && instance->tsize_opt && number >= 0 )
+            tsize = number;
+
+        else
+            return -1;
+    }
+
+    instance->window = window;
+    instance->tsize  = tsize;
+
+    return blksize == instance->blksize ? 0 : tftp_resize ( instance, blksize );
 }
@@ -18,11 +18,20 @@
 #include <syslog.h>      //log del sistema
 #include <unistd.h>      //llamadas al sistema
 
+#include "cc.h"
+#include "coro.h"
+#include "output.h"
+#include "parse.h"
+#include "pool.h"
+#include "stats.h"
+#include "timer.h"
+
 #define OPCODE_RRQ 1
 #define OPCODE_WRQ 2
 #define OPCODE_DATA 3
 #define OPCODE_ACK 4
 #define OPCODE_ERROR 5
+#define OPCODE_OACK 6
 
 #define DEF_RETRIES 20
 #define DEF_TIMEOUT_SEC 1
@@ -31,6 +40,13 @@
 #define MAX_BUFSIZE ( 4 + BUFSIZE )
 #define ACK_BUFSIZE 4
 #define NAMESIZE 255
+#define MIN_BLKSIZE 8
+#define MAX_BLKSIZE 65464
+#define MAX_WINDOWSIZE 65535
+
+#define OPT_BLKSIZE "blksize"
+#define OPT_WINDOWSIZE "windowsize"
+#define OPT_TSIZE "tsize"
 
 #define MODE_OCTET "octet"
 #define MODE_NETASCII "netascii"
@@ -43,6 +59,7 @@
 #define ERR_UNKNOWN_TID 5
 #define ERR_FILE_EXISTS 6
 #define ERR_NO_SUCH_USER 7
+#define ERR_OPTION 8
 
 #define STATE_STANDBY 0
 #define STATE_DATA_SENT 1
@@ -55,28 +72,124 @@
 #define ACK_SENDING 1
 
 #define DEFAULT_SERVER_PORT 69
+#define DEFAULT_SERVER_PORT_STR "69"
+
+/*  En la trama el numero de bloque tiene 16 bits y tras 65535 vuelve a 0. La
+    sesion cuenta los bloques sin vuelta y solo pone en la trama los 16 bits
+    bajos; al recibir, el numero de la trama es el del primer bloque logico
+    desde base con esos 16 bits */
+
+#define BLOCK_WIRE( block ) ( ( uint16_t ) ( block ) )
+#define BLOCK_UNWRAP( base, wire )                                            \
+    ( ( uint64_t ) ( base )                                                   \
+      + ( uint16_t ) ( ( uint16_t ) ( wire ) - ( uint64_t ) ( base ) ) )
+
+#define RESULT_MSGSIZE ( NAMESIZE + 128 )
+
+struct tftp_table;
+struct tftp_loop;
+struct tftp_sock;
+struct tftp_race;
+struct tftp_ahead;
+struct tftp_reorder;
+
+/*  Descriptor vigilado por el epoll del bucle (loop.h): al estar listo se
+    llama a ready con los eventos. Va dentro de quien lo usa, como los
+    temporizadores: los sockets de las sesiones, la sesion que espera a otro
+    hilo y, en el demonio, el socket de control y sus conexiones */
+
+typedef struct tftp_watch {
+    void ( *ready ) ( struct tftp_loop *loop, struct tftp_watch *watch,
+                      uint32_t events );
+
+} tftp_watch_t;
+
+/*  Parte fria de una sesion. El numero de bloque, el estado, los reintentos y
+    el tid viven en su entrada de la tabla de sesiones (table.h) */
 
 typedef struct tftp {
     int                local_descriptor; /* descriptor de socket local */
     int                fd;               /* descriptor de archivo */
-    int                retries;          /* reintentos */
-    uint16_t           state;            /* estado */
-    uint16_t           tid;              /* id de transferencia */
+    struct tftp_table *table;            /* tabla con la parte caliente */
+    uint32_t           slot;             /* posicion en la tabla */
+    struct tftp_loop * loop;             /* bucle que lleva la sesion */
+    struct tftp_sock * sock;             /* socket propio o compartido */
+    void ( *recv ) ( struct tftp *instance, ssize_t received ); /* msg en buf */
+    void ( *retry ) ( struct tftp *instance );  /* reenvio propio, o NULL */
+    void ( *resume ) ( struct tftp *instance ); /* tras esperar al ritmo */
+    void ( *finish ) ( struct tftp *instance ); /* al terminar, o NULL */
+    tftp_coro_t        co;               /* corrutina del protocolo */
+    struct tftp_race * race;             /* carrera de direcciones, o NULL */
+    tftp_timer_t       timer;            /* reenvio del ultimo msg */
+    tftp_timer_t       pace;             /* espera por el limite de ritmo */
+    tftp_watch_t       wake;             /* espera a otro hilo (session_sleep) */
+    int                sleep_fd;         /* eventfd que espera, -1 = ninguno */
+    uint32_t           srtt;             /* rtt suavizado (us) */
+    uint32_t           rttvar;           /* variacion del rtt (us) */
+    uint32_t           rto;              /* timeout de reenvio (ms) */
+    uint64_t           sent_at;          /* envio del ultimo msg (us) */
+    bool               resent;           /* el ultimo msg se reenvio */
+    bool               done;             /* sesion terminada */
+    bool               connected;        /* socket conectado al tid remoto */
+    bool               failed;           /* termino con error */
+    bool               cancelled;        /* se cancelo, ni bien ni mal */
+    bool               held;             /* pre-abierta, sin turno aun */
+    bool               parked;           /* ACK retenido mientras held */
+    bool               compressed;       /* pedir el .gz y descomprimir */
+    bool               draining;         /* todo recibido, falta descomprimir */
+    bool               sequential;       /* fd sin pread, una tuberia (WRQ) */
+    struct tftp_ahead *ahead;            /* lectura anticipada, o NULL */
+    struct tftp_reorder *reorder;        /* DATA adelantados (RRQ), o NULL */
+    bool               refused;          /* el servidor respondio con ERROR */
+    bool               lost;             /* el servidor dejo de responder */
+    uint16_t           code;             /* codigo de ese ERROR */
+    char *             reason;           /* motivo del fallo (pool), o NULL */
     uint16_t           err;              /* tipo de error */
-    int32_t            blknum;           /* numero de bloque */
+    uint16_t           blksize;          /* tamaño de bloque negociado */
+    uint16_t           blksize_opt;      /* blksize pedido (0 = no negociar) */
+    uint16_t           window;           /* windowsize acordado (bloques) */
+    uint16_t           window_opt;       /* windowsize pedido (0 = no negociar) */
+    bool               tsize_opt;        /* pedir el tamaño (RFC 2349, RRQ) */
+    int64_t            tsize;            /* tamaño anunciado, -1 = no se sabe */
+    uint64_t           next;             /* siguiente bloque a enviar (WRQ) */
+    uint64_t           sent;             /* mayor bloque enviado (WRQ) */
+    uint64_t           last;             /* bloque final, 0 = sin leer (WRQ) */
+    uint32_t           unacked;          /* bloques sin confirmar (RRQ) */
+    tftp_cc_t          cc;               /* control de congestion (WRQ) */
+    tftp_bucket_t      rate;             /* limite de la transferencia */
+    uint8_t            prio;             /* clase de prioridad (fair.h) */
+    bool               queued;           /* esperando turno en el reparto */
+    bool               turn;             /* enviando en su turno */
+    int64_t            deficit;          /* bytes que le quedan del turno */
+    struct tftp *      sched_next;       /* siguiente en su cola de turno */
+    tftp_stats_t       stats;            /* volumen, duracion y latencias */
     char *             msgerr;           /*  msg de error  */
     char *             mode;             /* modo de transferencia */
-    char               file[NAMESIZE];   /* nombre del archivo */
-    struct sockaddr_in remote_addr;      /* estructura remota */
-    struct sockaddr_in local_addr;       /* estructura local */
-    struct timeval     timeout;          /* tiempo de espera para cada msg */
+    char *             file;             /* nombre del archivo (pool) */
+    char *             local;            /* nombre local (pool), NULL = file */
+    tftp_out_t         out;              /* archivo destino (RRQ) */
+    struct sockaddr_storage remote_addr; /* estructura remota */
+    struct sockaddr_storage local_addr;  /* estructura local */
     socklen_t          size_remote;      /* tamaño estructura remota */
     socklen_t          size_local;       /* tamaño estructura local */
-    u_char             msg[BUFSIZE];     /* tamaño max msg a enviar */
-    u_char             buf[MAX_BUFSIZE]; /* tamaño max msg a recibir */
+    u_char *           buf;              /* msg recibido (pool) */
+    u_char *           pkt;              /* ultimo msg enviado (pool) */
+    size_t             pkt_len;          /* longitud de pkt */
 
 } tftp_t;
 
+/*  Resultado de una transferencia para quien la lanzo. code es el codigo del
+    ERROR que mando el servidor, o -1 si el fallo fue local o no lo hubo */
+
+typedef struct tftp_result {
+    bool     ok;                      /* termino bien */
+    uint64_t bytes;                   /* bytes de datos transferidos */
+    uint64_t usec;                    /* duracion (us) */
+    int      code;                    /* codigo TFTP del servidor, o -1 */
+    char     message[RESULT_MSGSIZE]; /* motivo del fallo, "" si no hubo */
+
+} tftp_result_t;
+
 typedef struct tftp_listen {
     int                descriptor;       /* descriptor de socket escucha */
     uint16_t           state;            /* estado */
@@ -89,17 +202,31 @@ typedef struct tftp_listen {
 
 } tftp_tl;
 
-void err_log_exit ( int priority, const char *format, ... );
+tftp_t *tftp_new ( void );
+
+tftp_t *tftp_clone ( const tftp_t *model );
+
+void tftp_free ( tftp_t *instance );
+
+int tftp_set_file ( tftp_t *instance, const char *file );
+
+int tftp_set_local ( tftp_t *instance, const char *local );
+
+int tftp_resize ( tftp_t *instance, uint16_t blksize );
+
+int tftp_set_reason ( tftp_t *instance, const char *reason );
+
+void tftp_result ( const tftp_t *instance, tftp_result_t *result );
 
-void _err_log_exit ( int priority, const char *format, ... );
+size_t build_request ( tftp_t *instance, int type );
 
-void build_data_msg ( tftp_t *instance );
+void build_data_msg ( tftp_t *instance, uint16_t blknum, size_t len );
 
 void build_error ( tftp_t *instance );
 
 void build_ack_msg ( tftp_t *instance );
 
-void dec_data ( tftp_t *instance );
+int dec_oack ( tftp_t *instance, const tftp_msg_t *msg );
 
 void data_send ( tftp_t *instance );
 
@@ -3,10 +3,48 @@ CONFIG += console
 CONFIG -= app_bundle
 CONFIG -= qt
 
+LIBS += -lz -lpthread
+
 SOURCES += main.c \
     tftp.c \
-    cmdline.c
+    cmdline.c \
+    output.c \
+    pool.c \
+    table.c \
+    timer.c \
+    loop.c \
+    cc.c \
+    stats.c \
+    race.c \
+    batch.c \
+    sync.c \
+    inflate.c \
+    ahead.c \
+    reorder.c \
+    parse.c \
+    score.c \
+    daemon.c \
+    fair.c \
+    coro.c
 
 HEADERS += \
     tftp.h \
-    cmdline.h
+    cmdline.h \
+    output.h \
+    pool.h \
+    table.h \
+    timer.h \
+    loop.h \
+    cc.h \
+    stats.h \
+    race.h \
+    batch.h \
+    sync.h \
+    inflate.h \
+    ahead.h \
+    reorder.h \
+    parse.h \
+    score.h \
+    daemon.h \
+    fair.h \
+    coro.h
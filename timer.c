@@ -0,0 +1,189 @@
+#include "timer.h"
+
+#include <stddef.h>
+
+#define WHEEL_MASK ( WHEEL_SLOTS - 1 )
+#define LEVEL_SHIFT( level ) ( ( level ) * WHEEL_BITS )
+
+void wheel_init ( tftp_wheel_t *wheel, uint64_t now ) {
+    int level, i;
+
+    wheel->now = now;
+
+    for ( level = 0; level < WHEEL_LEVELS; level++ ) {
+        wheel->used[level] = 0;
+
+        for ( i = 0; i < WHEEL_SLOTS; i++ ) {
+            wheel->slot[level][i].next = &wheel->slot[level][i];
+            wheel->slot[level][i].prev = &wheel->slot[level][i];
+        }
+    }
+}
+
+/*  wheel_place
+    Elige nivel y ranura segun lo que falta para el vencimiento. Un nivel L
+    solo recibe temporizadores a 64^L ms o mas, asi nunca caen en la ranura
+    que se esta recorriendo.
+*/
+
+static void wheel_place ( tftp_wheel_t *wheel, tftp_timer_t *timer ) {
+    uint64_t      delta;
+    uint64_t      expires = timer->expires;
+    tftp_timer_t *head;
+    int           level = 0;
+    int           i;
+
+    if ( expires <= wheel->now )
+        expires = wheel->now + 1;
+
+    delta = expires - wheel->now;
+
+    while ( level < WHEEL_LEVELS - 1
+            && delta >= ( uint64_t ) 1 << LEVEL_SHIFT ( level + 1 ) )
+        level++;
+
+    /* Lo que no cabe en el ultimo nivel se acerca al maximo */
+
+    if ( delta >= ( uint64_t ) 1 << LEVEL_SHIFT ( WHEEL_LEVELS ) )
+        expires = wheel->now + ( ( uint64_t ) 1 << LEVEL_SHIFT ( WHEEL_LEVELS ) )
+                  - 1;
+
+    i    = ( expires >> LEVEL_SHIFT ( level ) ) & WHEEL_MASK;
+    head = &wheel->slot[level][i];
+
+    timer->next      = head;
+    timer->prev      = head->prev;
+    head->prev->next = timer;
+    head->prev       = timer;
+
+    wheel->used[level] |= ( uint64_t ) 1 << i;
+}
+
+/*  timer_arm
+    Arma (o rearma) el temporizador para que venza en expires (ms)
+*/
+
+void timer_arm ( tftp_wheel_t *wheel, tftp_timer_t *timer, uint64_t expires ) {
+    timer_cancel ( wheel, timer );
+
+    timer->expires = expires;
+    wheel_place ( wheel, timer );
+}
+
+/*  timer_cancel
+    Lo desarma si estaba armado. Si la ranura queda vacia se apaga su bit: en
+    ese caso el siguiente del temporizador es la propia cabecera, y su
+    posicion en wheel->slot dice el nivel y la ranura.
+*/
+
+void timer_cancel ( tftp_wheel_t *wheel, tftp_timer_t *timer ) {
+    tftp_timer_t *next = timer->next;
+    tftp_timer_t *head;
+    ptrdiff_t     i;
+
+    if ( next == NULL )
+        return;
+
+    timer->prev->next = next;
+    next->prev        = timer->prev;
+    timer->next       = NULL;
+    timer->prev       = NULL;
+
+    if ( next != next->next )
+        return;
+
+    /* next es la cabecera de una ranura que quedo vacia */
+
+    head = next;
+    i    = head - &wheel->slot[0][0];
+
+    if ( i >= 0 && i < WHEEL_LEVELS * WHEEL_SLOTS )
+        wheel->used[i / WHEEL_SLOTS] &= ~( ( uint64_t ) 1 << ( i % WHEEL_SLOTS ) );
+}
+
+bool timer_armed ( const tftp_timer_t *timer ) {
+    return timer->next != NULL;
+}
+
+/*  wheel_next
+    Milisegundos hasta el proximo vencimiento, para el tiempo de espera del
+    bucle de eventos. Si solo hay temporizadores en niveles altos, se despierta
+    en la proxima vuelta del nivel 0 para repartirlos. -1 si no hay ninguno.
+*/
+
+int wheel_next ( const tftp_wheel_t *wheel ) {
+    unsigned pos = ( wheel->now + 1 ) & WHEEL_MASK;
+    uint64_t used;
+    int      wrap  = WHEEL_SLOTS - ( wheel->now & WHEEL_MASK );
+    int      level = 1;
+    int      next  = -1;
+
+    used = wheel->used[0];
+
+    if ( used != 0 ) {
+        used = ( used >> pos ) | ( pos ? used << ( WHEEL_SLOTS - pos ) : 0 );
+        next = __builtin_ctzll ( used ) + 1;
+    }
+
+    for ( ; level < WHEEL_LEVELS; level++ )
+        if ( wheel->used[level] != 0 )
+            return next == -1 || wrap < next ? wrap : next;
+
+    return next;
+}
+
+/*  wheel_cascade
+    Reparte la ranura i del nivel hacia niveles mas bajos, ahora que su
+    vencimiento esta a menos de una vuelta del nivel anterior
+*/
+
+static void wheel_cascade ( tftp_wheel_t *wheel, int level, int i ) {
+    tftp_timer_t *head = &wheel->slot[level][i];
+    tftp_timer_t *timer;
+
+    while ( ( timer = head->next ) != head ) {
+        head->next        = timer->next;
+        timer->next->prev = head;
+        wheel_place ( wheel, timer );
+    }
+
+    wheel->used[level] &= ~( ( uint64_t ) 1 << i );
+}
+
+/*  wheel_advance
+    Avanza la rueda hasta now (ms) llamando al expire de cada temporizador
+    vencido. expire puede volver a armar el temporizador o cualquier otro.
+*/
+
+void wheel_advance ( tftp_wheel_t *wheel, uint64_t now ) {
+    tftp_timer_t *head, *timer;
+    int           level, i;
+
+    while ( wheel->now < now ) {
+        wheel->now++;
+
+        /* Al dar la vuelta un nivel, bajamos la ranura del siguiente */
+
+        for ( level = 1; level < WHEEL_LEVELS; level++ ) {
+            if ( ( wheel->now >> LEVEL_SHIFT ( level - 1 ) ) & WHEEL_MASK )
+                break;
+
+            i = ( wheel->now >> LEVEL_SHIFT ( level ) ) & WHEEL_MASK;
+
+            if ( wheel->used[level] & ( ( uint64_t ) 1 << i ) )
+                wheel_cascade ( wheel, level, i );
+        }
+
+        i = wheel->now & WHEEL_MASK;
+
+        if ( !( wheel->used[0] & ( ( uint64_t ) 1 << i ) ) )
+            continue;
+
+        head = &wheel->slot[0][i];
+
+        while ( ( timer = head->next ) != head ) {
+            timer_cancel ( wheel, timer );
+            timer->expire ( timer );
+        }
+    }
+}
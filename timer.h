@@ -0,0 +1,45 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS ( 1 << WHEEL_BITS ) /* ranuras por nivel */
+#define WHEEL_LEVELS 4                  /* 64^4 ms, unas 4.6 horas */
+
+/*  Temporizador intrusivo: va dentro del objeto que lo usa, armarlo o
+    cancelarlo es enlazarlo o desenlazarlo de una lista, O(1) */
+
+typedef struct tftp_timer {
+    struct tftp_timer *next;    /* siguiente en la ranura */
+    struct tftp_timer *prev;    /* anterior en la ranura */
+    uint64_t           expires; /* vencimiento (ms) */
+    void ( *expire ) ( struct tftp_timer *timer ); /* al vencer */
+
+} tftp_timer_t;
+
+/*  Rueda jerarquica con ticks de 1 ms. El nivel 0 tiene una ranura por ms,
+    cada nivel siguiente cubre 64 veces mas; al dar la vuelta un nivel se
+    reparten los temporizadores de la ranura que toca del nivel superior */
+
+typedef struct tftp_wheel {
+    uint64_t     now;                              /* ultimo ms procesado */
+    uint64_t     used[WHEEL_LEVELS];               /* ranuras no vacias */
+    tftp_timer_t slot[WHEEL_LEVELS][WHEEL_SLOTS]; /* cabeceras de lista */
+
+} tftp_wheel_t;
+
+void wheel_init ( tftp_wheel_t *wheel, uint64_t now );
+
+void timer_arm ( tftp_wheel_t *wheel, tftp_timer_t *timer, uint64_t expires );
+
+void timer_cancel ( tftp_wheel_t *wheel, tftp_timer_t *timer );
+
+bool timer_armed ( const tftp_timer_t *timer );
+
+int wheel_next ( const tftp_wheel_t *wheel );
+
+void wheel_advance ( tftp_wheel_t *wheel, uint64_t now );
+
+#endif